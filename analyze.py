@@ -1,32 +1,121 @@
 import sys
 import os
+import re
 import json
+import shutil
+import tempfile
+import multiprocessing
+from collections import Counter
+from concurrent.futures import ProcessPoolExecutor
 from clang import cindex
 from clang.cindex import TranslationUnit
-from feedback import reinforcement_loop
-from utils import compile_and_run_project, json_to_cpp
+from feedback import reinforcement_loop, candidate_sources, flat_state, evaluate_candidate, sanitizer_failure
+from correctness import outputs_match
+from objectives import improves
+from utils import benchmark_project, json_to_cpp
+from benchmark import format_stats
+from profiler import profile_project, match_symbol, DEFAULT_TOP_K
+from writeback import HEADER_EXTS
+from flagtune import autotune_flags
+from rewrites import rewrite_prepass
+from remarks import attribute_remarks, vectorized_counts
+from asmdiff import asm_diff as run_asm_diff, hot_symbols
+from pgo import pgo_pipeline
+from workloads import primary_args, format_workloads, thread_scaling
+from parallel import scan_parallel_loops, build_flags, OPENMP_FLAGS, parallel_threads
+from sanitize import SANITIZE_CANDIDATES
+from search import DEFAULT_BEAM_WIDTH, DEFAULT_PATIENCE, ABLATION
+from parsecache import PARSER
+from antipatterns import scan_function, format_findings
+from microbench import plan_benchmarks, benchmark_functions, profile_from_stats, format_functions
 
 # Point Python to libclang
 cindex.Config.set_library_file("/opt/homebrew/opt/llvm/lib/libclang.dylib")
 
+DEFAULT_CLANG_ARGS = [
+    "-std=c++17",
+    "-I/Applications/Xcode.app/Contents/Developer/Toolchains/XcodeDefault.xctoolchain/usr/include/c++/v1",
+    "-I/Library/Developer/CommandLineTools/usr/include/c++/v1",
+    "-isysroot", "/Library/Developer/CommandLineTools/SDKs/MacOSX.sdk"
+]
 
-def analyze_cpp_file(filepath, clang_args=None):
-    """Analyze a single C++ file and extract structure."""
-    headers, functions, diagnostics, classes, enums, globals = set(), {}, [], {}, {}, []
+# Worker processes for parsing translation units (default: one per core)
+PARSE_WORKERS = int(os.getenv("OPTIMIZER_PARSE_WORKERS", "0")) or os.cpu_count() or 1
+# Precompile system headers shared by several TUs before parsing them
+USE_PCH = os.getenv("OPTIMIZER_USE_PCH", "0") == "1"
+
+_index = None
+
+CLASS_KINDS = (cindex.CursorKind.CLASS_DECL, cindex.CursorKind.STRUCT_DECL, cindex.CursorKind.CLASS_TEMPLATE)
+
+
+def get_index():
+    """Per-process libclang Index, created once and reused for every TU."""
+    global _index
+    if _index is None:
+        _index = cindex.Index.create()
+    return _index
+
+
+def build_common_pch(filepaths, clang_args=None, out_dir="."):
+    """Precompile the system headers shared by several TUs, returning the .pch path (or None)."""
+    counts = Counter()
+    for fp in filepaths:
+        with open(fp, errors="replace") as f:
+            counts.update(set(re.findall(r"^\s*#\s*include\s*<([^>]+)>", f.read(), re.M)))
 
-    index = cindex.Index.create()
-    tu = index.parse(
+    common = sorted(h for h, n in counts.items() if n >= 2)
+    if not common:
+        return None
+
+    header = os.path.join(out_dir, "common_preamble.hpp")
+    with open(header, "w") as f:
+        f.write("\n".join(f"#include <{h}>" for h in common) + "\n")
+
+    tu = get_index().parse(header, args=(clang_args or DEFAULT_CLANG_ARGS) + ["-x", "c++-header"])
+    if any(d.severity >= 3 for d in tu.diagnostics):
+        print("⚠️  Could not precompile common headers, parsing without PCH")
+        return None
+
+    pch = header + ".pch"
+    tu.save(pch)
+    print(f"📦 Precompiled {len(common)} common header(s)")
+    return pch
+
+
+def analyze_cpp_file(filepath, clang_args=None, pch=None, project_headers=(), keep=False):
+    """Analyze a single C++ file and extract structure.
+
+    project_headers (paths of the project's own headers) are extracted too,
+    instead of being kept as includes; "locations" records where every
+    extracted item lives so results can be written back (see writeback.py).
+    keep parses through the process's ParseService, so the TU stays around
+    for cheap reparses of candidates (see parsecache.py).
+    """
+    args = list(clang_args if clang_args else DEFAULT_CLANG_ARGS)
+    if pch:
+        # Common headers come from the precompiled preamble instead of being reparsed
+        args.extend(["-include-pch", pch])
+
+    if keep:
+        return PARSER.parse(filepath, args, use=lambda tu: extract_structure(tu, filepath, project_headers))
+    tu = get_index().parse(
         filepath,
-        args=clang_args if clang_args else [
-            "-std=c++17",
-            "-I/Applications/Xcode.app/Contents/Developer/Toolchains/XcodeDefault.xctoolchain/usr/include/c++/v1",
-            "-I/Library/Developer/CommandLineTools/usr/include/c++/v1",
-            "-isysroot", "/Library/Developer/CommandLineTools/SDKs/MacOSX.sdk"
-        ],
+        args=args,
         options=TranslationUnit.PARSE_DETAILED_PROCESSING_RECORD
     )
+    return extract_structure(tu, filepath, project_headers)
+
 
-    recursiveSearch(tu.cursor, filepath, headers, functions, classes, enums, globals)
+def extract_structure(tu, filepath, project_headers=()):
+    """analyze_cpp_file's results for a parsed TU."""
+    headers, functions, diagnostics, classes, enums, globals = set(), {}, [], {}, {}, []
+    locations = {"functions": {}, "classes": {}, "enums": {}}
+    findings = []
+
+    files = ProjectSources(filepath, project_headers)
+    recursiveSearch(tu.cursor, filepath, headers, functions, classes, enums, globals, files=files, locations=locations,
+                    findings=findings)
 
     # Collect diagnostics
     severity_map = {0: "Ignored", 1: "Note", 2: "Warning", 3: "Error", 4: "Fatal"}
@@ -43,48 +132,118 @@ def analyze_cpp_file(filepath, clang_args=None):
         "diagnostics": diagnostics,
         "classes": classes,
         "enums": enums,
-        "globals": globals
+        "globals": globals,
+        "locations": locations,
+        "findings": findings
     }
 
 
-def recursiveSearch(node, filepath, headers, functions, classes, enums, globals, current_class=None, depth=0):
-    """Recursively search AST for code structures."""
+def load_source(filepath):
+    """Read a file once and index its line starts, so extents can be sliced by byte offset."""
+    with open(filepath, "rb") as f:
+        data = f.read()
+    line_starts = [0] + [m.end() for m in re.finditer(b"\n", data)]
+    return data, line_starts
+
+
+class ProjectSources:
+    """The files declarations are extracted from: the TU itself plus the project's headers."""
+
+    def __init__(self, filepath, project_headers=()):
+        self.main = filepath
+        self._paths = {os.path.realpath(p): p for p in [*project_headers, filepath]}
+        self._owners = {}
+        self._loaded = {}
+
+    def owner(self, name):
+        """Project path of a file as clang names it (None for system and other foreign files)."""
+        if name not in self._owners:
+            self._owners[name] = self._paths.get(os.path.realpath(name))
+        return self._owners[name]
+
+    def source(self, path):
+        """load_source(path), read at most once per TU."""
+        if path not in self._loaded:
+            self._loaded[path] = load_source(path)
+        return self._loaded[path]
+
+
+def extent_span(cursor, source):
+    """Byte range of the full lines covered by a cursor's extent, surrounding whitespace excluded."""
+    data, line_starts = source
+    begin = line_starts[cursor.extent.start.line - 1]
+    last = cursor.extent.end.line
+    end = line_starts[last] if last < len(line_starts) else len(data)
+    raw = data[begin:end]
+    start = begin + len(raw) - len(raw.lstrip())
+    return start, start + len(raw.strip())
+
+
+def extent_code(cursor, source):
+    """Source text of the full lines covered by a cursor's extent."""
+    start, end = extent_span(cursor, source)
+    return source[0][start:end].decode(errors="replace")
+
+
+def location(cursor, path, source):
+    """Where an extracted item lives: its file and the byte range extent_code returned."""
+    start, end = extent_span(cursor, source)
+    return {"file": path, "start": start, "end": end}
+
+
+def recursiveSearch(node, filepath, headers, functions, classes, enums, globals, current_class=None, depth=0,
+                    files=None, locations=None, findings=None):
+    """Recursively search AST for code structures.
+
+    Each file is read once (files) and every extent is sliced out of that
+    buffer; subtrees that belong to other files (system headers) are skipped
+    without being walked. locations, if given, receives the file and byte
+    range of every function, class, method and enum; findings, if given,
+    the anti-patterns found in every function body (see antipatterns.py).
+    """
+    if files is None:
+        files = ProjectSources(filepath)
+
     for child in node.get_children():
-        # Header includes
+        # Everything below a cursor from another file lives in that file too
+        location_file = child.location.file
+        path = files.owner(location_file.name) if location_file is not None else None
+        if path is None:
+            continue
+        source = files.source(path)
+        in_header = path != files.main
+
+        # Header includes (project headers are extracted instead)
         if child.kind == cindex.CursorKind.INCLUSION_DIRECTIVE:
-            if child.location.file and child.location.file.name == filepath:
+            included = child.get_included_file()
+            if included is None or files.owner(included.name) is None:
                 headers.add(child.spelling)
 
         # Global variables (only at file scope, depth <= 1)
         elif child.kind == cindex.CursorKind.VAR_DECL and current_class is None and depth <= 1:
-            if child.location.file and child.location.file.name == filepath:
-                with open(child.location.file.name) as f:
-                    lines = f.readlines()
-                    code = "".join(lines[child.extent.start.line - 1: child.extent.end.line])
-                    globals.append(code.strip())
+            globals.append(extent_code(child, source))
 
-        # Free functions
+        # Free functions (headers only contribute definitions, not prototypes)
         elif child.kind == cindex.CursorKind.FUNCTION_DECL and current_class is None:
-            if child.location.file and child.location.file.name == filepath:
-                with open(child.location.file.name) as f:
-                    lines = f.readlines()
-                    code = "".join(lines[child.extent.start.line - 1: child.extent.end.line])
-                    functions[child.spelling] = code.strip()
+            if not in_header or child.is_definition():
+                functions[child.spelling] = extent_code(child, source)
+                if locations is not None:
+                    locations["functions"][child.spelling] = location(child, path, source)
+            if findings is not None and child.is_definition():
+                findings.extend(scan_function(child, child.spelling, path, f"functions/{child.spelling}"))
+                findings.extend(scan_parallel_loops(child, child.spelling, path, f"functions/{child.spelling}"))
 
         # Classes
-        elif child.kind in (
-            cindex.CursorKind.CLASS_DECL,
-            cindex.CursorKind.STRUCT_DECL,
-            cindex.CursorKind.CLASS_TEMPLATE
-        ):
-            if child.location.file and child.location.file.name == filepath:
-                name = child.spelling if child.spelling else "<anonymous>"
-                with open(child.location.file.name) as f:
-                    lines = f.readlines()
-                    code = "".join(lines[child.extent.start.line - 1: child.extent.end.line])
-                classes[name] = {"definition": code.strip(), "methods": {}}
-                recursiveSearch(child, filepath, headers, functions, classes, enums, globals, current_class=name, depth=depth+1)
+        elif child.kind in CLASS_KINDS:
+            if in_header and not child.is_definition():
                 continue
+            name = child.spelling if child.spelling else "<anonymous>"
+            classes[name] = {"definition": extent_code(child, source), "methods": {}}
+            if locations is not None:
+                locations["classes"][name] = {"definition": location(child, path, source), "methods": {}}
+            recursiveSearch(child, filepath, headers, functions, classes, enums, globals, current_class=name, depth=depth+1,
+                            files=files, locations=locations, findings=findings)
+            continue
 
         # Methods
         elif child.kind in (
@@ -93,28 +252,139 @@ def recursiveSearch(node, filepath, headers, functions, classes, enums, globals,
             cindex.CursorKind.DESTRUCTOR,
             cindex.CursorKind.FUNCTION_TEMPLATE
         ):
-            if current_class and child.location.file and child.location.file.name == filepath:
-                with open(child.location.file.name) as f:
-                    lines = f.readlines()
-                    code = "".join(lines[child.extent.start.line - 1: child.extent.end.line])
-                    classes[current_class]["methods"][child.spelling] = code.strip()
+            if current_class:
+                classes[current_class]["methods"][child.spelling] = extent_code(child, source)
+                if locations is not None:
+                    locations["classes"][current_class]["methods"][child.spelling] = location(child, path, source)
+            if findings is not None and child.is_definition():
+                parent = child.semantic_parent
+                owner = current_class or (parent.spelling if parent is not None and parent.kind in CLASS_KINDS else "")
+                qualified = f"{owner}::{child.spelling}" if owner else child.spelling
+                item = f"classes/{owner}" if owner else f"functions/{child.spelling}"
+                findings.extend(scan_function(child, qualified, path, item))
+                findings.extend(scan_parallel_loops(child, qualified, path, item))
 
         # Enums
         elif child.kind == cindex.CursorKind.ENUM_DECL:
-            if child.location.file and child.location.file.name == filepath:
-                name = child.spelling if child.spelling else "<anonymous_enum>"
-                with open(child.location.file.name) as f:
-                    lines = f.readlines()
-                    code = "".join(lines[child.extent.start.line - 1: child.extent.end.line])
-                    enums[name] = code.strip()
+            name = child.spelling if child.spelling else "<anonymous_enum>"
+            enums[name] = extent_code(child, source)
+            if locations is not None:
+                locations["enums"][name] = location(child, path, source)
 
         # Don't recurse into function bodies to avoid capturing local variables
         if child.kind != cindex.CursorKind.FUNCTION_DECL:
-            recursiveSearch(child, filepath, headers, functions, classes, enums, globals, current_class, depth+1)
+            recursiveSearch(child, filepath, headers, functions, classes, enums, globals, current_class, depth+1,
+                            files=files, locations=locations, findings=findings)
+
+
+def find_project_headers(project_root):
+    """Header files of an uploaded project (extracted like sources, and written back in place)."""
+    found = []
+    for root, dirs, files in os.walk(project_root):
+        dirs[:] = sorted(d for d in dirs if not d.startswith('.') and d not in ['__pycache__', '__MACOSX'])
+        found += [os.path.join(root, f) for f in sorted(files) if f.endswith(HEADER_EXTS) and not f.startswith('.')]
+    return found
 
 
-def analyze_cpp_project(filepaths, with_ai=False, clang_args=None, run_args=None):
-    """Analyze entire C++ project and optionally optimize with AI."""
+def analyze_translation_units(filepaths, clang_args=None, use_pch=False, build_root=None, progress=None,
+                              project_headers=(), tu_args=None):
+    """Parse TUs across a process pool, yielding (filepath, results) in input order.
+
+    tu_args maps a TU's realpath to its own clang args (from
+    compile_commands.json); the shared PCH is only used by TUs parsed with
+    clang_args, since its macros must match. TUs parsed by pool workers
+    can't be handed back (libclang objects don't cross processes), so the
+    ParseService starts empty then: the first candidate check parses each
+    TU in full and keeps it, later checks reparse.
+    """
+    pch_dir = build_root or tempfile.mkdtemp(prefix="cppopt_pch_")
+    try:
+        pch = build_common_pch(filepaths, clang_args, pch_dir) if use_pch else None
+        parses = []
+        for fp in filepaths:
+            args = (tu_args or {}).get(os.path.realpath(fp), clang_args)
+            parses.append((fp, args, pch if args == clang_args else None, project_headers))
+
+        def report(fp):
+            print(f"📄 Analyzing: {fp}")
+            if progress:
+                progress({"stage": "analyze", "file": os.path.basename(fp)})
+
+        workers = min(PARSE_WORKERS, len(filepaths))
+        if workers <= 1:
+            # Parsed in this process: keep the TUs for re-analyzing candidates
+            for parse in parses:
+                report(parse[0])
+                yield parse[0], analyze_cpp_file(*parse, keep=True)
+            return
+
+        # spawn, not fork: the server process has job and candidate threads running.
+        # The TUs aren't re-parsed here to warm the ParseService: that would
+        # redo the pool's work and compete with the baseline timings
+        ctx = multiprocessing.get_context("spawn")
+        with ProcessPoolExecutor(max_workers=workers, mp_context=ctx) as pool:
+            futures = [pool.submit(analyze_cpp_file, *parse) for parse in parses]
+            for fp, future in zip(filepaths, futures):
+                report(fp)
+                yield fp, future.result()
+    finally:
+        if not build_root:
+            shutil.rmtree(pch_dir, ignore_errors=True)
+
+
+def analyze_cpp_project(filepaths, with_ai=False, clang_args=None, run_args=None, parallel_candidates=1,
+                        work_dir=None, build_root=None, progress=None, use_pch=USE_PCH,
+                        profile_hotspots=True, top_k=DEFAULT_TOP_K, output_files=None, float_tolerance=0.0,
+                        project_root=None, tune_flags=False, allow_fast_math=False, pgo=False,
+                        microbench=False, bench_inputs=None, tu_args=None, objectives=None,
+                        rewrites=True, asm_diff=False, workloads=None, parallelize=False,
+                        sanitize=SANITIZE_CANDIDATES, beam_width=DEFAULT_BEAM_WIDTH, patience=DEFAULT_PATIENCE,
+                        ablation=ABLATION, known_best=None):
+    """Analyze entire C++ project and optionally optimize with AI.
+
+    Programs run from work_dir and binaries are built under build_root, so
+    several projects can be processed concurrently in one server process.
+    progress, if given, is called with a dict for each pipeline stage.
+    TUs are parsed in parallel; use_pch precompiles their shared system headers.
+    With profile_hotspots the baseline is profiled first and only the top_k
+    hot functions are sent to the AI. Candidates must reproduce the baseline's
+    output (and output_files) to be accepted, see correctness.py.
+    With project_root the project's headers are analyzed too and candidates
+    are built as edits to the original files (see writeback.py), so the
+    result keeps the project's TU structure.
+    tune_flags searches extra build flags first (see flagtune.py); the AI loop
+    then builds with the best ones, so source and flag tuning add up.
+    pgo finally builds the best source with PGO/BOLT (see pgo.py) and reports
+    the stages, the profile and a build recipe in ai_feedback["pgo"].
+    microbench times individual functions in a generated harness instead of
+    the whole program (see microbench.py), with bench_inputs ({function: C++
+    argument list}) for parameters that can't be generated; programs without
+    a main or that need interactive input become optimizable this way.
+    tu_args gives TUs their own parse flags (see compdb.py).
+    objectives ({name: weight}, see objectives.py) decides what the AI loop
+    optimizes; ai_feedback["pareto"] lists the non-dominated candidates.
+    rewrites first tries the mechanical rewrites of rewrites.py, each kept
+    only if it helps; the AI loop starts from the rewritten code.
+    Builds collect the loop vectorizer's remarks (see remarks.py), which are
+    attributed to the extracted functions and shown to the model.
+    asm_diff disassembles the hot and changed functions of the baseline and
+    the best build (see asmdiff.py) into ai_feedback["asm"].
+    workloads (see workloads.py) benchmarks every stage on a matrix of
+    arguments and thread counts instead of run_args, judged on its aggregate;
+    profiling, PGO training and the assembly diff use its last workload.
+    parallelize (see parallel.py) builds with OpenMP, shows the model the
+    loops whose iterations look independent, times candidates at 1 and
+    parallel_threads() threads unless workloads are given, and race-checks
+    multithreaded candidates with ThreadSanitizer.
+    sanitize builds AI candidates with ASan+UBSan (and TSan for threaded
+    code) while they are timed, and rejects any with a report.
+    beam_width and patience configure the AI loop's search (see search.py);
+    ablation times multi-item candidates one item at a time and ends it with
+    a composite of the best version of each item.
+    known_best, the best code state of an earlier run of the same sources
+    (see history.py), is checked first; if it still matches the baseline's
+    output and is faster it becomes the result without calling the model.
+    """
     project_results = {
         "headers": set(),
         "functions": {},
@@ -122,53 +392,289 @@ def analyze_cpp_project(filepaths, with_ai=False, clang_args=None, run_args=None
         "enums": {},
         "globals": [],
         "diagnostics": [],
+        "findings": [],
     }
+    seen_findings = set()
 
-    # Analyze each file
-    for fp in filepaths:
-        if not (fp.endswith(".cpp") or fp.endswith(".cc")):
-            continue  # skip headers
-        
-        print(f"📄 Analyzing: {fp}")
-        results = analyze_cpp_file(fp, clang_args)
-        
+    locations = {"functions": {}, "classes": {}, "enums": {}}
+    project_headers = find_project_headers(project_root) if project_root else []
+
+    # Analyze each file (merged in input order, so results are deterministic)
+    sources = [fp for fp in filepaths if fp.endswith(".cpp") or fp.endswith(".cc")]  # skip headers
+    # Kept for reparsing candidates' TUs with the flags they were analyzed with
+    parse_args = {fp: (tu_args or {}).get(os.path.realpath(fp), clang_args) for fp in sources}
+    for fp, results in analyze_translation_units(sources, clang_args, use_pch, build_root, progress,
+                                                 project_headers, tu_args):
         project_results["headers"].update(results["headers"])
         project_results["functions"].update(results["functions"])
         project_results["classes"].update(results["classes"])
         project_results["enums"].update(results["enums"])
         project_results["globals"].extend(results["globals"])
         project_results["diagnostics"].extend(results["diagnostics"])
+        for kind in ("functions", "classes", "enums"):
+            locations[kind].update(results["locations"][kind])
+        # Headers are seen by every TU that includes them
+        for finding in results["findings"]:
+            if finding["rule"] == "parallel_loop" and not parallelize:
+                continue
+            key = (finding["file"], finding["line"], finding["rule"])
+            if key not in seen_findings:
+                seen_findings.add(key)
+                project_results["findings"].append(finding)
 
     # Convert headers set to sorted list for JSON serialization
     project_results["headers"] = sorted(project_results["headers"])
+    for finding in project_results["findings"]:
+        finding["file"] = os.path.relpath(finding["file"], project_root) if project_root \
+            else os.path.basename(finding["file"])
+    if project_results["findings"]:
+        print(f"\n🔎 {len(project_results['findings'])} static finding(s):")
+        print(format_findings(project_results["findings"]))
 
-    # Compile and benchmark baseline
-    print("\n🔨 Compiling baseline...")
-    baseline = compile_and_run_project(filepaths, run_args=run_args, clang_args=clang_args)
-    
-    if baseline is not None:
-        print(f"⏱️  Baseline runtime: {baseline:.6f}s")
+    # Function-level mode: the harness replaces the whole-program run everywhere
+    plan = None
+    if microbench:
+        plan = plan_benchmarks(project_results["functions"], bench_inputs)
+        if not plan:
+            print("⚠️  No function could be benchmarked (supply bench_inputs), timing the whole program")
+        elif tune_flags or pgo:
+            print("ℹ️  Flag tuning and PGO need the whole program, skipped in microbenchmark mode")
+            tune_flags = pgo = False
+        if plan and workloads:
+            print("ℹ️  Workloads time the whole program, ignored in microbenchmark mode")
+            workloads = None
+        if plan and parallelize:
+            print("ℹ️  Parallelization needs the whole program, skipped in microbenchmark mode")
+            parallelize = False
+            project_results["findings"] = [f for f in project_results["findings"] if f["rule"] != "parallel_loop"]
+    if parallelize:
+        clang_args = list(clang_args or []) + OPENMP_FLAGS
+        if not workloads and run_args is not None:
+            workloads = thread_scaling(run_args, parallel_threads())
+        loops = sum(f["rule"] == "parallel_loop" for f in project_results["findings"])
+        threads = sorted({r["threads"] for r in workloads["runs"]}) if workloads else [1]
+        print(f"🧵 Parallelization: {loops} loop(s) with independent iterations, "
+              f"timed at {'/'.join(map(str, threads))} thread(s)")
+
+    # Single-run stages (profiling, PGO training) use the production-size workload
+    run_args = primary_args(workloads, run_args)
+
+    if plan:
+        print(f"\n🔬 Microbenchmarking {len(plan)} function benchmark(s)...")
+        if progress:
+            progress({"stage": "baseline"})
+        baseline = benchmark_functions(filepaths, project_results, plan, clang_args, build_dir=build_root,
+                                       cwd=work_dir)
+        if baseline is not None:
+            print(f"⏱️  Baseline: {format_functions(baseline)}")
+        else:
+            print("⚠️  Baseline microbenchmark failed")
+        if progress:
+            progress({"stage": "baseline_done", "time": baseline["median"] if baseline else None})
     else:
-        print("⚠️  Baseline compilation failed or no runtime available")
+        # Compile and benchmark baseline
+        print("\n🔨 Compiling baseline...")
+        if progress:
+            progress({"stage": "baseline"})
+        baseline = benchmark_project(filepaths, run_args=run_args, clang_args=clang_args,
+                                     build_dir=build_root, cwd=work_dir, output_files=output_files,
+                                     workloads=workloads)
+    
+        if baseline is not None:
+            print(f"⏱️  Baseline runtime: {format_stats(baseline)}")
+            if format_workloads(baseline):
+                print(f"📈 Workloads ({workloads['aggregate']}): {format_workloads(baseline)}")
+            baseline["remarks"] = attribute_remarks(baseline.get("remarks"), project_results, filepaths)
+            counts = vectorized_counts(baseline["remarks"]).values()
+            if counts:
+                print(f"🧮 Vectorizer: {sum(c[0] for c in counts)} loop(s) vectorized, "
+                      f"{sum(c[1] for c in counts)} not, in the extracted code")
+        else:
+            print("⚠️  Baseline compilation failed or no runtime available")
+        if progress:
+            progress({"stage": "baseline_done", "time": baseline["median"] if baseline else None})
+
+    # Flag tuning runs first: source edits are then judged with the flags they'll ship with
+    baseline_args = clang_args
+    flag_tuning = None
+    start_stats = baseline
+    if tune_flags and baseline is not None:
+        print("\n🎛️  Autotuning build flags...")
+        flag_tuning = autotune_flags(filepaths, run_args=run_args, clang_args=clang_args, baseline_stats=baseline,
+                                     build_root=build_root, cwd=work_dir, output_files=output_files,
+                                     float_tolerance=float_tolerance, allow_fast_math=allow_fast_math,
+                                     progress=progress, workloads=workloads, objectives=objectives)
+        clang_args = list(clang_args or []) + flag_tuning["flags"]
+        start_stats = flag_tuning["stats"]
+        start_stats["remarks"] = attribute_remarks(start_stats.get("remarks"), project_results, filepaths)
+        if progress:
+            progress({"stage": "flags_done", "flags": flag_tuning["flags"], "time": start_stats["median"]})
+
+    # Profile the baseline so the AI works on the code that actually takes the time
+    profile = profile_from_stats(baseline) if plan else None
+    if with_ai and profile_hotspots and baseline is not None and not plan:
+        print("\n🔥 Profiling hotspots...")
+        if progress:
+            progress({"stage": "profile"})
+        profile = profile_project(filepaths, run_args=run_args, clang_args=clang_args,
+                                  build_dir=build_root, cwd=work_dir)
+        if profile:
+            for row in profile[:top_k]:
+                print(f"   {row['self_pct']:6.2f}% self / {row['total_pct']:6.2f}% total  {row['symbol']}")
+
+    # Candidates are written back into a copy of the project instead of one combined file
+    layout = None
+    if project_root:
+        layout = {"root": str(project_root), "sources": filepaths, "locations": locations, "parse_args": parse_args}
 
     # Run AI optimization if requested
     if with_ai and (project_results["functions"] or project_results["classes"]):
-        print("\n🤖 Starting AI optimization loop...")
-        best_json, best_time = reinforcement_loop(
+        # A known-good result for these sources stands in for the model if it still holds
+        reused = None
+        if known_best and start_stats is not None:
+            print("\n♻️  Checking the known-good result of an earlier run...")
+            known_args = list(clang_args or []) + build_flags(known_best) if parallelize else clang_args
+            stats = evaluate_candidate(known_best, "known_best", known_args, run_args, work_dir=work_dir,
+                                       build_root=build_root, output_files=output_files, layout=layout,
+                                       original_json=project_results, microbench=plan, workloads=workloads)
+            ok, reason = outputs_match(start_stats.get("output"), stats.get("output"), float_tolerance) \
+                if stats is not None else (False, "build or run failed")
+            if ok and not improves(start_stats, stats, start_stats, objectives):
+                ok, reason = False, "no significant improvement"
+            # The sanitizer gate of this run, which may check more than the run that found it
+            failure = sanitizer_failure(known_best, "known_best", known_args, run_args, work_dir, build_root, layout,
+                                        project_results, output_files, sanitize, parallelize) \
+                if ok and not plan else None
+            if failure:
+                ok, reason = False, failure.splitlines()[0]
+            if ok:
+                print(f"♻️  Reusing it, no model calls: {format_stats(start_stats)} -> {format_stats(stats)}")
+                reused = stats
+            else:
+                print(f"⚠️  Known-good result no longer holds ({reason}), "
+                      f"optimizing from scratch")
+            if progress:
+                progress({"stage": "known_best_done", "reused": reused is not None,
+                          "time": stats["median"] if stats else None})
+
+        # Deterministic rewrites first: the model then doesn't spend iterations on them
+        rewriting = None
+        if rewrites and start_stats is not None and reused is None:
+            print("\n🪄  Trying mechanical rewrites...")
+            rewriting = rewrite_prepass(project_results, start_stats, clang_args=clang_args, run_args=run_args,
+                                        work_dir=work_dir, build_root=build_root, output_files=output_files,
+                                        float_tolerance=float_tolerance, layout=layout, microbench=plan,
+                                        objectives=objectives, progress=progress, workloads=workloads,
+                                        sanitize=sanitize, parallelize=parallelize)
+            start_stats = rewriting["stats"]
+            if progress:
+                progress({"stage": "rewrites_done", "time": start_stats["median"],
+                          "rewrites": [t["rewrite"] for t in rewriting["trials"] if t["accepted"]]})
+
+        if reused is None:
+            print("\n🤖 Starting AI optimization loop...")
+        best_json, best_time, best_stats, front = reinforcement_loop(
             "project",
             project_results,
-            baseline,
-            iterations=5,
+            reused or start_stats,
+            iterations=0 if reused else 5,
             clang_args=clang_args,
-            run_args=run_args
+            run_args=run_args,
+            parallel=parallel_candidates,
+            work_dir=work_dir,
+            build_root=build_root,
+            progress=progress,
+            profile=profile,
+            top_k=top_k,
+            output_files=output_files,
+            float_tolerance=float_tolerance,
+            layout=layout,
+            microbench=plan,
+            objectives=objectives,
+            start_json=known_best if reused else rewriting["json"] if rewriting else None,
+            workloads=workloads,
+            parallelize=parallelize,
+            # A reused result passed the sanitizer gate above, and nothing else runs
+            sanitize=sanitize and reused is None,
+            beam_width=beam_width,
+            patience=patience,
+            ablation=ablation
         )
+        # The best code may need more than OpenMP to link (TBB for parallel algorithms)
+        parallel_flags = OPENMP_FLAGS + build_flags(best_json) if parallelize else []
+        clang_args = list(clang_args or []) + [f for f in parallel_flags if f not in (clang_args or [])]
         project_results["ai_feedback"] = {
             "best_json": best_json,
-            "best_time": best_time
+            "best_time": best_time,
+            "baseline_time": baseline["median"] if baseline else None,
+            "baseline_stats": baseline,
+            "best_stats": best_stats,
+            "profile": profile,
+            "layout": layout,
+            "build_flags": (flag_tuning["flags"] if flag_tuning else []) + parallel_flags,
+            "flag_tuning": flag_tuning["trials"] if flag_tuning else None,
+            "rewrites": rewriting["trials"] if rewriting else None,
+            "microbench": plan,
+            "objectives": objectives,
+            "workloads": workloads,
+            "pareto": front,
+            "reused": reused is not None
         }
     elif with_ai:
         print("⚠️ No functions or classes found to optimize")
 
+    # Codegen of the hot functions, before PGO so it shows what the source and flags changed
+    if asm_diff and "ai_feedback" in project_results and not plan:
+        feedback = project_results["ai_feedback"]
+        print("\n🔍 Disassembling hot functions...")
+        if progress:
+            progress({"stage": "asm"})
+        sandbox = tempfile.mkdtemp(prefix="asm_src_", dir=build_root)
+        try:
+            best_sources, best_args = candidate_sources(feedback["best_json"], sandbox, "project_combined",
+                                                        clang_args, layout, project_results)
+            before, after = flat_state(project_results), flat_state(feedback["best_json"])
+            changed = [k.split("/", 1)[1] for k in after if k.startswith("functions/") and after[k] != before.get(k)]
+            for name, data in feedback["best_json"].get("classes", {}).items():
+                old = project_results.get("classes", {}).get(name, {})
+                methods = data.get("methods", {}) if isinstance(data, dict) else {}
+                changed += [f"{name}::{m}" for m, code in methods.items()
+                            if code != (old.get("methods", {}) if isinstance(old, dict) else {}).get(m)]
+            hot = [row for row in profile or [] if match_symbol(row["symbol"], project_results)]
+            feedback["asm"] = run_asm_diff(filepaths, baseline_args, best_sources, best_args,
+                                           hot_symbols(hot, changed), run_args=run_args, cwd=work_dir,
+                                           build_root=build_root, profile=hot)
+        finally:
+            shutil.rmtree(sandbox, ignore_errors=True)
+    elif asm_diff and plan:
+        print("ℹ️  The assembly diff needs the whole program, skipped in microbenchmark mode")
+
+    # PGO/BOLT on top of the best source and flags
+    if pgo and with_ai and "ai_feedback" in project_results and baseline is not None and run_args is not None:
+        feedback = project_results["ai_feedback"]
+        sandbox = tempfile.mkdtemp(prefix="pgo_src_", dir=build_root)
+        try:
+            pgo_sources, pgo_args = candidate_sources(feedback["best_json"], sandbox, "project_combined",
+                                                      clang_args, layout, project_results)
+            if layout:
+                recipe_sources = [os.path.relpath(fp, layout["root"]) for fp in layout["sources"]]
+            else:
+                recipe_sources = ["project_combined.cpp"]
+            result = pgo_pipeline(pgo_sources, run_args=run_args, clang_args=pgo_args, baseline_stats=baseline,
+                                  start_stats=feedback["best_stats"], build_root=build_root, cwd=work_dir,
+                                  output_files=output_files, float_tolerance=float_tolerance,
+                                  recipe_sources=recipe_sources, recipe_flags=feedback["build_flags"],
+                                  progress=progress, workloads=workloads)
+        finally:
+            shutil.rmtree(sandbox, ignore_errors=True)
+        feedback["pgo"] = result
+        if result["stats"] is not feedback["best_stats"]:
+            feedback["best_stats"] = result["stats"]
+            feedback["best_time"] = result["stats"]["median"]
+
+    for root in (project_root, build_root):
+        if root:
+            PARSER.discard(root)
     return project_results
 
 
@@ -0,0 +1,170 @@
+import re
+from clang import cindex
+
+# Rule-based performance findings on the libclang AST of each extracted
+# function: problems that are cheap to spot deterministically (and often to
+# fix) without asking the model. Severity is a static estimate; code inside
+# loops, and nested loops most of all, weighs more.
+
+LOOP_KINDS = (cindex.CursorKind.FOR_STMT, cindex.CursorKind.WHILE_STMT, cindex.CursorKind.DO_STMT,
+              cindex.CursorKind.CXX_FOR_RANGE_STMT)
+REFERENCE_TYPES = (cindex.TypeKind.LVALUEREFERENCE, cindex.TypeKind.RVALUEREFERENCE, cindex.TypeKind.POINTER)
+CONTAINER = re.compile(r"\bstd::(?:__\w+::)?(vector|basic_string|string|map|multimap|set|multiset|"
+                       r"unordered_map|unordered_set|list|deque)<")
+NODE_CONTAINER = re.compile(r"\bstd::(?:__\w+::)?(map|multimap|set|multiset|list)<")
+GROWABLE = re.compile(r"\bstd::(?:__\w+::)?(vector|basic_string|string)\b")
+ALLOC_FUNCTIONS = {"malloc", "calloc", "realloc", "make_unique", "make_shared", "strdup"}
+SEVERITIES = ["low", "medium", "high"]
+
+RULES = {
+    "container_by_value": ("medium", "container parameter '{name}' is passed by value (copied on every call)",
+                           "pass it as const& (or move into it)"),
+    "endl_in_loop": ("high", "std::endl inside a loop flushes the stream every iteration",
+                     "write '\\n' and flush once after the loop"),
+    "push_back_without_reserve": ("medium", "'{name}' grows with {call} in a loop without reserve()",
+                                  "call {name}.reserve(n) before the loop"),
+    "node_container_in_loop": ("medium", "node-based container '{name}' ({kind}) is used inside a loop",
+                               "consider std::unordered_map, a sorted std::vector or a flat array"),
+    "virtual_call_in_loop": ("low", "virtual call to '{name}' inside a loop prevents inlining",
+                             "hoist the dispatch out of the loop, or make the type final / use templates"),
+    "allocation_in_loop": ("medium", "heap allocation ({name}) inside a loop",
+                           "allocate once outside the loop and reuse the storage"),
+}
+
+
+def _type_spelling(cursor):
+    return cursor.type.get_canonical().spelling if cursor.type else ""
+
+
+def _object_name(call):
+    """Variable a member call like v.push_back(x) is made on (cursor or None)."""
+    for child in call.get_children():
+        if child.kind == cindex.CursorKind.MEMBER_REF_EXPR:
+            # The first reference below the method is the object (a local or a member)
+            for base in child.get_children():
+                for node in base.walk_preorder():
+                    if node.kind in (cindex.CursorKind.DECL_REF_EXPR, cindex.CursorKind.MEMBER_REF_EXPR) \
+                            and node.referenced is not None:
+                        return node.referenced
+            return None
+    return None
+
+
+def scan_function(cursor, name, path, item):
+    """Findings for one function definition: list of {"rule", "severity", "message", "fix", "function",
+    "item", "file", "line", "name"}. item is the code-state key it belongs to ("functions/f" or
+    "classes/C"), name what the finding is about (a parameter, container or callee; None for endl)."""
+    findings = []
+    reserved = set()
+    grown = []
+
+    def add(rule, node, loop_depth, **fields):
+        base, message, fix = RULES[rule]
+        level = min(SEVERITIES.index(base) + max(0, loop_depth - 1), len(SEVERITIES) - 1)
+        findings.append({
+            "rule": rule,
+            "severity": SEVERITIES[level],
+            "message": message.format(**fields),
+            "fix": fix.format(**fields),
+            "function": name,
+            "item": item,
+            "file": path,
+            "line": node.location.line,
+            "name": fields.get("name"),
+        })
+
+    for param in cursor.get_arguments():
+        if param.type.kind not in REFERENCE_TYPES and CONTAINER.search(_type_spelling(param)):
+            add("container_by_value", param, 0, name=param.spelling)
+
+    seen = set()
+
+    def walk(node, loop_depth):
+        for child in node.get_children():
+            kind = child.kind
+            if kind == cindex.CursorKind.LAMBDA_EXPR:
+                continue
+            if loop_depth:
+                visit(child, loop_depth)
+            elif kind == cindex.CursorKind.CALL_EXPR and child.spelling == "reserve":
+                target = _object_name(child)
+                if target is not None:
+                    reserved.add(target.hash)
+            if kind in LOOP_KINDS:
+                children = list(child.get_children())
+                if kind == cindex.CursorKind.CXX_FOR_RANGE_STMT and children:
+                    # The range expression is evaluated once; only the body repeats
+                    for c in children[:-1]:
+                        walk_once(c, loop_depth)
+                    walk_body(children[-1], loop_depth + 1)
+                else:
+                    walk(child, loop_depth + 1)
+            else:
+                walk(child, loop_depth)
+
+    def walk_once(node, loop_depth):
+        if loop_depth:
+            visit(node, loop_depth)
+        walk(node, loop_depth)
+
+    def walk_body(node, loop_depth):
+        visit(node, loop_depth)
+        walk(node, loop_depth)
+
+    def visit(node, loop_depth):
+        kind = node.kind
+        if kind == cindex.CursorKind.DECL_REF_EXPR and node.spelling == "endl":
+            key = ("endl", node.location.line)
+            if key not in seen:
+                seen.add(key)
+                add("endl_in_loop", node, loop_depth)
+        elif kind == cindex.CursorKind.CALL_EXPR:
+            callee = node.referenced
+            if node.spelling == "reserve":
+                target = _object_name(node)
+                if target is not None:
+                    reserved.add(target.hash)
+            elif node.spelling in ("push_back", "emplace_back"):
+                target = _object_name(node)
+                if target is not None and GROWABLE.search(_type_spelling(target)):
+                    grown.append((target, node, loop_depth))
+            elif node.spelling in ALLOC_FUNCTIONS:
+                add("allocation_in_loop", node, loop_depth, name=node.spelling)
+            elif callee is not None and callee.kind == cindex.CursorKind.CXX_METHOD and callee.is_virtual_method():
+                key = ("virtual", callee.spelling, node.location.line)
+                if key not in seen:
+                    seen.add(key)
+                    add("virtual_call_in_loop", node, loop_depth, name=callee.spelling)
+        elif kind == cindex.CursorKind.CXX_NEW_EXPR:
+            add("allocation_in_loop", node, loop_depth, name="new")
+        elif kind == cindex.CursorKind.VAR_DECL and CONTAINER.search(_type_spelling(node)) \
+                and node.type.kind not in REFERENCE_TYPES:
+            add("allocation_in_loop", node, loop_depth, name=f"{node.spelling} constructed every iteration")
+        elif kind in (cindex.CursorKind.DECL_REF_EXPR, cindex.CursorKind.MEMBER_REF_EXPR) \
+                and node.referenced is not None:
+            match = NODE_CONTAINER.search(_type_spelling(node.referenced))
+            key = ("node", node.referenced.hash)
+            if match and key not in seen:
+                seen.add(key)
+                add("node_container_in_loop", node, loop_depth, name=node.spelling, kind=f"std::{match.group(1)}")
+
+    walk(cursor, 0)
+
+    # Decided at the end: reserve() may come anywhere before in the function
+    reported = set()
+    for target, node, loop_depth in grown:
+        if target.hash not in reserved and target.hash not in reported:
+            reported.add(target.hash)
+            add("push_back_without_reserve", node, loop_depth, name=target.spelling, call=node.spelling)
+    return findings
+
+
+def most_severe(findings, limit):
+    """The limit most severe findings, most severe first (stable within a level)."""
+    return sorted(findings, key=lambda f: -SEVERITIES.index(f["severity"]))[:limit]
+
+
+def format_findings(findings, limit=10):
+    """Prompt/log lines for the most severe findings."""
+    return "\n".join(f"- [{f['severity']}] {f['function']} (line {f['line']}): {f['message']}; fix: {f['fix']}"
+                     for f in most_severe(findings, limit))
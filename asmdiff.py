@@ -0,0 +1,233 @@
+import difflib
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+from utils import compile_project
+from benchmark import run_once, DEFAULT_TIMEOUT
+from profiler import split_symbol, PERF_FREQUENCY
+
+# Codegen review of a result: the hot functions of the baseline and best
+# builds disassembled side by side, with instruction counts, the widest SIMD
+# registers the code uses and, where perf can sample the binaries, the share
+# of samples per instruction and per loop (backward branch). Tells a real
+# vectorization win apart from a speedup that happened by accident.
+OBJDUMP = os.getenv("OPTIMIZER_OBJDUMP", "objdump")
+MAX_ASM_FUNCTIONS = 8
+# Instructions with at least this share of a binary's samples are marked in listings
+HOT_INSTRUCTION_PCT = 1.0
+
+HEADER = re.compile(r"^([0-9a-f]+) <(.+)>:$")
+INSTRUCTION = re.compile(r"^\s*([0-9a-f]+):\s+(.+?)\s*$")
+# Direct conditional and unconditional jumps: x86 j*, arm64 b, b.<cond>, cbz/cbnz and tbz/tbnz
+# (whose target follows the tested register and bit)
+BRANCH = re.compile(r"^(?:j\w+|b(?:\.\w+)?|cbn?z|tbn?z)\s+(?:[^,<]+,\s*)*([0-9a-f]+) <")
+VECTOR_REGISTERS = [(512, re.compile(r"%zmm\d+")), (256, re.compile(r"%ymm\d+")),
+                    (128, re.compile(r"%xmm\d+|\bv\d+\.\d+[bhsd]\b"))]
+# Scalar SSE/AVX arithmetic on xmm registers (addss, vmulsd, cvtsi2sd, ...)
+SCALAR_SSE = re.compile(r"^v?\w*(ss|sd)\b|^v?cvt\w*s[sd]\b|^v?u?comis[sd]\b|^v?movd\b|^v?movq\b")
+
+
+def disassemble(exe):
+    """{demangled symbol: [(address, instruction)]} of a binary's code."""
+    result = subprocess.run([OBJDUMP, "-d", "-C", "--no-show-raw-insn", exe], capture_output=True, text=True)
+    functions, current = {}, None
+    for line in result.stdout.splitlines():
+        m = HEADER.match(line)
+        if m:
+            current = functions.setdefault(m.group(2), [])
+            continue
+        m = INSTRUCTION.match(line)
+        if m and current is not None and not m.group(2).startswith("(bad)"):
+            current.append((int(m.group(1), 16), m.group(2)))
+    return functions
+
+
+def simd_width(instructions):
+    """(widest vector register width in bits used by packed instructions, vector instruction count)."""
+    width, count = 0, 0
+    for _, text in instructions:
+        mnemonic = text.split()[0] if text.split() else ""
+        for bits, pattern in VECTOR_REGISTERS:
+            if pattern.search(text):
+                if bits == 128 and SCALAR_SSE.match(mnemonic):
+                    break
+                width = max(width, bits)
+                count += 1
+                break
+    return width, count
+
+
+def loops(instructions):
+    """(start, end) address ranges closed by a backward branch, innermost first."""
+    found = []
+    for addr, text in instructions:
+        m = BRANCH.match(text)
+        if m and int(m.group(1), 16) <= addr:
+            found.append((int(m.group(1), 16), addr))
+    return sorted(found, key=lambda r: r[1] - r[0])
+
+
+def sample_instructions(exe, run_args, cwd, workdir):
+    """perf samples per instruction: ({symbol: {offset: samples}}, total samples), or None without perf."""
+    if not shutil.which("perf"):
+        return None
+    data = os.path.join(workdir, f"{os.path.basename(exe)}.perf.data")
+    try:
+        record = run_once(["perf", "record", "-F", str(PERF_FREQUENCY), "-o", data, "--", exe] + (run_args or []),
+                          timeout=DEFAULT_TIMEOUT * 2, cwd=cwd)
+    except subprocess.TimeoutExpired:
+        return None
+    if record["returncode"] != 0 or not os.path.exists(data):
+        return None
+    script = subprocess.run(["perf", "script", "-i", data, "-F", "ip,sym,symoff"], capture_output=True, text=True)
+    samples, total = {}, 0
+    # "          40113a slow(long)+0x1a"
+    for line in script.stdout.splitlines():
+        m = re.match(r"^\s*[0-9a-f]+\s+(.+)\+0x([0-9a-f]+)\s*$", line)
+        total += 1
+        if m:
+            per_symbol = samples.setdefault(m.group(1), {})
+            offset = int(m.group(2), 16)
+            per_symbol[offset] = per_symbol.get(offset, 0) + 1
+    return (samples, total) if total else None
+
+
+def _normalize(text):
+    """Instruction without absolute addresses, so unchanged code diffs as unchanged."""
+    return re.sub(r"\b[0-9a-f]+ <(.+?)>", r"<\1>", text)
+
+
+def function_report(symbol, instructions, samples=None, total=0, profile_pct=None):
+    """{"symbol", "instructions", "vector_instructions", "simd_width", "samples_pct", "loops"} of one function.
+
+    samples are its perf samples per offset; without them samples_pct is the
+    function's self time from the profiling stage (profile_pct), if known.
+    """
+    width, vector = simd_width(instructions)
+    start = instructions[0][0] if instructions else 0
+    report = {"symbol": symbol, "instructions": len(instructions), "vector_instructions": vector,
+              "simd_width": width, "samples_pct": profile_pct, "loops": []}
+    if samples and total:
+        report["samples_pct"] = round(100.0 * sum(samples.values()) / total, 2)
+    for lo, hi in loops(instructions):
+        body = [(a, t) for a, t in instructions if lo <= a <= hi]
+        loop = {"start": f"+{lo - start:#x}", "end": f"+{hi - start:#x}", "instructions": len(body),
+                "simd_width": simd_width(body)[0], "samples_pct": None}
+        if samples and total:
+            loop["samples_pct"] = round(100.0 * sum(n for off, n in samples.items()
+                                                    if lo - start <= off <= hi - start) / total, 2)
+        report["loops"].append(loop)
+    return report
+
+
+def listing(instructions, samples=None, total=0):
+    """(display lines, diff keys): normalized instructions with offsets, prefixed with their share of
+    samples where it is HOT_INSTRUCTION_PCT or more; keys leave out offsets, which shift with any edit."""
+    start = instructions[0][0] if instructions else 0
+    lines, keys = [], []
+    for addr, text in instructions:
+        pct = 100.0 * (samples or {}).get(addr - start, 0) / total if total else 0.0
+        mark = f"{pct:5.1f}%" if pct >= HOT_INSTRUCTION_PCT else "      "
+        lines.append(f"{mark} +{addr - start:<5x} {_normalize(text)}")
+        keys.append(re.sub(r"\+0x[0-9a-f]+>", "+…>", " ".join(_normalize(text).split())))
+    return lines, keys
+
+
+def _diff(before, after, name, context=3):
+    """Unified diff of two listings, compared by their keys."""
+    (old, old_keys), (new, new_keys) = before, after
+    out = [f"--- baseline/{name}", f"+++ best/{name}"]
+    matcher = difflib.SequenceMatcher(None, old_keys, new_keys, autojunk=False)
+    for group in matcher.get_grouped_opcodes(context):
+        out.append(f"@@ -{group[0][1] + 1},{group[-1][2] - group[0][1]} "
+                   f"+{group[0][3] + 1},{group[-1][4] - group[0][3]} @@")
+        for tag, i1, i2, j1, j2 in group:
+            if tag == "equal":
+                out += [f" {line}" for line in new[j1:j2]]
+                continue
+            out += [f"-{line}" for line in old[i1:i2]]
+            out += [f"+{line}" for line in new[j1:j2]]
+    return out if len(out) > 2 else out + ["(identical)"]
+
+
+def _describe(report):
+    if report is None:
+        return "not in the binary (inlined or removed)"
+    simd = f"{report['simd_width']}-bit SIMD" if report["simd_width"] else "scalar"
+    text = f"{report['instructions']} instructions, {report['vector_instructions']} vector, {simd}"
+    if report["samples_pct"] is not None:
+        text += f", {report['samples_pct']:.1f}% of samples"
+    for loop in report["loops"][:4]:
+        hot = f", {loop['samples_pct']:.1f}% of samples" if loop["samples_pct"] is not None else ""
+        width = f"{loop['simd_width']}-bit" if loop["simd_width"] else "scalar"
+        text += f"\n      loop {loop['start']}..{loop['end']}: {loop['instructions']} instructions, {width}{hot}"
+    return text
+
+
+def _find(disassembly, name, qualified):
+    """Symbol of disassembly for a function: the exact symbol, else the only one with its qualified name."""
+    if name in disassembly:
+        return name
+    matches = [s for s in disassembly if split_symbol(s) == qualified and "[clone" not in s]
+    return matches[0] if len(matches) == 1 else None
+
+
+def hot_symbols(profile, changed, limit=MAX_ASM_FUNCTIONS):
+    """Profiled symbols (hottest first), then the qualified names of changed functions, up to limit."""
+    names, seen = [], set()
+    for name in [row["symbol"] for row in profile or []] + list(changed):
+        key = tuple(split_symbol(name))
+        if key and key not in seen:
+            seen.add(key)
+            names.append(name)
+    return names[:limit]
+
+
+def asm_diff(baseline_files, baseline_args, best_files, best_args, symbols, run_args=None, cwd=None,
+             build_root=None, profile=None):
+    """Disassembly of symbols in the baseline and the best build, plus their diff.
+
+    Returns {"functions": [{"symbol", "baseline", "best"}], "report": text}
+    (each side a function_report or None), or None if a build fails.
+    """
+    workdir = tempfile.mkdtemp(prefix="cppopt_asm_", dir=build_root)
+    try:
+        sides = {}
+        for side, files, args in (("baseline", baseline_files, baseline_args), ("best", best_files, best_args)):
+            exe = os.path.join(workdir, f"{side}_bin")
+            if not compile_project(files, exe, args):
+                print(f"⚠️  Could not build the {side} for the assembly diff")
+                return None
+            sides[side] = (disassemble(exe), sample_instructions(exe, run_args, cwd, workdir) if run_args is not None
+                           else None)
+
+        self_pct = {row["symbol"]: row["self_pct"] for row in profile or []}
+        functions, sections = [], []
+        for name in symbols:
+            qualified = split_symbol(name)
+            entry, listings = {"symbol": name}, {}
+            for side, (disassembly, sampled) in sides.items():
+                symbol = _find(disassembly, name, qualified)
+                if symbol is None:
+                    entry[side] = None
+                    listings[side] = ([], [])
+                    continue
+                samples, total = (sampled[0].get(symbol), sampled[1]) if sampled else (None, 0)
+                entry[side] = function_report(symbol, disassembly[symbol], samples, total,
+                                              self_pct.get(name) if side == "baseline" else None)
+                listings[side] = listing(disassembly[symbol], samples, total)
+            if entry["baseline"] is None and entry["best"] is None:
+                continue
+            functions.append(entry)
+            sections.append("\n".join([f"=== {name}", f"  baseline: {_describe(entry['baseline'])}",
+                                       f"  best:     {_describe(entry['best'])}", ""]
+                                      + _diff(listings["baseline"], listings["best"], name)))
+        if not functions:
+            return None
+        header = ("Hot functions, baseline vs best build (addresses relative to each function; "
+                  "leading percentages are perf samples per instruction)")
+        return {"functions": functions, "report": "\n\n".join([header] + sections) + "\n"}
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
@@ -0,0 +1,65 @@
+import os
+import sys
+import tempfile
+import time
+from analyze import analyze_cpp_file
+
+# Parse+extract benchmark for analyze_cpp_file on synthetic translation units.
+# Usage: python bench_analyze.py [decls_per_kind ...]   (default: 500 2000 5000)
+
+
+def generate_tu(n):
+    """A TU with n globals, enums, free functions and classes (each with two methods)."""
+    lines = ["#include <vector>", "#include <string>", ""]
+    for i in range(n):
+        lines.append(f"int global_{i} = {i};")
+    for i in range(n):
+        lines.append(f"enum Enum{i} {{ A{i}, B{i}, C{i} }};")
+    for i in range(n):
+        lines += [
+            f"class Class{i} {{",
+            "public:",
+            f"    int get() const {{ return value_ * {i}; }}",
+            "    void set(int v) {",
+            "        value_ = v;",
+            "    }",
+            "private:",
+            "    int value_ = 0;",
+            "};",
+        ]
+    for i in range(n):
+        lines += [
+            f"int function_{i}(const std::vector<int>& v) {{",
+            "    int sum = 0;",
+            "    for (int x : v) sum += x;",
+            f"    return sum + global_{i};",
+            "}",
+        ]
+    lines.append("int main() { return function_0({1, 2, 3}); }")
+    return "\n".join(lines) + "\n"
+
+
+def bench(n):
+    """Time one parse+extract of a generated TU and return (lines, seconds, decls)."""
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, f"synthetic_{n}.cpp")
+        source = generate_tu(n)
+        with open(path, "w") as f:
+            f.write(source)
+
+        start = time.perf_counter()
+        results = analyze_cpp_file(path)
+        elapsed = time.perf_counter() - start
+
+        decls = (len(results["functions"]) + len(results["classes"]) + len(results["enums"])
+                 + len(results["globals"])
+                 + sum(len(c["methods"]) for c in results["classes"].values()))
+        return source.count("\n"), elapsed, decls
+
+
+if __name__ == "__main__":
+    sizes = [int(a) for a in sys.argv[1:]] or [500, 2000, 5000]
+    print(f"{'decls/kind':>10} {'lines':>8} {'extracted':>10} {'parse+extract':>14}")
+    for n in sizes:
+        lines, elapsed, decls = bench(n)
+        print(f"{n:>10} {lines:>8} {decls:>10} {elapsed:>13.3f}s")
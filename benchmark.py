@@ -0,0 +1,598 @@
+import contextlib
+import functools
+import math
+import os
+import queue
+import shutil
+import signal
+import statistics
+import sys
+import subprocess
+import tempfile
+import threading
+import time
+from correctness import capture_outputs, clear_output_files, read_output_file
+from isolation import RunCgroup, child_setup, cgroups_available
+
+# Defaults for the benchmark harness. One warmup run primes the page cache and
+# dynamic loader, then the median over several timed runs is used.
+DEFAULT_WARMUP = 1
+DEFAULT_REPETITIONS = 5
+DEFAULT_TIMEOUT = 20
+
+# Acceptance rule: one-sided significance level and the minimum relative
+# improvement of the median that we are willing to call a speedup.
+DEFAULT_ALPHA = 0.05
+DEFAULT_MIN_IMPROVEMENT = 0.01
+
+# perf stat events collected in one extra, untimed run per benchmark
+PERF_EVENTS = ["cycles", "instructions", "L1-dcache-load-misses", "LLC-load-misses", "branch-misses"]
+COLLECT_COUNTERS = os.getenv("OPTIMIZER_COUNTERS", "1") != "0"
+# Heap allocations counted in one extra, untimed run with an LD_PRELOAD counter (Linux)
+COUNT_ALLOCATIONS = os.getenv("OPTIMIZER_ALLOCATIONS", "1") != "0"
+
+
+def parse_cpu_list(spec):
+    """Parse a cpuset-style list such as "2-5,8" into [2, 3, 4, 5, 8]."""
+    cpus = []
+    for part in spec.split(","):
+        part = part.strip()
+        if not part:
+            continue
+        if "-" in part:
+            lo, hi = part.split("-")
+            cpus.extend(range(int(lo), int(hi) + 1))
+        else:
+            cpus.append(int(part))
+    return cpus
+
+
+def isolated_cpus():
+    """Cores the kernel keeps the scheduler off (isolcpus=), the best ones to benchmark on."""
+    try:
+        with open("/sys/devices/system/cpu/isolated") as f:
+            return set(parse_cpu_list(f.read()))
+    except OSError:
+        return set()
+
+
+# Threads can only be pinned where the OS has affinity calls (not on macOS)
+CAN_PIN = hasattr(os, "sched_getaffinity") and hasattr(os, "sched_setaffinity")
+_multi_core_lock = threading.Lock()
+_cores_lock = threading.Lock()
+_free_cores = None
+
+
+@functools.lru_cache(maxsize=None)
+def bench_cpus():
+    """Cores reserved for timed runs (e.g. OPTIMIZER_BENCH_CPUS="8-15"; default: the isolated cores, if any).
+
+    Each concurrent benchmark takes one core for all of its repetitions, so
+    timings never share a core. Without a reservation (or without pinning)
+    benchmarks are serialized instead.
+    """
+    if not CAN_PIN:
+        return []
+    spec = os.getenv("OPTIMIZER_BENCH_CPUS", "")
+    allowed = os.sched_getaffinity(0) | isolated_cpus()
+    return [c for c in (parse_cpu_list(spec) if spec else sorted(isolated_cpus())) if c in allowed]
+
+
+def _core_queue():
+    # Filled on first use, so importing this module doesn't touch the scheduler
+    global _free_cores
+    with _cores_lock:
+        if _free_cores is None:
+            _free_cores = queue.Queue()
+            for core in bench_cpus() or [None]:
+                _free_cores.put(core)
+        return _free_cores
+
+
+def _take_cores(n):
+    """n benchmark cores (at most all reserved ones); multi-core takers queue up so they can't deadlock."""
+    if n <= 1:
+        return [_core_queue().get()]
+    with _multi_core_lock:
+        return [_core_queue().get() for _ in range(min(n, max(1, len(bench_cpus()))))]
+
+
+def _return_cores(cores):
+    for core in cores:
+        _core_queue().put(core)
+
+
+def unreserved_cpus():
+    """Cores left for compiles and LLM work once benchmark cores are reserved (None without pinning)."""
+    if not CAN_PIN:
+        return None
+    available = os.sched_getaffinity(0)
+    rest = available - set(bench_cpus())
+    return rest or available
+
+
+def pin_unreserved():
+    """preexec_fn keeping a child (e.g. a compiler) off the benchmark cores, or None if nothing is reserved."""
+    if not bench_cpus():
+        return None
+    cpus = unreserved_cpus()
+    return lambda: os.sched_setaffinity(0, cpus)
+
+
+# ru_maxrss survives exec, so a child forked from this (large) Python process
+# reports our RSS as its peak. Timed programs are therefore started by a tiny
+# launcher, which forks the real program and reports that grandchild's rusage.
+LAUNCHER_SOURCE = r"""
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    if (argc < 3) return 127;
+    pid_t pid = fork();
+    if (pid < 0) return 127;
+    if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        _exit(127);
+    }
+    /* The allocation counter (if preloaded) reports the program, not us */
+    unsetenv("CPPOPT_ALLOC_OUT");
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) return 127;
+    FILE *out = fopen(argv[1], "w");
+    if (out) {
+        fprintf(out, "%ld %ld.%06ld %ld.%06ld\n", ru.ru_maxrss,
+                (long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec,
+                (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec);
+        fclose(out);
+    }
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+    }
+    return WEXITSTATUS(status);
+}
+"""
+
+_launcher = {}
+_launcher_lock = threading.Lock()
+
+
+def launcher_path():
+    """Build the rusage launcher once per process (None if it can't be compiled)."""
+    with _launcher_lock:
+        if "path" not in _launcher:
+            build_dir = tempfile.mkdtemp(prefix="cppopt_launcher_")
+            src = os.path.join(build_dir, "launcher.c")
+            exe = os.path.join(build_dir, "launcher")
+            with open(src, "w") as f:
+                f.write(LAUNCHER_SOURCE)
+            result = subprocess.run(["clang++", "-x", "c", "-O2", src, "-o", exe], capture_output=True)
+            _launcher["path"] = exe if result.returncode == 0 else None
+        return _launcher["path"]
+
+
+# Preloaded into one run to count heap allocations: glibc's allocator entry
+# points are wrapped, and every process writes its totals at exit.
+ALLOC_COUNTER_SOURCE = r"""
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+
+static atomic_long count, bytes;
+
+static void note(size_t n) {
+    atomic_fetch_add_explicit(&count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes, (long)n, memory_order_relaxed);
+}
+
+void *malloc(size_t n) { note(n); return __libc_malloc(n); }
+void *calloc(size_t n, size_t size) { note(n * size); return __libc_calloc(n, size); }
+void *realloc(void *p, size_t n) { note(n); return __libc_realloc(p, n); }
+void *memalign(size_t align, size_t n) { note(n); return __libc_memalign(align, n); }
+void *aligned_alloc(size_t align, size_t n) { note(n); return __libc_memalign(align, n); }
+int posix_memalign(void **out, size_t align, size_t n) {
+    note(n);
+    *out = __libc_memalign(align, n);
+    return *out ? 0 : 12;
+}
+
+__attribute__((destructor)) static void report(void) {
+    long c = atomic_load(&count), b = atomic_load(&bytes);
+    const char *prefix = getenv("CPPOPT_ALLOC_OUT");
+    if (!prefix) return;
+    char path[4096];
+    snprintf(path, sizeof path, "%s.%d", prefix, (int)getpid());
+    FILE *out = fopen(path, "w");
+    if (out) {
+        fprintf(out, "%ld %ld\n", c, b);
+        fclose(out);
+    }
+}
+"""
+
+
+def alloc_counter_path():
+    """Build the allocation counter library once per process (None if unsupported here)."""
+    with _launcher_lock:
+        if "alloc" not in _launcher:
+            lib = None
+            if sys.platform.startswith("linux"):
+                build_dir = tempfile.mkdtemp(prefix="cppopt_alloc_")
+                src = os.path.join(build_dir, "alloc_counter.c")
+                lib = os.path.join(build_dir, "alloc_counter.so")
+                with open(src, "w") as f:
+                    f.write(ALLOC_COUNTER_SOURCE)
+                result = subprocess.run(["clang++", "-x", "c", "-O2", "-shared", "-fPIC", src, "-o", lib],
+                                        capture_output=True)
+                lib = lib if result.returncode == 0 else None
+            _launcher["alloc"] = lib
+        return _launcher["alloc"]
+
+
+def count_allocations(cmd, timeout=DEFAULT_TIMEOUT, cwd=None, env=None, cpus=None):
+    """Run once with the allocation counter, returning {"allocations", "allocated_bytes"} (None if unavailable).
+
+    Counts cover the program and any processes it starts; statically linked
+    programs can't be counted.
+    """
+    lib = alloc_counter_path()
+    if not lib:
+        return None
+    with tempfile.TemporaryDirectory(prefix="cppopt_allocs_") as out_dir:
+        prefix = os.path.join(out_dir, "allocs")
+        run_env = dict(env or os.environ, CPPOPT_ALLOC_OUT=prefix)
+        run_env["LD_PRELOAD"] = " ".join(filter(None, [lib, run_env.get("LD_PRELOAD")]))
+        try:
+            run = run_once(cmd, timeout=timeout, cwd=cwd, env=run_env, cpus=cpus)
+        except subprocess.TimeoutExpired:
+            return None
+        reports = [f for f in os.listdir(out_dir) if f.startswith("allocs.")]
+        if run["returncode"] != 0 or not reports:
+            return None
+        count = size = 0
+        for name in reports:
+            with open(os.path.join(out_dir, name)) as f:
+                fields = f.read().split()
+            if len(fields) == 2:
+                count, size = count + int(fields[0]), size + int(fields[1])
+        return {"allocations": count, "allocated_bytes": size}
+
+
+def run_once(cmd, timeout=DEFAULT_TIMEOUT, cwd=None, env=None, cpus=None, limit_address_space=True,
+             background=False):
+    """Run a command once, returning wall time, CPU time, peak RSS and exit status.
+
+    The program runs under the limits of isolation.py; "limit" names the one
+    it hit (e.g. the memory cap), if any. A background run gets the lowest
+    CPU priority (for untimed work beside timed runs, see untimed_slot).
+    """
+    cgroup = None
+    if cgroups_available():
+        try:
+            cgroup = RunCgroup(cpus)
+        except OSError as e:
+            print(f"⚠️  Could not create run cgroup: {e}")
+    try:
+        return _run_limited(cmd, timeout, cwd, env, cpus, cgroup, limit_address_space, background)
+    finally:
+        if cgroup:
+            cgroup.close()
+
+
+def _run_limited(cmd, timeout, cwd, env, cpus, cgroup, limit_address_space=True, background=False):
+    launcher = launcher_path()
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err, \
+            tempfile.NamedTemporaryFile(mode="r", suffix=".rusage") as usage_file:
+        full_cmd = [launcher, usage_file.name] + list(cmd) if launcher else cmd
+        start = time.perf_counter_ns()
+        # Own session, so a timeout kills the program and anything it forked
+        proc = subprocess.Popen(full_cmd, stdout=out, stderr=err, cwd=cwd, env=env,
+                                preexec_fn=child_setup(cpus, cgroup, timeout, limit_address_space, background),
+                                start_new_session=True)
+
+        # Reap the child with wait4 so we get its own rusage, not the sum over
+        # every child of this process (other jobs may be running concurrently).
+        status = {}
+
+        def reap():
+            _, code, usage = os.wait4(proc.pid, 0)
+            status["end"] = time.perf_counter_ns()
+            status["code"] = code
+            status["usage"] = usage
+
+        waiter = threading.Thread(target=reap, daemon=True)
+        waiter.start()
+        waiter.join(timeout)
+        if waiter.is_alive():
+            try:
+                os.killpg(proc.pid, signal.SIGKILL)
+            except ProcessLookupError:
+                pass
+            if cgroup:
+                cgroup.kill()
+            waiter.join()
+            raise subprocess.TimeoutExpired(cmd, timeout)
+
+        proc.returncode = os.waitstatus_to_exitcode(status["code"])
+        usage = status["usage"]
+        max_rss, cpu = usage.ru_maxrss, usage.ru_utime + usage.ru_stime
+
+        # Prefer the launcher's report on the real program
+        reported = usage_file.read().split()
+        if len(reported) == 3:
+            max_rss, cpu = int(reported[0]), float(reported[1]) + float(reported[2])
+
+        limit = None
+        if cgroup and cgroup.events().get("oom_kill"):
+            limit = "memory limit exceeded"
+        elif os.WIFSIGNALED(status["code"]) and os.WTERMSIG(status["code"]) in (signal.SIGXCPU, signal.SIGXFSZ):
+            limit = "CPU time limit exceeded" if os.WTERMSIG(status["code"]) == signal.SIGXCPU else "file size limit exceeded"
+
+        out.seek(0)
+        err.seek(0)
+        stderr = err.read()
+        return {
+            "wall": (status["end"] - start) / 1e9,
+            "cpu": cpu,
+            # ru_maxrss is KiB on Linux but bytes on macOS
+            "max_rss_kb": max_rss // 1024 if sys.platform == "darwin" else max_rss,
+            "returncode": proc.returncode,
+            "stdout_bytes": out.read(),
+            "stderr_bytes": stderr,
+            "stderr": stderr.decode(errors="replace"),
+            "limit": limit,
+        }
+
+
+def collect_counters(cmd, timeout=DEFAULT_TIMEOUT, cwd=None, env=None, cpus=None):
+    """Run once under `perf stat`, returning hardware counters plus IPC (None if perf is unavailable)."""
+    if not shutil.which("perf"):
+        return None
+    with tempfile.NamedTemporaryFile(mode="r", suffix=".csv") as report:
+        stat_cmd = ["perf", "stat", "-x", ",", "-o", report.name, "-e", ",".join(PERF_EVENTS), "--"] + cmd
+        try:
+            run = run_once(stat_cmd, timeout=timeout, cwd=cwd, env=env, cpus=cpus)
+        except subprocess.TimeoutExpired:
+            return None
+        if run["returncode"] != 0:
+            return None
+
+        # CSV lines: value,unit,event,... ; unsupported events report "<not supported>"
+        counters = {}
+        for line in report.read().splitlines():
+            fields = line.split(",")
+            if len(fields) < 3 or line.startswith("#"):
+                continue
+            event = fields[2].split(":")[0]
+            try:
+                counters[event] = int(float(fields[0]))
+            except ValueError:
+                continue
+
+    if not counters:
+        return None
+    if counters.get("cycles") and "instructions" in counters:
+        counters["ipc"] = round(counters["instructions"] / counters["cycles"], 3)
+    return counters
+
+
+def format_counters(stats):
+    """Counter summary for logs and prompts, e.g. 'IPC 1.85, LLC-load-misses 2.1/kinstr, peak RSS 12.3MB'."""
+    if not stats:
+        return ""
+    parts = []
+    counters = stats.get("counters") or {}
+    if "ipc" in counters:
+        parts.append(f"IPC {counters['ipc']:.2f}")
+    instructions = counters.get("instructions")
+    for event in PERF_EVENTS[2:]:
+        if event in counters:
+            if instructions:
+                parts.append(f"{event} {1000 * counters[event] / instructions:.2f}/kinstr")
+            else:
+                parts.append(f"{event} {counters[event]}")
+    if stats.get("peak_rss_kb"):
+        parts.append(f"peak RSS {stats['peak_rss_kb'] / 1024:.1f}MB")
+    if stats.get("allocations") is not None:
+        parts.append(f"{stats['allocations']} heap allocations ({stats['allocated_bytes'] / 2**20:.1f}MB)")
+    if stats.get("binary_size"):
+        parts.append(f"binary {stats['binary_size'] / 1024:.1f}KB")
+    return ", ".join(parts)
+
+
+def median_ci(samples, confidence=0.95):
+    """Distribution-free confidence interval for the median (order statistics)."""
+    ordered = sorted(samples)
+    n = len(ordered)
+    if n < 2:
+        return ordered[0], ordered[0], 0.0
+
+    # Widen [x_(k), x_(n-k+1)] until its binomial coverage reaches `confidence`
+    # (or we run out of samples and report the coverage we actually have).
+    def coverage(k):
+        tail = sum(math.comb(n, i) for i in range(k)) / 2 ** n
+        return 1 - 2 * tail
+
+    k = n // 2
+    while k > 1 and coverage(k) < confidence:
+        k -= 1
+    return ordered[k - 1], ordered[n - k], coverage(k)
+
+
+def summarize(wall_samples, cpu_samples, peak_rss_kb=None, counters=None, output=None, allocations=None):
+    """Build the statistics dict passed around for a benchmarked binary (cpu_samples None if CPU time is unknown)."""
+    low, high, level = median_ci(wall_samples)
+    allocations = allocations or {}
+    return {
+        "median": statistics.median(wall_samples),
+        "ci_low": low,
+        "ci_high": high,
+        "ci_level": level,
+        "cpu_median": statistics.median(cpu_samples) if cpu_samples else None,
+        "samples": wall_samples,
+        "cpu_samples": cpu_samples,
+        "peak_rss_kb": peak_rss_kb,
+        "counters": counters,
+        "output": output,
+        "allocations": allocations.get("allocations"),
+        "allocated_bytes": allocations.get("allocated_bytes"),
+    }
+
+
+# Programs that write output files share their working directory, so runs
+# whose output files are checked must not overlap.
+_output_files_lock = threading.Lock()
+
+
+@contextlib.contextmanager
+def untimed_slot(output_files=None):
+    """Cores for an untimed run (e.g. a sanitizer build's), which never takes a benchmark core.
+
+    With reserved benchmark cores it runs on the others. Without, it runs
+    beside the timed runs and should be a background run_once: the scheduler
+    then favours the timed program, which still shares caches and memory
+    bandwidth with it (reserve cores with OPTIMIZER_BENCH_CPUS to rule that
+    out). A program with checked output_files still waits for timed runs
+    that write them.
+    """
+    if output_files:
+        _output_files_lock.acquire()
+    try:
+        yield unreserved_cpus() if bench_cpus() else None
+    finally:
+        if output_files:
+            _output_files_lock.release()
+
+
+def run_benchmark(cmd, warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS,
+                  timeout=DEFAULT_TIMEOUT, cwd=None, env=None, counters=COLLECT_COUNTERS,
+                  output_files=None, allocations=COUNT_ALLOCATIONS, threads=1):
+    """Run a command with warmup and repetitions, returning timing statistics.
+
+    Peak RSS comes from the timed runs; hardware counters and heap
+    allocations from extra runs afterwards, so they never perturb the timings. stdout,
+    stderr and the given output_files are captured for the correctness gate.
+    A multithreaded program (threads > 1) gets that many reserved cores.
+    """
+    wall_samples, cpu_samples, peak_rss = [], [], 0
+    stdouts, stderrs = [], []
+    file_runs = {p: [] for p in output_files or []}
+    counter_values = output = alloc_values = None
+
+    cores = _take_cores(threads)
+    cpus = {c for c in cores if c is not None} or None
+    if output_files:
+        _output_files_lock.acquire()
+    try:
+        clear_output_files(output_files, cwd)
+        for i in range(warmup + repetitions):
+            run = run_once(cmd, timeout=timeout, cwd=cwd, env=env, cpus=cpus)
+            if run["returncode"] != 0:
+                print(f"⚠️ Runtime Error (Exit {run['returncode']}): {run['limit'] or run['stderr']}")
+                return None
+            if i >= warmup:
+                wall_samples.append(run["wall"])
+                cpu_samples.append(run["cpu"])
+                peak_rss = max(peak_rss, run["max_rss_kb"])
+                stdouts.append(run["stdout_bytes"])
+                stderrs.append(run["stderr_bytes"])
+                for p, runs in file_runs.items():
+                    runs.append(read_output_file(os.path.join(cwd or os.getcwd(), p)))
+
+        output = capture_outputs(stdouts, stderrs, output_files, cwd, file_runs)
+
+        if counters:
+            counter_values = collect_counters(cmd, timeout=timeout, cwd=cwd, env=env, cpus=cpus)
+        if allocations:
+            alloc_values = count_allocations(cmd, timeout=timeout, cwd=cwd, env=env, cpus=cpus)
+    finally:
+        if output_files:
+            _output_files_lock.release()
+        _return_cores(cores)
+
+    return summarize(wall_samples, cpu_samples, peak_rss or None, counter_values, output, alloc_values)
+
+
+def mann_whitney_p(faster, slower):
+    """One-sided Mann-Whitney U p-value for `faster` being stochastically smaller."""
+    n1, n2 = len(faster), len(slower)
+    u = sum(1.0 if a < b else 0.5 if a == b else 0.0 for a in faster for b in slower)
+
+    # Exact null distribution for the small sample sizes we normally use.
+    if n1 * n2 <= 400 and len(set(faster) | set(slower)) == n1 + n2:
+        # counts[i][j][k] = orderings of i faster / j slower samples with U == k
+        counts = [[[0] * (i * j + 1) for j in range(n2 + 1)] for i in range(n1 + 1)]
+        for i in range(n1 + 1):
+            for j in range(n2 + 1):
+                if i == 0 or j == 0:
+                    counts[i][j][0] = 1
+                    continue
+                for k in range(i * j + 1):
+                    # Largest value belongs to `slower`: U gains i; otherwise nothing.
+                    from_slower = counts[i][j - 1][k - i] if k >= i else 0
+                    from_faster = counts[i - 1][j][k] if k <= (i - 1) * j else 0
+                    counts[i][j][k] = from_slower + from_faster
+        dist = counts[n1][n2]
+        total = sum(dist)
+        threshold = math.ceil(u)
+        return sum(dist[threshold:]) / total
+
+    # Normal approximation with tie correction for larger samples.
+    ranked = sorted(faster + slower)
+    ties = {}
+    for value in ranked:
+        ties[value] = ties.get(value, 0) + 1
+    n = n1 + n2
+    tie_term = sum(t ** 3 - t for t in ties.values()) / (n * (n - 1))
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - tie_term))
+    if sigma == 0:
+        return 1.0
+    z = (u - n1 * n2 / 2 - 0.5) / sigma
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def is_significant_improvement(best, candidate, alpha=DEFAULT_ALPHA,
+                               min_improvement=DEFAULT_MIN_IMPROVEMENT):
+    """Only accept a candidate whose speedup is both real and large enough.
+
+    Stats of a workload matrix (see workloads.py) are compared on their
+    aggregate; the "worst" aggregate requires a speedup on every workload.
+    """
+    if candidate is None:
+        return False
+    if best is None:
+        return True
+    if candidate.get("aggregate") == "worst" and best.get("workloads") and candidate.get("workloads"):
+        pairs = list(zip(best["workloads"], candidate["workloads"]))
+        return len(pairs) == len(candidate["workloads"]) and \
+            all(is_significant_improvement(b, c, alpha, min_improvement) for b, c in pairs)
+
+    if candidate["median"] > best["median"] * (1 - min_improvement):
+        return False
+
+    # Single-sample runs (no repetitions) can't be tested, fall back to the median.
+    if len(best["samples"]) < 2 or len(candidate["samples"]) < 2:
+        return True
+
+    return mann_whitney_p(candidate["samples"], best["samples"]) < alpha
+
+
+def format_stats(stats):
+    """Human-readable one-liner for a statistics dict."""
+    if stats is None:
+        return "n/a"
+    return (f"{stats['median']:.6f}s "
+            f"[{stats['ci_low']:.6f}, {stats['ci_high']:.6f}] @{stats['ci_level']:.0%}, "
+            + (f"cpu {stats['cpu_median']:.6f}s, " if stats.get("cpu_median") is not None else "")
+            + f"n={len(stats['samples'])}")
@@ -0,0 +1,212 @@
+import functools
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+
+# ccache-style store for compiled binaries and their benchmark results.
+# Binaries are keyed by compiler version + flags + preprocessed source, so
+# resubmitted projects and candidates the LLM did not really change skip the
+# compile; results are additionally keyed by the run arguments and inputs.
+CACHE_ENABLED = os.getenv("OPTIMIZER_CACHE", "1") != "0"
+CACHE_DIR = os.path.expanduser(os.getenv("OPTIMIZER_CACHE_DIR", "~/.cache/cpp-optimizer"))
+CACHE_MAX_BINARIES = int(os.getenv("OPTIMIZER_CACHE_MAX_BINARIES", "500"))
+
+# Flags whose value is a path: the path itself changes with every upload's
+# temp dir, and what it contributes is already in the preprocessed output.
+_PATH_FLAGS = ("-I", "-isystem", "-iquote", "-isysroot")
+
+# Sources are in the binary key already; build and VCS directories aren't program inputs
+_SOURCE_EXTS = (".cpp", ".cc", ".c", ".cxx", ".h", ".hpp", ".hxx", ".hh", ".H", ".ipp", ".inl", ".tpp")
+_SKIP_INPUT_DIRS = {"build", "CMakeFiles", "node_modules", "__pycache__", "__MACOSX"}
+_digests = {}
+
+
+@functools.lru_cache(maxsize=None)
+def compiler_version(compiler="clang++"):
+    """Full `--version` banner of the compiler, part of every key."""
+    try:
+        return subprocess.run([compiler, "--version"], capture_output=True, text=True).stdout
+    except OSError:
+        return ""
+
+
+def _key_flags(flags):
+    """Drop include/sysroot paths from flags; keep everything that affects codegen."""
+    kept, skip_next = [], False
+    for flag in flags:
+        if skip_next:
+            skip_next = False
+            continue
+        if flag in _PATH_FLAGS:
+            skip_next = True
+            continue
+        if flag.startswith(_PATH_FLAGS):
+            continue
+        kept.append(flag)
+    return kept
+
+
+def binary_key(cpp_files, flags, compiler="clang++"):
+    """Hash of compiler, flags and preprocessed sources (None if preprocessing fails)."""
+    # -P drops line markers, which would otherwise embed the temp upload paths
+    cmd = [compiler] + flags + ["-E", "-P"] + cpp_files
+    result = subprocess.run(cmd, capture_output=True)
+    if result.returncode != 0:
+        return None
+
+    h = hashlib.sha256()
+    h.update(compiler_version(compiler).encode())
+    h.update(json.dumps(_key_flags(flags)).encode())
+    h.update(result.stdout)
+    return h.hexdigest()
+
+
+def _file_digest(path):
+    h = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(1 << 20), b""):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def _cached_digest(path):
+    # Digests of unchanged files are remembered, so big data files are read once per process
+    st = os.stat(path)
+    stamp = (path, st.st_size, st.st_mtime_ns)
+    if stamp not in _digests:
+        _digests[stamp] = _file_digest(path)
+    return _digests[stamp]
+
+
+def data_files(cwd, exclude=()):
+    """{relative path: digest} of the non-source files under cwd, which a program may read as input."""
+    digests = {}
+    skip = {os.path.normpath(p) for p in exclude}
+    for root, dirs, files in os.walk(cwd):
+        dirs[:] = [d for d in dirs if not d.startswith(".") and d not in _SKIP_INPUT_DIRS]
+        for name in files:
+            path = os.path.join(root, name)
+            rel = os.path.relpath(path, cwd)
+            if name.startswith(".") or name.endswith(_SOURCE_EXTS) or rel in skip or not os.path.isfile(path):
+                continue
+            digests[rel] = _cached_digest(path)
+    return digests
+
+
+# Bumped when the shape of stored stats changes, so older results aren't served
+RESULT_FORMAT = 2
+
+
+def result_key(bin_key, run_args=None, cwd=None, output_files=(), **settings):
+    """Key for a benchmark result: binary, arguments, input files and harness settings.
+
+    Inputs are the files named in the arguments plus every non-source file
+    in cwd (the files the program writes, output_files, excluded), so a
+    data file that changes invalidates the timings and output measured
+    with it.
+    """
+    cwd = cwd or os.getcwd()
+    inputs = {}
+    for arg in run_args or []:
+        path = os.path.join(cwd, arg)
+        if os.path.isfile(path):
+            inputs[arg] = _cached_digest(path)
+
+    h = hashlib.sha256()
+    h.update(bin_key.encode())
+    h.update(json.dumps({"format": RESULT_FORMAT, "args": run_args or [], "inputs": inputs,
+                         "data": data_files(cwd, output_files),
+                         "settings": dict(settings, output_files=list(output_files))},
+                        sort_keys=True).encode())
+    return h.hexdigest()
+
+
+def _path(kind, key, suffix=""):
+    return os.path.join(CACHE_DIR, kind, key[:2], key + suffix)
+
+
+def _atomic_write(dest, write):
+    os.makedirs(os.path.dirname(dest), exist_ok=True)
+    fd, tmp = tempfile.mkstemp(dir=os.path.dirname(dest))
+    try:
+        with os.fdopen(fd, "wb") as f:
+            write(f)
+        os.replace(tmp, dest)
+    except Exception:
+        if os.path.exists(tmp):
+            os.remove(tmp)
+        raise
+
+
+def fetch_binary(key, exe_path):
+    """Materialize a cached binary at exe_path, returning True on a hit."""
+    cached = _path("bin", key)
+    if not os.path.exists(cached):
+        return False
+    try:
+        os.link(cached, exe_path)
+    except OSError:
+        shutil.copy2(cached, exe_path)
+    os.utime(cached)  # LRU bookkeeping for trim_binaries
+    return True
+
+
+def store_binary(key, exe_path):
+    """Copy a freshly built binary into the cache."""
+    def write(f):
+        with open(exe_path, "rb") as src:
+            shutil.copyfileobj(src, f)
+    dest = _path("bin", key)
+    _atomic_write(dest, write)
+    os.chmod(dest, 0o755)
+    trim_binaries()
+
+
+def load_result(key):
+    """Previously measured benchmark statistics, or None."""
+    try:
+        with open(_path("results", key, ".json")) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def store_result(key, stats):
+    """Remember benchmark statistics for a binary/workload pair."""
+    _atomic_write(_path("results", key, ".json"), lambda f: f.write(json.dumps(stats).encode()))
+
+
+def load_remarks(key):
+    """Compiler remarks recorded with a cached binary, or None."""
+    try:
+        with open(_path("remarks", key, ".json")) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def store_remarks(key, remarks):
+    """Keep a build's compiler remarks for when its binary is served from the cache."""
+    _atomic_write(_path("remarks", key, ".json"), lambda f: f.write(json.dumps(remarks).encode()))
+
+
+def trim_binaries():
+    """Keep at most CACHE_MAX_BINARIES binaries, evicting the least recently used."""
+    root = os.path.join(CACHE_DIR, "bin")
+    entries = []
+    for dirpath, _, files in os.walk(root):
+        for name in files:
+            path = os.path.join(dirpath, name)
+            try:
+                entries.append((os.stat(path).st_mtime, path))
+            except OSError:
+                pass
+    entries.sort()
+    for _, path in entries[:max(0, len(entries) - CACHE_MAX_BINARIES)]:
+        try:
+            os.remove(path)
+        except OSError:
+            pass
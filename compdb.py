@@ -0,0 +1,155 @@
+import json
+import os
+import shlex
+import shutil
+import subprocess
+from collections import Counter
+from benchmark import run_once, unreserved_cpus
+
+# compile_commands.json support: the project's real per-TU flags instead of
+# an -I for every directory of the upload. The database may come from the
+# user's machine, so its paths are remapped onto the uploaded tree.
+COMPDB_NAME = "compile_commands.json"
+CMAKE_TIMEOUT = int(os.getenv("OPTIMIZER_CMAKE_TIMEOUT", "120"))
+# Search depth for a database inside the upload (root, build/, out/Release/, ...)
+MAX_SEARCH_DEPTH = 3
+
+PATH_FLAGS = ("-I", "-isystem", "-iquote", "-idirafter", "-include")
+VALUE_FLAGS = ("-D", "-U")
+
+
+def find_compile_commands(project_root):
+    """Path of the shallowest compile_commands.json in the project, or None."""
+    root_depth = project_root.rstrip(os.sep).count(os.sep)
+    found = []
+    for dirpath, dirs, files in os.walk(project_root):
+        depth = dirpath.count(os.sep) - root_depth
+        if COMPDB_NAME in files:
+            found.append((depth, os.path.join(dirpath, COMPDB_NAME)))
+        if depth >= MAX_SEARCH_DEPTH:
+            dirs[:] = []
+        dirs.sort()
+    return min(found)[1] if found else None
+
+
+def generate_compile_commands(project_root, build_dir):
+    """Configure a CMake project into build_dir to export its compile database (None if not possible).
+
+    Configuring runs project code (execute_process, included scripts), so
+    cmake runs sandboxed like the programs themselves (see isolation.py).
+    """
+    if not os.path.exists(os.path.join(project_root, "CMakeLists.txt")) or not shutil.which("cmake"):
+        return None
+    print("🧱 Configuring with CMake to export compile_commands.json...")
+    cmd = ["cmake", "-S", project_root, "-B", build_dir, "-DCMAKE_EXPORT_COMPILE_COMMANDS=ON",
+           "-DCMAKE_CXX_COMPILER=clang++", "-DCMAKE_BUILD_TYPE=Release"]
+    try:
+        os.makedirs(build_dir, exist_ok=True)
+        result = run_once(cmd, timeout=CMAKE_TIMEOUT, cwd=build_dir, cpus=unreserved_cpus())
+    except subprocess.TimeoutExpired:
+        print("⚠️  CMake configure timed out")
+        return None
+    path = os.path.join(build_dir, COMPDB_NAME)
+    if result["returncode"] != 0 or not os.path.exists(path):
+        print("⚠️  CMake configure failed:")
+        print("\n".join((result["limit"] or result["stderr"]).splitlines()[:10]))
+        return None
+    return path
+
+
+def _original_root(entries, rel_sources):
+    """Directory the database's paths were recorded under, matched against the uploaded sources."""
+    roots = Counter()
+    for entry in entries:
+        path = entry["file"].replace("\\", "/")
+        for rel in rel_sources:
+            if path.endswith("/" + rel):
+                roots[path[:-len(rel) - 1]] += 1
+                break
+    return roots.most_common(1)[0][0] if roots else None
+
+
+def _split(entry):
+    """Argument list of a database entry ("arguments" or a shell "command")."""
+    return list(entry["arguments"]) if "arguments" in entry else shlex.split(entry.get("command", ""))
+
+
+def _path_flag(arg):
+    """The PATH_FLAGS option arg starts with (joined or separate), or None."""
+    for flag in PATH_FLAGS:
+        if arg.startswith(flag) and not arg.startswith("-include-"):
+            return flag
+    return None
+
+
+def tu_flags(arguments, directory, remap):
+    """The flags of one compile command that matter here: includes, macros and the language standard.
+
+    Paths are made absolute (joined form, so writeback can redirect them)
+    and remapped; include directories that don't exist here are dropped.
+    """
+    flags = []
+    args = iter(arguments[1:])  # skip the compiler
+    for arg in args:
+        flag = _path_flag(arg)
+        if flag:
+            value = arg[len(flag):] or next(args, "")
+            path = remap(os.path.normpath(os.path.join(directory, value)))
+            if os.path.exists(path):
+                flags.append(flag + path)
+        elif arg in VALUE_FLAGS:
+            flags.append(arg + next(args, ""))
+        elif arg.startswith(VALUE_FLAGS) or arg.startswith("-std="):
+            flags.append(arg)
+    return flags
+
+
+def load_compile_commands(path, project_root, filepaths):
+    """{realpath of each uploaded source: its flags} from a compile database.
+
+    Sources without an entry are left out; callers fall back to the shared
+    flags for them.
+    """
+    try:
+        with open(path) as f:
+            entries = [e for e in json.load(f) if "file" in e]
+    except (OSError, ValueError) as e:
+        print(f"⚠️  Could not read {path}: {e}")
+        return {}
+
+    rel_sources = sorted((os.path.relpath(fp, project_root).replace(os.sep, "/") for fp in filepaths),
+                         key=len, reverse=True)
+    for entry in entries:
+        entry["file"] = os.path.normpath(os.path.join(entry.get("directory", ""), entry["file"]))
+    orig = _original_root(entries, rel_sources)
+
+    def remap(p):
+        if orig and (p == orig or p.startswith(orig + "/")):
+            return os.path.join(project_root, p[len(orig) + 1:]) if p != orig else project_root
+        return p
+
+    sources = {os.path.realpath(fp) for fp in filepaths}
+    per_tu = {}
+    for entry in entries:
+        source = os.path.realpath(remap(entry["file"]))
+        if source in sources and source not in per_tu:
+            per_tu[source] = tu_flags(_split(entry), remap(entry.get("directory", "")), remap)
+    print(f"🧾 {COMPDB_NAME}: flags for {len(per_tu)}/{len(sources)} source(s)")
+    return per_tu
+
+
+def shared_flags(per_tu):
+    """One flag set for whole-program builds: every TU's include paths (in order) plus the macros common to all.
+
+    Builds compile all sources in one invocation (or one merged file), so
+    TU-specific macros can't be applied per file; they are reported instead.
+    """
+    if not per_tu:
+        return []
+    tus = list(per_tu.values())
+    includes = list(dict.fromkeys(f for flags in tus for f in flags if f.startswith(PATH_FLAGS)))
+    common = [f for f in tus[0] if not f.startswith(PATH_FLAGS) and all(f in flags for flags in tus[1:])]
+    differing = {f for flags in tus for f in flags if not f.startswith(PATH_FLAGS)} - set(common)
+    if differing:
+        print(f"⚠️  Per-TU flags not applied to builds: {' '.join(sorted(differing))}")
+    return includes + list(dict.fromkeys(common))
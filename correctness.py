@@ -0,0 +1,155 @@
+import hashlib
+import math
+import os
+import re
+
+# Outputs up to this size are kept as text so they can be compared line by
+# line (volatile lines, float tolerance); larger ones are compared by hash.
+MAX_COMPARE_OUTPUT = 4 * 1024 * 1024
+
+_NUMBER = re.compile(r"[-+]?(?:\d+\.\d*|\.\d+|\d+)(?:[eE][-+]?\d+)?|[-+]?(?:inf|nan)", re.I)
+
+
+def _digest(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+def file_digest(path):
+    """sha256 of a file produced by the program (None if it wasn't written)."""
+    if not os.path.isfile(path):
+        return None
+    h = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(1 << 20), b""):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def read_output_file(path):
+    """An output file after one run: its bytes, its sha256 if it's too large to compare by line, or None."""
+    if not os.path.isfile(path):
+        return None
+    if os.path.getsize(path) > MAX_COMPARE_OUTPUT:
+        return file_digest(path)
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def _file_stream(runs):
+    """Summarize an output file over repeated runs like a stream (None if some run didn't write it)."""
+    if not runs or any(r is None for r in runs):
+        return None
+    if any(isinstance(r, str) for r in runs):
+        digests = [r if isinstance(r, str) else _digest(r) for r in runs]
+        return {"sha256": digests[0], "stable": len(set(digests)) == 1, "text": None, "volatile": []}
+    return _stream(runs)
+
+
+def _stream(runs):
+    """Summarize one output stream over repeated runs of the same binary."""
+    first = runs[0]
+    stream = {"sha256": _digest(first), "stable": all(r == first for r in runs), "text": None, "volatile": []}
+    if len(first) <= MAX_COMPARE_OUTPUT:
+        texts = [r.decode(errors="replace").splitlines() for r in runs]
+        stream["text"] = texts[0]
+        # Lines that change between identical runs (timestamps, "took 0.3s", ...)
+        if all(len(t) == len(texts[0]) for t in texts):
+            stream["volatile"] = [i for i in range(len(texts[0])) if any(t[i] != texts[0][i] for t in texts)]
+    return stream
+
+
+def clear_output_files(output_files, cwd=None):
+    """Delete the declared output files before a binary runs, so a file left by an earlier binary can't pass as its output."""
+    for p in output_files or []:
+        try:
+            os.unlink(os.path.join(cwd or os.getcwd(), p))
+        except FileNotFoundError:
+            pass
+
+
+def capture_outputs(stdouts, stderrs, output_files=None, cwd=None, file_runs=None):
+    """Reference/candidate output record built from the timed runs of one binary.
+
+    file_runs is {path: [read_output_file() after each run]}; without it the
+    output files are read once, as the last run left them.
+    """
+    if file_runs is None:
+        file_runs = {p: [read_output_file(os.path.join(cwd or os.getcwd(), p))] for p in output_files or []}
+    return {
+        "stdout": _stream(stdouts),
+        "stderr": _stream(stderrs),
+        "files": {p: _file_stream(file_runs.get(p)) for p in output_files or []},
+    }
+
+
+def _tokens_match(expected, actual, tolerance):
+    """Compare two lines, allowing relative/absolute float tolerance on numbers."""
+    if expected == actual:
+        return True
+    if not tolerance:
+        return False
+    exp_nums, act_nums = _NUMBER.findall(expected), _NUMBER.findall(actual)
+    if _NUMBER.sub("#", expected) != _NUMBER.sub("#", actual) or len(exp_nums) != len(act_nums):
+        return False
+    for e, a in zip(exp_nums, act_nums):
+        e, a = float(e), float(a)
+        if math.isnan(e) and math.isnan(a):
+            continue
+        if not math.isclose(e, a, rel_tol=tolerance, abs_tol=tolerance):
+            return False
+    return True
+
+
+def _stream_matches(reference, candidate, tolerance):
+    if reference["stable"] and candidate["sha256"] == reference["sha256"]:
+        return True, None
+    if reference["text"] is None or candidate["text"] is None:
+        return False, "output differs (too large for line comparison)"
+    if len(reference["text"]) != len(candidate["text"]):
+        return False, f"{len(candidate['text'])} lines instead of {len(reference['text'])}"
+
+    # Only lines the baseline showed to be volatile: a candidate's own unstable lines must still match
+    skip = set(reference["volatile"])
+    for i, (expected, actual) in enumerate(zip(reference["text"], candidate["text"])):
+        if i not in skip and not _tokens_match(expected, actual, tolerance):
+            return False, f"line {i + 1}: expected {expected[:80]!r}, got {actual[:80]!r}"
+    return True, None
+
+
+def outputs_match(reference, candidate, tolerance=0.0, check_stderr=True):
+    """Check a candidate's outputs against the baseline, returning (ok, reason).
+
+    tolerance > 0 compares numbers with that relative/absolute tolerance
+    (for floating-point output); lines that vary between identical baseline
+    runs are ignored. Output files are compared the same way; one the
+    baseline doesn't write must not be written by the candidate either.
+    """
+    if not reference:
+        return True, None
+    if not candidate:
+        return False, "no output captured"
+    if "workloads" in reference:
+        # A workload matrix (see workloads.py): every workload must match its baseline
+        for name, expected in reference["workloads"].items():
+            ok, reason = outputs_match(expected, (candidate.get("workloads") or {}).get(name), tolerance,
+                                       check_stderr)
+            if not ok:
+                return False, f"workload {name}: {reason}"
+        return True, None
+
+    streams = ["stdout", "stderr"] if check_stderr else ["stdout"]
+    for name in streams:
+        ok, reason = _stream_matches(reference[name], candidate[name], tolerance)
+        if not ok:
+            return False, f"{name} {reason}"
+
+    for path, expected in reference["files"].items():
+        actual = candidate["files"].get(path)
+        if expected is None or actual is None:
+            if actual is not expected:
+                return False, f"output file {path} was {'not ' if actual is None else ''}written"
+            continue
+        ok, reason = _stream_matches(expected, actual, tolerance)
+        if not ok:
+            return False, f"output file {path} {reason}"
+    return True, None
@@ -1,98 +1,691 @@
 from groq import Groq
-import os, json
+import os, json, copy, shutil, tempfile, functools
+from concurrent.futures import ThreadPoolExecutor
 from dotenv import load_dotenv
-from utils import json_to_cpp, compile_and_run_project
-
-load_dotenv()
-api_key = os.getenv("GROQ_API_KEY")
-client = Groq(api_key=api_key)
-
-def reinforcement_loop(label, original_json, baseline_time, iterations=3, clang_args=None, run_args=None):
-    print(f"Baseline runtime: {baseline_time:.6f}s")
-    
-    best_json = original_json.copy()
-    best_time = baseline_time if baseline_time else float('inf')
-
-    for i in range(iterations):
-        print(f"\n--- Iteration {i+1} ---")
-
-        # 1. System Prompt ( Allowed structural changes and required scope resolution)
-        system_msg = (
-            "You are a C++ Performance Expert.\n"
-            "Goal: Optimize the C++ code to reduce execution time. Architectural refactors (like AoS to SoA) are highly encouraged.\n"
-            "Format: Return a JSON object with 'functions' and/or 'classes' keys containing ONLY the items you modified.\n"
-            "Ensure class methods maintain their scope resolution (e.g., ClassName::MethodName) if moved outside the class definition.\n"
-            "Do NOT return the full file."
-        )
-
-        # 2. User Prompt (FIXED: Encouraged memory layout optimization)
-        user_msg = (
-            f"Current Runtime: {best_time:.6f}s\n"
-            "Identify bottlenecks (loops, memory layout, AoS vs SoA) and optimize them.\n"
-            "Use -O3 friendly code (std::move, references, SIMD-friendly layouts).\n\n"
-            f"Code State:\n{json.dumps(best_json)}"
-        )
+from utils import json_to_cpp, benchmark_project, get_code
+from benchmark import format_stats, format_counters, DEFAULT_WARMUP, DEFAULT_REPETITIONS
+from profiler import profile_project, hot_subset, format_profile, DEFAULT_TOP_K
+from correctness import outputs_match
+from writeback import write_tree, apply_changes
+from parsecache import PARSER, error_messages
+from antipatterns import format_findings
+from remarks import attribute_remarks, format_remarks, remark_changes
+from objectives import improves, ranking_key, update_front, metrics, objective_prompt, time_only, \
+    format_objectives, score
+from patching import make_diff, apply_diff
+from microbench import benchmark_functions, format_functions, profile_from_stats
+from workloads import format_workloads, THREADS_ENV
+from parallel import parallel_prompt, build_flags, parallel_threads
+from sanitize import sanitizer_check, candidate_sanitizers, new_report, SANITIZERS, SANITIZE_CANDIDATES
+from search import record_edit, combine_edits, select_beam, state_key, single_edits, record_variant, composite, \
+    DEFAULT_BEAM_WIDTH, DEFAULT_PATIENCE, ABLATION, MAX_ABLATED_CANDIDATES
 
-        try:
-            response = client.chat.completions.create(
-                model="openai/gpt-oss-120b",
-                messages=[
-                    {"role": "system", "content": system_msg},
-                    {"role": "user", "content": user_msg}
-                ],
-                temperature=0.2, # Low temp = more valid JSON
-                response_format={"type": "json_object"}
-            )
-            
-            # 3. Merge Strategy (Now handles both functions and classes)
-            changes = json.loads(response.choices[0].message.content.strip())
-            candidate_json = best_json.copy()
-            
-            # Merge Functions
-            if "functions" in changes:
-                print(f"    AI optimized {len(changes['functions'])} functions")
-                for name, code in changes["functions"].items():
-                    candidate_json["functions"][name] = code
-            
-            # Merge Classes
-            if "classes" in changes:
-                print(f"    AI optimized {len(changes['classes'])} classes")
-                if "classes" not in candidate_json:
-                    candidate_json["classes"] = {}
-                    
-                for class_name, class_data in changes["classes"].items():
-                    if class_name in candidate_json["classes"]:
-                        # Overwrite the main class definition (strips out old inline methods)
-                        if "definition" in class_data:
-                            candidate_json["classes"][class_name]["definition"] = class_data["definition"]
-                        # Overwrite specific methods if provided
-                        if "methods" in class_data:
-                            for method_name, method_code in class_data["methods"].items():
-                                candidate_json["classes"][class_name]["methods"][method_name] = method_code
-                    else:
-                        # If the AI generated a completely new class structure
-                        candidate_json["classes"][class_name] = class_data
-            
-            # Merge new headers if needed
-            if "headers" in changes:
-                old_h = set(candidate_json.get("headers", []))
-                new_h = set(changes["headers"])
-                candidate_json["headers"] = list(old_h.union(new_h))
 
-        except Exception as e:
-            print(f"❌ JSON Error: {e}")
-            continue
-
-        # 4. Test
-        cpp_file = json_to_cpp(candidate_json, f"iter_{i+1}.cpp")
-        runtime = compile_and_run_project([cpp_file], run_args=run_args, clang_args=clang_args)
-        
-        if runtime is not None and runtime < best_time:
-            print(f" Improvement! {best_time:.6f}s -> {runtime:.6f}s")
-            best_time = runtime
-            best_json = candidate_json
+@functools.lru_cache(maxsize=None)
+def groq_client():
+    """The LLM client, built on first use: parse workers importing this module never need one."""
+    load_dotenv()
+    return Groq(api_key=os.getenv("GROQ_API_KEY"))
+
+
+# Diversity for parallel candidates: candidate 0 is the classic low-temperature
+# request, the others trade JSON reliability for more exploratory rewrites.
+CANDIDATE_TEMPERATURES = [0.2, 0.5, 0.7, 0.9]
+CANDIDATE_HINTS = [
+    "",
+    "Focus on memory layout and cache locality.\n",
+    "Focus on algorithmic complexity and redundant work.\n",
+    "Focus on tight loops: hoisting, branch removal and SIMD-friendly rewrites.\n",
+]
+
+# Reparse candidates with libclang before building them (see parsecache.py)
+PARSE_CHECK = os.getenv("OPTIMIZER_PARSE_CHECK", "1") != "0"
+
+# A conversation is reset (full code state re-sent) once its history grows past this
+MAX_HISTORY_CHARS = int(os.getenv("OPTIMIZER_MAX_HISTORY_CHARS", "120000"))
+
+SYSTEM_PROMPT = (
+    "You are a C++ Performance Expert.\n"
+    "Goal: Optimize the C++ code to reduce execution time. Architectural refactors (like AoS to SoA) are highly encouraged.\n"
+    "Format: Return a JSON object with 'functions' and/or 'classes' keys containing ONLY the items you modified.\n"
+    "For small edits you may instead return a 'diffs' object mapping 'functions/<name>' or 'classes/<Name>' "
+    "to a unified diff against the code you were shown.\n"
+    "Ensure class methods maintain their scope resolution (e.g., ClassName::MethodName) if moved outside the class definition.\n"
+    "Do NOT return the full file."
+)
+
+
+def flat_state(code_json):
+    """{"functions/<name>" or "classes/<Name>": code} of a code state, the unit of diffs and deltas."""
+    items = {f"functions/{name}": get_code(code) for name, code in code_json.get("functions", {}).items()}
+    items.update({f"classes/{name}": get_code(data) for name, data in code_json.get("classes", {}).items()})
+    return items
+
+
+class Conversation:
+    """One candidate stream's chat with the model, kept across iterations.
+
+    The first request carries the code state; later ones only the outcome of
+    the previous candidate and the items that changed since the model last
+    saw them (as diffs), so prompt and answer size follow the change size.
+    """
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.messages = []
+        self.seen = {}
+        self.proposed = None
+        self.outcome = None
+        self.remarks = ""
+
+    def size(self):
+        return sum(len(m["content"]) for m in self.messages)
+
+    def record(self, accepted, stats=None, reason=None, note=""):
+        """Remember how the last candidate did (plus a note, e.g. on vectorization), for the next message."""
+        if self.proposed is None:
+            return
+        if accepted:
+            # The model's own proposal is now the current code
+            self.seen.update({k: v for k, v in self.proposed.items() if k in self.seen})
+            self.outcome = f"Your last candidate was ACCEPTED ({stats['median']:.6f}s); it is now the current code."
+        elif stats is not None:
+            self.outcome = f"Your last candidate was rejected ({stats['median']:.6f}s): {reason or 'not significantly faster'}."
         else:
-            print(f"⚠️ No improvement ({runtime}s)")
-            if os.path.exists(cpp_file): os.remove(cpp_file)
+            self.outcome = f"Your last candidate was rejected: {reason or 'it failed to compile or run'}."
+        if note:
+            self.outcome += f" {note}"
+        self.proposed = None
+
+
+def _state_message(code_state, counters_text, profile_text, best_time, hint, objective="", findings_text="",
+                   remarks_text=""):
+    return (
+        f"Current Runtime: {best_time:.6f}s\n"
+        f"{counters_text}"
+        f"{objective}"
+        "Identify bottlenecks (loops, memory layout, AoS vs SoA) and optimize them.\n"
+        "Use -O3 friendly code (std::move, references, SIMD-friendly layouts).\n"
+        f"{hint}\n"
+        f"{profile_text}"
+        f"{findings_text}"
+        f"{remarks_text}"
+        f"Code State:\n{json.dumps({k: v for k, v in code_state.items() if k != 'findings'})}"
+    )
+
+
+def _delta_message(conversation, shown, counters_text, profile_text, best_time, objective="", remarks_text=""):
+    """Follow-up request (and the state the model will have seen): last outcome plus what changed since."""
+    parts = [conversation.outcome or "", f"Current Runtime: {best_time:.6f}s", counters_text.rstrip(),
+             objective.rstrip()]
+    current = flat_state(shown)
+    changes = []
+    for key, code in current.items():
+        if key not in conversation.seen:
+            changes.append(f"New in view: {key}\n{code}")
+        elif conversation.seen[key] != code:
+            changes.append(f"Changed since you last saw it:\n{make_diff(conversation.seen[key], code, key)}")
+    parts.append("\n\n".join(changes) if changes else "The code is otherwise unchanged.")
+    if profile_text:
+        parts.append(profile_text.rstrip())
+    if remarks_text:
+        parts.append(remarks_text.rstrip())
+    parts.append("Propose the next optimization.")
+    return "\n".join(p for p in parts if p), {**conversation.seen, **current}
+
+
+def request_candidate(best_json, best_stats, temperature=0.2, hint="", profile=None, top_k=DEFAULT_TOP_K,
+                      conversation=None, objectives=None, findings=None, system_prompt=SYSTEM_PROMPT):
+    """Ask the LLM for one optimized variant of best_json, returning the merged candidate.
+
+    With a profile only the top_k hot functions (plus callees and the classes
+    they use) are sent, together with the profile numbers. Hardware counters of
+    the current best tell the model which bottleneck to target. With a
+    conversation, follow-up requests only send deltas (see Conversation).
+    objectives (see objectives.py) beyond runtime are named in every prompt.
+    findings (see antipatterns.py) about the shown code open the conversation.
+    The vectorizer remarks of the current best's build (see remarks.py) are
+    sent with the first request and again when they change.
+    """
+    objective = objective_prompt(objectives, best_stats)
+    best_time = best_stats["median"] if best_stats else float('inf')
+    counters = format_counters(best_stats)
+    counters_text = f"Hardware counters: {counters}\n" if counters else ""
+    if format_workloads(best_stats):
+        counters_text += f"Runtime per workload ({best_stats['aggregate']} is the score): {format_workloads(best_stats)}\n"
+    code_state = hot_subset(best_json, profile, top_k) if profile else None
+    profile_text = f"{format_profile(profile, top_k)}\nOnly the hot code is shown; optimize it.\n\n" if code_state else ""
+    shown = code_state or best_json
+    visible = flat_state(shown)
+    remarks = format_remarks(best_stats.get("remarks") if best_stats else None, visible)
+    remarks_text = f"Compiler vectorization remarks (lines within each function):\n{remarks}\n\n" if remarks else ""
+
+    if conversation is not None and conversation.size() > MAX_HISTORY_CHARS:
+        conversation.reset()
+    if conversation is not None and conversation.messages:
+        user_msg, seen = _delta_message(conversation, shown, counters_text, profile_text, best_time, objective,
+                                        remarks_text if remarks_text != conversation.remarks else "")
+        history = conversation.messages
+    else:
+        relevant = [f for f in findings or [] if f["item"] in visible]
+        findings_text = f"Static analysis findings:\n{format_findings(relevant)}\n\n" if relevant else ""
+        user_msg = _state_message(shown, counters_text, profile_text, best_time, hint, objective, findings_text,
+                                  remarks_text)
+        seen = visible
+        history = []
+
+    response = groq_client().chat.completions.create(
+        model="openai/gpt-oss-120b",
+        messages=[{"role": "system", "content": system_prompt}] + history + [{"role": "user", "content": user_msg}],
+        temperature=temperature, # Low temp = more valid JSON
+        response_format={"type": "json_object"}
+    )
+
+    # 3. Merge Strategy (diffs first, then whole functions and classes)
+    content = response.choices[0].message.content.strip()
+    changes = json.loads(content)
+    # Deep copy: candidates are merged concurrently and must never alias best_json
+    candidate_json = copy.deepcopy(best_json)
+
+    # Apply diffs against the code the model was shown
+    for key, diff in (changes.get("diffs") or {}).items():
+        kind, _, name = key.partition("/")
+        if kind == "functions" and name in candidate_json.get("functions", {}):
+            candidate_json["functions"][name] = apply_diff(get_code(candidate_json["functions"][name]), diff)
+        elif kind == "classes" and name in candidate_json.get("classes", {}):
+            cls = candidate_json["classes"][name]
+            cls["definition"] = apply_diff(cls["definition"], diff)
+        else:
+            raise ValueError(f"diff for unknown item {key}")
+    if changes.get("diffs"):
+        print(f"    AI sent {len(changes['diffs'])} diffs")
+
+    # Merge Functions
+    if "functions" in changes:
+        print(f"    AI optimized {len(changes['functions'])} functions")
+        for name, code in changes["functions"].items():
+            candidate_json["functions"][name] = code
+
+    # Merge Classes
+    if "classes" in changes:
+        print(f"    AI optimized {len(changes['classes'])} classes")
+        if "classes" not in candidate_json:
+            candidate_json["classes"] = {}
+
+        for class_name, class_data in changes["classes"].items():
+            if class_name in candidate_json["classes"]:
+                # Overwrite the main class definition (strips out old inline methods)
+                if "definition" in class_data:
+                    candidate_json["classes"][class_name]["definition"] = class_data["definition"]
+                # Overwrite specific methods if provided
+                if "methods" in class_data:
+                    for method_name, method_code in class_data["methods"].items():
+                        candidate_json["classes"][class_name]["methods"][method_name] = method_code
+            else:
+                # If the AI generated a completely new class structure
+                candidate_json["classes"][class_name] = class_data
+
+    # Merge new headers if needed
+    if "headers" in changes:
+        old_h = set(candidate_json.get("headers", []))
+        new_h = set(changes["headers"])
+        candidate_json["headers"] = list(old_h.union(new_h))
+
+    if conversation is not None:
+        conversation.messages += [{"role": "user", "content": user_msg}, {"role": "assistant", "content": content}]
+        conversation.seen = seen
+        conversation.remarks = remarks_text
+        conversation.outcome = None
+        conversation.proposed = flat_state(candidate_json)
+    return candidate_json
+
+def candidate_sources(candidate_json, sandbox, name, clang_args=None, layout=None, original_json=None):
+    """Write a candidate into sandbox, returning (files to compile, clang_args).
+
+    Without a layout it becomes one combined TU; with one (see writeback.py)
+    its changes are applied to a copy of the original project files.
+    """
+    if layout:
+        return write_tree(layout, original_json, candidate_json, os.path.join(sandbox, "src"), clang_args)
+    return [json_to_cpp(candidate_json, os.path.join(sandbox, f"{name}.cpp"))], clang_args
+
+def candidate_errors(candidate_json, slot, clang_args=None, layout=None, original_json=None, build_root=None):
+    """Error messages libclang reports for a candidate, reparsing only what it changed.
+
+    Combined candidates are written to one fixed path per slot, so their TU
+    (and its preamble of #includes) is reused; with a layout the edited files
+    are passed as unsaved files to the project TUs that include them.
+    """
+    if layout:
+        changed = {p: data.decode(errors="replace")
+                   for p, data in apply_changes(original_json, candidate_json, layout["locations"]).items()}
+        errors = set()
+        for src, args in layout["parse_args"].items():
+            if changed and not PARSER.depends_on(src, changed):
+                continue
+            errors |= PARSER.parse(src, args or [], changed, use=error_messages)
+        return errors
+    path = os.path.join(build_root or tempfile.gettempdir(), f"cppopt_parse_{slot}.cpp")
+    json_to_cpp(candidate_json, path)
+    return PARSER.parse(path, clang_args or [], use=error_messages)
+
+def evaluate_candidate(candidate_json, name, clang_args=None, run_args=None,
+                       warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, work_dir=None, build_root=None,
+                       output_files=None, layout=None, original_json=None, microbench=None, workloads=None):
+    """Compile and benchmark a candidate in its own sandbox directory, running it from work_dir.
+
+    With a microbench plan (see microbench.py) the planned functions are timed
+    in a harness instead of running the whole program.
+    """
+    sandbox = tempfile.mkdtemp(prefix=f"{name}_", dir=build_root)
+    try:
+        cpp_files, clang_args = candidate_sources(candidate_json, sandbox, name, clang_args, layout, original_json)
+        if microbench:
+            return benchmark_functions(cpp_files, candidate_json, microbench, clang_args, build_dir=sandbox,
+                                       cwd=work_dir)
+        stats = benchmark_project(cpp_files, run_args=run_args, clang_args=clang_args,
+                                  warmup=warmup, repetitions=repetitions, build_dir=sandbox, cwd=work_dir,
+                                  output_files=output_files, workloads=workloads)
+        # Attributed while the sources still exist
+        if stats is not None and stats.get("remarks"):
+            stats["remarks"] = attribute_remarks(stats["remarks"], candidate_json, cpp_files)
+        return stats
+    finally:
+        shutil.rmtree(sandbox, ignore_errors=True)
+
+def sanitize_candidate(candidate_json, name, sanitizer, clang_args=None, run_args=None, work_dir=None,
+                       build_root=None, layout=None, original_json=None, env=None, output_files=None):
+    """Run a candidate once in a sanitizer build (see sanitize.py), returning (verdict, report)."""
+    sandbox = tempfile.mkdtemp(prefix=f"{name}_{sanitizer}_", dir=build_root)
+    try:
+        cpp_files, clang_args = candidate_sources(candidate_json, sandbox, name, clang_args, layout, original_json)
+        return sanitizer_check(cpp_files, sanitizer, clang_args, run_args, cwd=work_dir, build_dir=sandbox, env=env,
+                               output_files=output_files)
+    finally:
+        shutil.rmtree(sandbox, ignore_errors=True)
+
+def sanitizer_failure(candidate_json, name, clang_args=None, run_args=None, work_dir=None, build_root=None,
+                      layout=None, original_json=None, output_files=None, sanitize=SANITIZE_CANDIDATES,
+                      parallelize=False):
+    """Why a candidate fails the sanitizer gate, or None; reports the original code has too don't count."""
+    race_env = dict(os.environ, **{THREADS_ENV: str(max(parallel_threads(), 2))})
+    for sanitizer in candidate_sanitizers(candidate_json, sanitize, parallelize):
+        env = race_env if sanitizer == "thread" else None
+        verdict, report = sanitize_candidate(candidate_json, name, sanitizer, clang_args, run_args, work_dir,
+                                             build_root, layout, original_json, env, output_files)
+        if verdict is None:
+            print(f"⚠️  {name}: {SANITIZERS[sanitizer]['name']} check unavailable ({report})")
+        elif verdict is False:
+            known, known_report = sanitize_candidate(original_json, f"{name}_base", sanitizer, clang_args, run_args,
+                                                     work_dir, build_root, layout, original_json, env, output_files)
+            if known is False and not new_report(known_report, report):
+                continue
+            return f"{SANITIZERS[sanitizer]['name']} reported:\n{report}"
+    return None
+
+def profile_candidate(candidate_json, clang_args=None, run_args=None, work_dir=None, build_root=None,
+                      layout=None, original_json=None):
+    """Re-profile an accepted candidate so the next prompt targets the new hotspots."""
+    sandbox = tempfile.mkdtemp(prefix="profile_", dir=build_root)
+    try:
+        cpp_files, clang_args = candidate_sources(candidate_json, sandbox, "profiled", clang_args, layout, original_json)
+        return profile_project(cpp_files, run_args=run_args, clang_args=clang_args, build_dir=sandbox, cwd=work_dir)
+    finally:
+        shutil.rmtree(sandbox, ignore_errors=True)
+
+def reinforcement_loop(label, original_json, baseline_stats, iterations=3, clang_args=None, run_args=None,
+                       warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, parallel=1,
+                       work_dir=None, build_root=None, progress=None, profile=None, top_k=DEFAULT_TOP_K,
+                       output_files=None, float_tolerance=0.0, layout=None, microbench=None, objectives=None,
+                       start_json=None, workloads=None, parallelize=False, sanitize=SANITIZE_CANDIDATES,
+                       beam_width=DEFAULT_BEAM_WIDTH, patience=DEFAULT_PATIENCE, ablation=ABLATION):
+    """Iteratively ask the LLM for optimizations, keeping only statistically significant speedups.
+
+    With parallel > 1 each iteration requests that many diverse candidates at once,
+    compiles and benchmarks them concurrently and keeps the best one. Candidates
+    are built under build_root and run from work_dir; the process cwd is never used.
+    progress, if given, is called with a dict after every iteration.
+    A profile (see profiler.py) limits the prompt to the top_k hot functions.
+    A candidate only counts if its stdout/stderr and output_files match the
+    baseline's (numbers within float_tolerance, if set).
+    With a layout candidates are built as edits to the original project files.
+    With a microbench plan candidates are timed function by function instead
+    of as a whole program, and the per-function timings serve as the profile.
+    Each candidate slot keeps its conversation with the model across
+    iterations, so later prompts only carry what changed.
+    Candidates with new libclang errors are rejected before they are built.
+    objectives (see objectives.py) replaces runtime as what counts as better;
+    returns (best_json, best_time, best_stats, Pareto front of the correct
+    candidates on those objectives).
+    start_json (e.g. the result of rewrites.py, measured as baseline_stats)
+    is where the search starts; original_json stays the reference for
+    write-back and findings.
+    With a workload matrix (see workloads.py) candidates run on every
+    workload and are judged on its aggregate.
+    parallelize asks for multithreaded code (see parallel.py); candidates
+    that use threads must then pass a ThreadSanitizer run.
+    With sanitize every candidate is also built with ASan+UBSan (and TSan if
+    it uses threads, see sanitize.py) while it is being timed; a candidate
+    is only promoted once those runs come back clean.
+    beam_width > 1 searches several lineages at once and combines
+    independent edits (see search.py); patience stops the loop after that
+    many iterations without a new best.
+    With ablation a round's correct candidates that changed several items
+    (accepted or not) are also timed one item at a time, and the loop ends
+    with a composite of the best version of every item (see search.py).
+    """
+    print(f"Baseline runtime: {format_stats(baseline_stats)}")
+    if format_counters(baseline_stats):
+        print(f"Baseline counters: {format_counters(baseline_stats)}")
+
+    best_json = copy.deepcopy(start_json or original_json)
+    best_stats = baseline_stats
+    best_time = baseline_stats["median"] if baseline_stats else float('inf')
+    conversations = [Conversation() for _ in range(max(1, parallel))]
+    objectives = objectives or {"time": 1.0}
+    original_items = flat_state(original_json)
+
+    def open_findings():
+        # Findings describe the original code; they lapse once their item changes
+        current = flat_state(best_json)
+        return [f for f in original_json.get("findings", [])
+                if current.get(f["item"]) == original_items.get(f["item"])]
+    threads = max([w["threads"] for w in (workloads or {}).get("runs", [])] + [parallel_threads() if parallelize else 1])
+    system_prompt = SYSTEM_PROMPT + (parallel_prompt(threads) if parallelize else "")
+    # Races show up more readily with every thread the benchmark uses
+    race_env = dict(os.environ, **{THREADS_ENV: str(max(threads, 2))})
+    rank = ranking_key(baseline_stats, objectives)
+    front = [{"iteration": 0, "metrics": metrics(baseline_stats, objectives)}] if baseline_stats else []
+    if not time_only(objectives):
+        print(f"Objectives: {format_objectives(objectives)}")
+
+    def parse_errors(code_json, slot):
+        try:
+            return candidate_errors(code_json, slot, clang_args, layout, original_json, build_root)
+        except Exception as e:
+            print(f"⚠️  Parse check unavailable: {e}")
+            return None
+
+    # Errors the original already has (e.g. missing system headers for
+    # libclang) are not the candidate's fault
+    baseline_errors = parse_errors(original_json, "base") if PARSE_CHECK else None
+
+    # Sanitizer builds run beside the timed ones; only a candidate about to be promoted waits for them
+    checks = ThreadPoolExecutor(max_workers=2 * max(1, parallel))
+
+    def check(code_json, name, args):
+        sanitizers = [] if microbench else candidate_sanitizers(code_json, sanitize, parallelize)
+        return {s: checks.submit(sanitize_candidate, code_json, name, s, args, run_args, work_dir, build_root,
+                                 layout, original_json, race_env if s == "thread" else None, output_files)
+                for s in sanitizers}
+
+    # Reports of the starting code are the program's own, not a candidate's fault
+    baseline_checks = check(best_json, "base", clang_args)
+    unclean_baseline = set()
+
+    def baseline_report(sanitizer):
+        # The baseline's report, announced once: candidates are only failed for other errors then
+        verdict, report = baseline_checks[sanitizer].result() if sanitizer in baseline_checks else (True, None)
+        if verdict is not False:
+            return None
+        if sanitizer not in unclean_baseline:
+            unclean_baseline.add(sanitizer)
+            print(f"⚠️  The starting code already fails {SANITIZERS[sanitizer]['name']}, "
+                  f"candidates are only rejected for other reports:\n{report}")
+        return report
+
+    def check_failure(pending, name):
+        """Why a candidate's sanitizer runs fail it, or None (waits for them)."""
+        for sanitizer, future in pending.items():
+            verdict, report = future.result()
+            if verdict is None:
+                print(f"⚠️  {name}: {SANITIZERS[sanitizer]['name']} check unavailable ({report})")
+            elif verdict is False:
+                known = baseline_report(sanitizer)
+                if known is not None and not new_report(known, report):
+                    continue
+                return f"{SANITIZERS[sanitizer]['name']} reported:\n{report}"
+        return None
+
+    def promote(code_json, stats):
+        nonlocal best_json, best_stats, best_time, profile
+        print(f" Improvement! {format_stats(best_stats)} -> {format_stats(stats)}")
+        if format_counters(stats):
+            print(f"    Counters: {format_counters(best_stats)} -> {format_counters(stats)}")
+        if format_functions(stats):
+            print(f"    Functions: {format_functions(best_stats)} -> {format_functions(stats)}")
+        if format_workloads(stats):
+            print(f"    Workloads: {format_workloads(best_stats)} -> {format_workloads(stats)}")
+        best_stats = stats
+        best_time = stats["median"]
+        best_json = code_json
+        if microbench:
+            profile = profile_from_stats(stats) or profile
+        elif profile:
+            profile = profile_candidate(best_json, clang_args, run_args, work_dir, build_root,
+                                        layout, original_json) or profile
+
+    def build_args(code_json):
+        return list(clang_args or []) + build_flags(code_json) if parallelize else clang_args
+
+    # Lineages the next candidates start from (just the best one when greedy, see search.py)
+    beam = [{"json": best_json, "stats": best_stats}]
+    edits, measured = [], {state_key(best_json)}
+    variants = {}
+    slots = max(1, parallel)
+    stale = 0
+
+    def measure(code_json, name):
+        # Time a state the loop made itself; its stats, or None if it failed or printed something else
+        stats = evaluate_candidate(code_json, name, build_args(code_json), run_args, warmup, repetitions, work_dir,
+                                   build_root, output_files, layout, original_json, microbench, workloads)
+        ok, reason = outputs_match(baseline_stats.get("output"), stats.get("output"), float_tolerance) \
+            if stats is not None and baseline_stats else (stats is not None, "build or run failed")
+        if not ok:
+            print(f"❌ {name} rejected: {reason}")
+            return None
+        return stats
+
+    def try_merged(code_json, name):
+        """Time a state merged from earlier candidates and promote it if it's better; its stats if it was."""
+        measured.add(state_key(code_json))
+        pending = check(code_json, name, build_args(code_json))
+        stats = measure(code_json, name)
+        try:
+            if stats is not None and improves(best_stats, stats, baseline_stats, objectives) \
+                    and check_failure(pending, name) is None:
+                promote(code_json, stats)
+                return stats
+            if stats is not None:
+                print(f"⚠️ {name} not significantly better ({format_stats(stats)})")
+            return None
+        finally:
+            for future in pending.values():
+                future.cancel()
+
+    def ablate(parent, code_json, name):
+        # Each changed item on its own, so its share of the candidate's speedup is known
+        singles = single_edits(parent["json"], code_json)
+        timings = list(pool.map(lambda n: measure(singles[n][1], f"{name}_ablate_{n+1}"), range(len(singles))))
+        parts = []
+        for (item, single_json), single_stats in zip(singles, timings):
+            if single_stats is None:
+                parts.append(f"{item[1]} fails on its own")
+                continue
+            speedup = parent["stats"]["median"] / single_stats["median"]
+            record_variant(variants, parent["json"], item, single_json, speedup)
+            if beam_width > 1:
+                record_edit(edits, parent["json"], parent["stats"], single_json, single_stats)
+            parts.append(f"{item[1]} {speedup:.2f}x")
+        if parts:
+            print(f"🔬 {name} one item at a time: {', '.join(parts)}")
+        return f"On its own each change was: {', '.join(parts)}." if parts else ""
+
+    with ThreadPoolExecutor(max_workers=slots) as pool, checks:
+        for i in range(iterations):
+            if patience and stale >= patience:
+                print(f"\n⏹️  No improvement in {stale} iterations, stopping early")
+                break
+            print(f"\n--- Iteration {i+1} ---")
+            if progress:
+                progress({"stage": "iteration", "iteration": i + 1, "of": iterations})
+
+            # Candidate slots take turns on the lineages of the beam
+            parents = [beam[(i * slots + c) % len(beam)] for c in range(slots)]
+
+            def slot_name(c):
+                return f"iter_{i+1}" if parallel <= 1 else f"iter_{i+1}_{c+1}"
+
+            def attempt(c):
+                temperature = CANDIDATE_TEMPERATURES[c % len(CANDIDATE_TEMPERATURES)]
+                hint = CANDIDATE_HINTS[c % len(CANDIDATE_HINTS)]
+                try:
+                    candidate_json = request_candidate(parents[c]["json"], parents[c]["stats"], temperature, hint,
+                                                       profile, top_k, conversations[c], objectives,
+                                                       open_findings(), system_prompt)
+                except Exception as e:
+                    print(f"❌ JSON Error: {e}")
+                    return None, None, None, {}
+
+                # 4. Test
+                name = slot_name(c)
+                if baseline_errors is not None:
+                    errors = (parse_errors(candidate_json, c) or set()) - baseline_errors
+                    if errors:
+                        print(f"❌ {name} rejected before building: {'; '.join(sorted(errors)[:3])}")
+                        return candidate_json, None, f"does not compile: {'; '.join(sorted(errors)[:5])}", {}
+                args = build_args(candidate_json)
+                pending = check(candidate_json, name, args)
+                stats = evaluate_candidate(candidate_json, name, args, run_args,
+                                           warmup, repetitions, work_dir, build_root, output_files,
+                                           layout, original_json, microbench, workloads)
+
+                # Correctness gate: a faster program that prints something else is not an optimization
+                if stats is not None and baseline_stats:
+                    ok, reason = outputs_match(baseline_stats.get("output"), stats.get("output"), float_tolerance)
+                    if not ok:
+                        print(f"❌ {name} rejected, output differs from baseline: {reason}")
+                        return candidate_json, None, f"output differs from the original program: {reason}", pending
+                return candidate_json, stats, None, pending
+
+            results = list(pool.map(attempt, range(slots)))
+
+            # Keep the fastest candidate of this round, if it beats the current best
+            finished = [(c, r[1]) for c, r in enumerate(results) if r[1] is not None]
+            if not finished:
+                print("⚠️ No candidate compiled and ran successfully")
+                for c, r in enumerate(results):
+                    conversations[c].record(False, reason=r[2])
+                    for future in r[3].values():
+                        future.cancel()
+                stale += 1
+                if progress:
+                    progress({"stage": "iteration_done", "iteration": i + 1, "accepted": False,
+                              "candidate_time": None, "best_time": best_time})
+                continue
+            previous_remarks = best_stats.get("remarks") if best_stats else None
+            measured.update(state_key(r[0]) for r in results if r[0] is not None)
+            verdicts = {}
+
+            def failure_of(c):
+                # Sanitizer verdict of a slot's candidate, waited for only when it matters
+                if c not in verdicts:
+                    verdicts[c] = check_failure(results[c][3], slot_name(c))
+                    if verdicts[c]:
+                        print(f"❌ {slot_name(c)} rejected, {' '.join(verdicts[c].splitlines()[:2])}")
+                return verdicts[c]
+
+            # Only promote when the speedup is larger than the measurement noise and the
+            # sanitizers found nothing; a candidate they fail makes way for the runner-up
+            for winner, stats in sorted(finished, key=lambda r: rank(r[1])):
+                accepted = improves(best_stats, stats, baseline_stats, objectives)
+                if not accepted or failure_of(winner) is None:
+                    break
+                accepted = False
+            candidate_json = results[winner][0]
+            if accepted:
+                promote(candidate_json, stats)
+            else:
+                print(f"⚠️ No significant improvement ({format_stats(stats)})")
+            if not time_only(objectives):
+                print(f"    Score: {score(stats, baseline_stats, objectives):.4f} (baseline 1.0)")
+
+            if beam_width > 1:
+                # Every candidate that beat the lineage it came from is a reusable edit
+                for c, c_stats in finished:
+                    record_edit(edits, parents[c]["json"], parents[c]["stats"], results[c][0], c_stats)
+                # The beam keeps the best correct states, each once its sanitizer runs are clean
+                entries = beam + [{"json": results[c][0], "stats": c_stats, "slot": c} for c, c_stats in finished]
+                beam = [{"json": e["json"], "stats": e["stats"]}
+                        for e in select_beam(entries, len(entries), rank)
+                        if "slot" not in e or failure_of(e["slot"]) is None][:beam_width]
+            else:
+                beam = [{"json": best_json, "stats": best_stats}]
+            # Candidates that passed the output and sanitizer gates, promoted or not: a
+            # win in one function of a rejected answer still reaches the composite
+            ablation_notes = {}
+            if ablation:
+                splittable = [c for c, _ in sorted(finished, key=lambda r: rank(r[1]))
+                              if parents[c]["stats"] and single_edits(parents[c]["json"], results[c][0])
+                              and failure_of(c) is None]
+                for c in splittable[:MAX_ABLATED_CANDIDATES]:
+                    ablation_notes[c] = ablate(parents[c], results[c][0], slot_name(c))
+            for r in results:
+                for future in r[3].values():
+                    future.cancel()
+            unsafe = {c: failure for c, failure in verdicts.items() if failure}
+            for c, c_stats in finished:
+                if c not in unsafe:
+                    front = update_front(front, {"iteration": i + 1, "candidate": c + 1,
+                                                 "metrics": metrics(c_stats, objectives)}, objectives)
+
+            # Tell every conversation how its candidate did
+            for c, (_, c_stats, reason, _) in enumerate(results):
+                # Whether the change made the compiler vectorize more (or fewer) loops
+                note = remark_changes(previous_remarks, c_stats.get("remarks")) if c_stats is not None else ""
+                if ablation_notes.get(c):
+                    note = f"{note} {ablation_notes[c]}".strip()
+                if c in unsafe:
+                    conversations[c].record(False, c_stats, unsafe[c], note)
+                elif c == winner:
+                    conversations[c].record(accepted, c_stats,
+                                            None if time_only(objectives) else "no improvement on the objectives",
+                                            note)
+                elif c_stats is not None:
+                    conversations[c].record(False, c_stats, "another candidate this round was faster", note)
+                else:
+                    conversations[c].record(False, reason=reason)
+
+            # Independent edits from different lineages, applied together to the best
+            combined = combine_edits(edits, best_json) if beam_width > 1 else None
+            if combined and state_key(combined[0]) not in measured:
+                combined_json, used = combined
+                items = sorted({f"{kind}/{n}" for e in used for kind, n in e["changes"]})
+                print(f"🧩 Applying {len(used)} pooled edit(s) to the best: {', '.join(items)}")
+                c_stats = try_merged(combined_json, f"iter_{i+1}_combined")
+                if c_stats is not None:
+                    accepted = True
+                    beam = select_beam(beam + [{"json": combined_json, "stats": c_stats}], max(1, beam_width), rank)
+            stale = 0 if accepted else stale + 1
+
+            if progress:
+                progress({"stage": "iteration_done", "iteration": i + 1, "accepted": accepted,
+                          "candidate_time": stats["median"], "best_time": best_time,
+                          "counters": stats.get("counters"), "peak_rss_kb": stats.get("peak_rss_kb"),
+                          "functions": stats.get("functions"), "allocations": stats.get("allocations"),
+                          "binary_size": stats.get("binary_size"),
+                          "workloads": [{k: w[k] for k in ("name", "threads", "median")}
+                                        for w in stats.get("workloads") or []] or None,
+                          "beam": [e["stats"]["median"] for e in beam] if beam_width > 1 else None})
+
+        # The final answer: the best measured version of every item, put together
+        merged = composite(variants, best_json) if variants else None
+        if merged and state_key(merged[0]) not in measured:
+            print(f"\n🧩 Composite of the best version of each item: {', '.join(merged[1])}")
+            accepted = try_merged(merged[0], "composite") is not None
+            if progress:
+                progress({"stage": "composite", "items": merged[1], "accepted": accepted, "best_time": best_time})
 
-    return best_json, best_time
\ No newline at end of file
+    return best_json, best_time, best_stats, front
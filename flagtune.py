@@ -0,0 +1,73 @@
+import shutil
+import tempfile
+from utils import benchmark_project, compile_flags
+from benchmark import format_stats, DEFAULT_WARMUP, DEFAULT_REPETITIONS
+from correctness import outputs_match
+from objectives import improves
+
+# Build flags tried on top of the forced -O3, in this order. Each one is kept
+# only if it improves on the best configuration so far (a significant speedup,
+# or a better score when objectives weigh memory/size too) and
+# the program still produces the baseline's output; later options are
+# measured on top of the ones already kept, so gains compose.
+FLAG_OPTIONS = [
+    ["-march=native"],
+    ["-flto"],
+    ["-fno-plt"],
+    ["-funroll-loops"],
+    ["-fno-math-errno"],
+]
+# Changes floating-point results; only searched when explicitly allowed
+FAST_MATH_OPTIONS = [
+    ["-ffast-math"],
+]
+
+
+def autotune_flags(filepaths, run_args=None, clang_args=None, baseline_stats=None,
+                   warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, build_root=None, cwd=None,
+                   output_files=None, float_tolerance=0.0, allow_fast_math=False, progress=None, workloads=None, objectives=None):
+    """Greedy search over FLAG_OPTIONS with the benchmark harness.
+
+    Returns {"flags", "stats", "trials"}: the extra flags to build with, the
+    statistics of that build and one entry per configuration tried. flags is
+    empty when nothing beat the baseline. objectives ({name: weight}, see
+    objectives.py) decides what "beat" means, as in the source edit loop.
+    """
+    options = FLAG_OPTIONS + (FAST_MATH_OPTIONS if allow_fast_math else [])
+    best_flags, best_stats = [], baseline_stats
+    trials = []
+
+    for option in options:
+        flags = best_flags + option
+        print(f"\n🎛️  Trying {' '.join(option)}")
+        if progress:
+            progress({"stage": "flags", "flags": flags})
+
+        build_dir = tempfile.mkdtemp(prefix="flags_", dir=build_root)
+        try:
+            stats = benchmark_project(filepaths, run_args=run_args, clang_args=list(clang_args or []) + flags,
+                                      warmup=warmup, repetitions=repetitions, build_dir=build_dir, cwd=cwd,
+                                      output_files=output_files, workloads=workloads)
+        finally:
+            shutil.rmtree(build_dir, ignore_errors=True)
+
+        trial = {"flags": flags, "median": stats["median"] if stats else None, "accepted": False, "reason": None}
+        if stats is None:
+            trial["reason"] = "build or run failed"
+        else:
+            ok, reason = outputs_match(baseline_stats.get("output") if baseline_stats else None,
+                                       stats.get("output"), float_tolerance)
+            if not ok:
+                trial["reason"] = f"output differs: {reason}"
+            elif not improves(best_stats, stats, baseline_stats, objectives):
+                trial["reason"] = "no significant improvement"
+            else:
+                trial["accepted"] = True
+                best_flags, best_stats = flags, stats
+
+        print(f"    {format_stats(stats)} -> {'kept' if trial['accepted'] else trial['reason']}")
+        trials.append(trial)
+
+    if best_flags:
+        print(f"🎛️  Best configuration: {' '.join(compile_flags(best_flags))}")
+    return {"flags": best_flags, "stats": best_stats, "trials": trials}
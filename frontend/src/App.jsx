@@ -1,10 +1,13 @@
 import { useState } from 'react';
 import './App.css';
 
+const API_URL = "http://localhost:8000";
+
 function App() {
   const [file, setFile] = useState(null);
   const [isOptimizing, setIsOptimizing] = useState(false);
   const [statusMsg, setStatusMsg] = useState("");
+  const [progress, setProgress] = useState([]);
 
   // Handle Drag and Drop
   const handleDrop = (e) => {
@@ -32,12 +35,81 @@ function App() {
     }
   };
 
-  // Connect to FastAPI Backend
+  // Turn a backend progress event into a status line
+  const describeEvent = (event) => {
+    switch (event.stage) {
+      case "analyze":
+        return `📄 Analyzing ${event.file}...`;
+      case "baseline":
+        return "🔨 Compiling and benchmarking baseline...";
+      case "baseline_done":
+        return event.time != null
+          ? `⏱️ Baseline runtime: ${event.time.toFixed(6)}s`
+          : "⚠️ Baseline compilation failed or no runtime available";
+      case "flags":
+        return `🎛️ Trying build flags: ${event.flags.join(" ")}`;
+      case "flags_done":
+        return event.flags.length
+          ? `🎛️ Best build flags: ${event.flags.join(" ")} (${event.time.toFixed(6)}s)`
+          : "🎛️ No build flags beat the baseline";
+      case "rewrite":
+        return `🪄 Trying rewrite ${event.rewrite} in ${event.functions.join(", ")}`;
+      case "rewrites_done":
+        return event.rewrites.length
+          ? `🪄 Kept rewrites: ${event.rewrites.join(", ")} (${event.time.toFixed(6)}s)`
+          : "🪄 No mechanical rewrite helped";
+      case "profile":
+        return "🔥 Profiling hotspots...";
+      case "asm":
+        return "🔍 Disassembling hot functions...";
+      case "pgo":
+        return event.step === "bolt"
+          ? "📈 BOLT: instrumenting and training the binary..."
+          : "📈 PGO: instrumented build and training run...";
+      case "pgo_done":
+        return event.time != null
+          ? `📈 PGO/BOLT done: ${event.time.toFixed(6)}s`
+          : "📈 PGO/BOLT done";
+      case "iteration":
+        return `🤖 Iteration ${event.iteration}/${event.of}: waiting for AI candidates...`;
+      case "iteration_done":
+        return event.accepted
+          ? `✅ Iteration ${event.iteration}: improved to ${event.best_time.toFixed(6)}s`
+          : `➖ Iteration ${event.iteration}: no significant improvement`;
+      default:
+        return null;
+    }
+  };
+
+  const downloadResult = async (jobId) => {
+    const response = await fetch(`${API_URL}/jobs/${jobId}/result`);
+    if (!response.ok) {
+      const errorData = await response.json().catch(() => ({}));
+      throw new Error(errorData.detail || `Server Error: ${response.status}`);
+    }
+
+    // Convert binary response to a downloadable file
+    const blob = await response.blob();
+    const downloadUrl = window.URL.createObjectURL(blob);
+    
+    const link = document.createElement('a');
+    link.href = downloadUrl;
+    link.download = `optimized_${file.name}`;
+    document.body.appendChild(link);
+    link.click();
+    
+    // Cleanup
+    link.remove();
+    window.URL.revokeObjectURL(downloadUrl);
+  };
+
+  // Connect to FastAPI Backend: submit a job, then follow its progress stream
   const handleOptimize = async () => {
     if (!file) return;
     
     setIsOptimizing(true);
-    setStatusMsg("🤖 AI is analyzing and compiling... This usually takes 30-60 seconds.");
+    setProgress([]);
+    setStatusMsg("📤 Submitting optimization job...");
 
     const formData = new FormData();
     formData.append("cpp_files", file);
@@ -47,7 +119,7 @@ function App() {
     formData.append("skip_execution", false);
 
     try {
-      const response = await fetch("http://localhost:8000/optimize-files", {
+      const response = await fetch(`${API_URL}/jobs/optimize-files`, {
         method: "POST",
         body: formData,
       });
@@ -57,20 +129,34 @@ function App() {
         throw new Error(errorData.detail || `Server Error: ${response.status}`);
       }
 
-      // Convert binary response to a downloadable file
-      const blob = await response.blob();
-      const downloadUrl = window.URL.createObjectURL(blob);
-      
-      const link = document.createElement('a');
-      link.href = downloadUrl;
-      link.download = `optimized_${file.name}`;
-      document.body.appendChild(link);
-      link.click();
-      
-      // Cleanup
-      link.remove();
-      window.URL.revokeObjectURL(downloadUrl);
+      const { job_id } = await response.json();
+      setStatusMsg("🤖 AI is analyzing and compiling...");
+
+      await new Promise((resolve, reject) => {
+        const events = new EventSource(`${API_URL}/jobs/${job_id}/events`);
+        events.onmessage = (message) => {
+          const event = JSON.parse(message.data);
+          if (event.stage === "done") {
+            events.close();
+            resolve();
+          } else if (event.stage === "failed") {
+            events.close();
+            reject(new Error(event.error || "Optimization failed"));
+          } else {
+            const line = describeEvent(event);
+            if (line) {
+              setStatusMsg(line);
+              setProgress((lines) => [...lines, line]);
+            }
+          }
+        };
+        events.onerror = () => {
+          events.close();
+          reject(new Error("Lost connection to the optimization job"));
+        };
+      });
 
+      await downloadResult(job_id);
       setStatusMsg("✅ Optimization complete! Your file has been downloaded.");
     } catch (error) {
       console.error(error);
@@ -116,6 +202,12 @@ function App() {
         </div>
       )}
 
+      {progress.length > 0 && (
+        <ul className="progress-log">
+          {progress.map((line, i) => <li key={i}>{line}</li>)}
+        </ul>
+      )}
+
       {statusMsg && (
         <div className={`status-message ${statusMsg.includes('❌') ? 'error' : ''}`}>
           {statusMsg}
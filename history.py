@@ -0,0 +1,224 @@
+import contextlib
+import hashlib
+import json
+import os
+import sqlite3
+import threading
+import time
+from cache import CACHE_DIR
+from uploads import SKIP_DIRS, SKIP_DIR_PREFIXES
+from feedback import flat_state
+from patching import make_diff
+
+# Results history: every optimization run is recorded in a SQLite database
+# (project, hash of the uploaded files, options, baseline and best metrics,
+# the per-iteration candidates and the accepted changes as diffs), so the
+# same service submitted release after release can be compared with its
+# last run, and a known-good result for unchanged sources is reused instead
+# of paying for the model again.
+HISTORY_ENABLED = os.getenv("OPTIMIZER_HISTORY", "1") != "0"
+HISTORY_DB = os.path.expanduser(os.getenv("OPTIMIZER_HISTORY_DB", os.path.join(CACHE_DIR, "history.sqlite")))
+MAX_LISTED_RUNS = 200
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS runs (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    project TEXT NOT NULL,
+    project_hash TEXT NOT NULL,
+    created REAL NOT NULL,
+    options TEXT NOT NULL,
+    build_flags TEXT,
+    baseline_time REAL,
+    best_time REAL,
+    summary TEXT,
+    diffs TEXT,
+    best_json TEXT
+);
+CREATE INDEX IF NOT EXISTS runs_by_project ON runs (project, id);
+CREATE INDEX IF NOT EXISTS runs_by_hash ON runs (project_hash, id);
+CREATE TABLE IF NOT EXISTS candidates (
+    run_id INTEGER NOT NULL REFERENCES runs (id) ON DELETE CASCADE,
+    iteration INTEGER,
+    accepted INTEGER,
+    time REAL,
+    best_time REAL,
+    metrics TEXT
+);
+CREATE INDEX IF NOT EXISTS candidates_by_run ON candidates (run_id);
+"""
+# Columns of a run in listings; the rest only in get_run
+RUN_COLUMNS = "id, project, project_hash, created, baseline_time, best_time"
+# Metrics of an iteration_done event kept per candidate
+# Settings a recorded result is only valid under (the workload, the build's
+# inputs, the gates and objectives it passed); search knobs and output options don't count
+REUSE_OPTIONS = ("run_args", "work_dir", "include_paths", "compile_commands", "output_files", "float_tolerance",
+                 "allow_fast_math", "parallelize", "sanitize", "microbench", "bench_inputs", "objectives",
+                 "workloads")
+CANDIDATE_METRICS = ("counters", "peak_rss_kb", "functions", "allocations", "binary_size", "workloads")
+
+_lock = threading.Lock()
+
+
+@contextlib.contextmanager
+def _db():
+    """A connection to the history database, committed and closed after use."""
+    with _lock:
+        os.makedirs(os.path.dirname(HISTORY_DB), exist_ok=True)
+        conn = sqlite3.connect(HISTORY_DB, timeout=30)
+        try:
+            conn.row_factory = sqlite3.Row
+            conn.execute("PRAGMA foreign_keys = ON")
+            conn.executescript(SCHEMA)
+            with conn:
+                yield conn
+        finally:
+            conn.close()
+
+
+def _run_dict(row, detail=False):
+    run = {k: row[k] for k in RUN_COLUMNS.split(", ")}
+    run["speedup"] = run["baseline_time"] / run["best_time"] \
+        if run["baseline_time"] and run["best_time"] else None
+    if detail:
+        for column in ("options", "build_flags", "summary", "diffs"):
+            run[column] = json.loads(row[column]) if row[column] else None
+    return run
+
+
+def project_hash(project_root):
+    """sha256 of every file of the project (relative path and contents), skipping build and VCS directories."""
+    h = hashlib.sha256()
+    for root, dirs, files in os.walk(project_root):
+        dirs[:] = sorted(d for d in dirs if not d.startswith('.') and d not in SKIP_DIRS
+                         and not d.startswith(SKIP_DIR_PREFIXES))
+        for name in sorted(f for f in files if not f.startswith('.')):
+            path = os.path.join(root, name)
+            h.update(os.path.relpath(path, project_root).encode() + b"\0")
+            with open(path, "rb") as f:
+                for chunk in iter(lambda: f.read(1 << 20), b""):
+                    h.update(chunk)
+            h.update(b"\0")
+    return h.hexdigest()
+
+
+def accepted_diffs(original_json, best_json):
+    """{"functions/<name>" or "classes/<Name>": unified diff} of the items best_json changed."""
+    before, after = flat_state(original_json), flat_state(best_json)
+    return {item: make_diff(before.get(item, ""), code, item)
+            for item, code in sorted(after.items()) if code != before.get(item)}
+
+
+def record_run(project, source_hash, options, results, summary, events):
+    """Store a finished run (summary as built by main.result_summary, events its progress events); its id."""
+    feedback = results.get("ai_feedback", {})
+    best_json = feedback.get("best_json")
+    candidates = [(e["iteration"], int(bool(e["accepted"])), e.get("candidate_time"), e.get("best_time"),
+                   json.dumps({k: e.get(k) for k in CANDIDATE_METRICS if e.get(k) is not None}))
+                  for e in events if e.get("stage") == "iteration_done"]
+    best_time = summary.get("best_time")
+    with _db() as conn:
+        cursor = conn.execute(
+            "INSERT INTO runs (project, project_hash, created, options, build_flags, baseline_time, best_time, "
+            "summary, diffs, best_json) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+            (project, source_hash, time.time(), json.dumps(options, sort_keys=True, default=str),
+             json.dumps(summary.get("build_flags")), summary.get("baseline_time"), best_time,
+             json.dumps(summary, default=str),
+             json.dumps(accepted_diffs(results, best_json)) if best_json else None,
+             json.dumps(best_json, default=str) if best_json else None))
+        run_id = cursor.lastrowid
+        conn.executemany("INSERT INTO candidates VALUES (?, ?, ?, ?, ?, ?)",
+                         [(run_id,) + c for c in candidates])
+    return run_id
+
+
+def list_runs(project=None, source_hash=None, limit=50):
+    """Recorded runs, newest first, optionally of one project or one exact set of sources."""
+    where, args = [], []
+    if project:
+        where.append("project = ?")
+        args.append(project)
+    if source_hash:
+        where.append("project_hash = ?")
+        args.append(source_hash)
+    query = f"SELECT {RUN_COLUMNS} FROM runs" + (f" WHERE {' AND '.join(where)}" if where else "") + \
+        " ORDER BY id DESC LIMIT ?"
+    with _db() as conn:
+        rows = conn.execute(query, args + [max(1, min(limit, MAX_LISTED_RUNS))]).fetchall()
+    return [_run_dict(r) for r in rows]
+
+
+def get_run(run_id):
+    """A run with its options, summary, accepted diffs and candidates, or None."""
+    with _db() as conn:
+        row = conn.execute("SELECT * FROM runs WHERE id = ?", (run_id,)).fetchone()
+        if row is None:
+            return None
+        candidates = conn.execute("SELECT iteration, accepted, time, best_time, metrics FROM candidates "
+                                  "WHERE run_id = ? ORDER BY rowid", (run_id,)).fetchall()
+    run = _run_dict(row, detail=True)
+    run["candidates"] = [{"iteration": c["iteration"], "accepted": bool(c["accepted"]), "time": c["time"],
+                          "best_time": c["best_time"], **json.loads(c["metrics"] or "{}")} for c in candidates]
+    return run
+
+
+def previous_run_id(run_id):
+    """The run of the same project before run_id, or None."""
+    with _db() as conn:
+        row = conn.execute("SELECT p.id FROM runs r JOIN runs p ON p.project = r.project AND p.id < r.id "
+                           "WHERE r.id = ? ORDER BY p.id DESC LIMIT 1", (run_id,)).fetchone()
+    return row["id"] if row else None
+
+
+def _change(before, after):
+    """Relative change of a metric (0.1 = 10% more), or None."""
+    return after / before - 1 if before and after is not None else None
+
+
+def _regressed(before, after):
+    """Whether after is significantly slower than before: their confidence intervals don't overlap."""
+    return bool(before and after and after["ci"][0] > before["ci"][1])
+
+
+def compare_runs(run, previous):
+    """What changed between two runs of a project: timings, metrics and which items the optimizations touch."""
+    summary, old = run["summary"] or {}, previous["summary"] or {}
+    metrics = {}
+    for side in ("baseline", "best"):
+        now, before = summary.get(side) or {}, old.get(side) or {}
+        metrics[side] = {k: _change(before.get(k), now.get(k))
+                         for k in ("median", "cpu_median", "peak_rss_kb", "allocations", "binary_size")
+                         if before.get(k) is not None and now.get(k) is not None}
+    diffs, old_diffs = run["diffs"] or {}, previous["diffs"] or {}
+    return {
+        "run": {k: run[k] for k in RUN_COLUMNS.split(", ") + ["speedup"]},
+        "previous": {k: previous[k] for k in RUN_COLUMNS.split(", ") + ["speedup"]},
+        "same_sources": run["project_hash"] == previous["project_hash"],
+        # The shipped code (baseline) or the optimized one got significantly slower
+        "baseline_regression": _regressed(old.get("baseline"), summary.get("baseline")),
+        "best_regression": _regressed(old.get("best"), summary.get("best")),
+        "metrics": metrics,
+        "optimizations": {
+            "new": sorted(set(diffs) - set(old_diffs)),
+            "lost": sorted(set(old_diffs) - set(diffs)),
+            "changed": sorted(i for i in set(diffs) & set(old_diffs) if diffs[i] != old_diffs[i]),
+        },
+    }
+
+
+def reuse_options(settings):
+    """The REUSE_OPTIONS of a run's settings, as they read back from the database."""
+    return json.loads(json.dumps({k: settings.get(k) for k in REUSE_OPTIONS}, sort_keys=True, default=str))
+
+
+def known_best(source_hash, settings):
+    """{"run_id", "best_json", "best_time"} of the latest run of these exact sources that found a speedup
+    with the same REUSE_OPTIONS as settings, or None."""
+    wanted = reuse_options(settings)
+    with _db() as conn:
+        rows = conn.execute("SELECT id, options, best_json, best_time FROM runs WHERE project_hash = ? "
+                            "AND best_json IS NOT NULL AND best_time < baseline_time ORDER BY id DESC LIMIT ?",
+                            (source_hash, MAX_LISTED_RUNS)).fetchall()
+    for row in rows:
+        if reuse_options(json.loads(row["options"])) == wanted:
+            return {"run_id": row["id"], "best_json": json.loads(row["best_json"]), "best_time": row["best_time"]}
+    return None
@@ -0,0 +1,172 @@
+import ctypes
+import itertools
+import os
+import resource
+import threading
+
+# Resource control for the programs we run: untrusted candidates must not
+# exhaust the host or disturb concurrent measurements. Every run gets
+# rlimits; with a delegated cgroup v2 directory (OPTIMIZER_CGROUP, owned by
+# the server user, with no processes of its own) every run also gets its
+# own cgroup with a memory cap (no swap), a pid cap against fork bombs, its
+# benchmark core as cpuset and optionally a CPU quota.
+CGROUP_ROOT = os.getenv("OPTIMIZER_CGROUP", "")
+RUN_MEMORY_MB = int(os.getenv("OPTIMIZER_RUN_MEMORY_MB", "4096"))
+# Counts threads too, so multithreaded programs need headroom
+RUN_MAX_PIDS = int(os.getenv("OPTIMIZER_RUN_MAX_PIDS", "512"))
+RUN_MAX_FILE_MB = int(os.getenv("OPTIMIZER_RUN_MAX_FILE_MB", "1024"))
+# CPU quota in cores per run (0 = only the pinning limits it)
+RUN_CPU_QUOTA = float(os.getenv("OPTIMIZER_RUN_CPU_QUOTA", "0"))
+# Run programs without network access (unprivileged user + network namespace)
+RUN_NO_NETWORK = os.getenv("OPTIMIZER_RUN_NO_NETWORK", "0") == "1"
+# Turn off turbo/boost while the server runs, so clocks don't depend on load
+DISABLE_BOOST = os.getenv("OPTIMIZER_DISABLE_BOOST", "0") == "1"
+
+CLONE_NEWUSER = 0x10000000
+CLONE_NEWNET = 0x40000000
+BOOST_SWITCHES = [
+    ("/sys/devices/system/cpu/intel_pstate/no_turbo", "1"),
+    ("/sys/devices/system/cpu/cpufreq/boost", "0"),
+]
+
+_counter = itertools.count()
+_setup = {}
+_setup_lock = threading.Lock()
+
+
+def _write(path, value):
+    with open(path, "w") as f:
+        f.write(value)
+
+
+def cgroups_available():
+    """Enable the controllers under CGROUP_ROOT once; False if cgroups can't be used."""
+    with _setup_lock:
+        if "cgroups" not in _setup:
+            ok = False
+            if CGROUP_ROOT:
+                try:
+                    _write(os.path.join(CGROUP_ROOT, "cgroup.subtree_control"), "+memory +pids +cpu +cpuset")
+                    ok = True
+                except OSError as e:
+                    print(f"⚠️  Cannot use cgroup {CGROUP_ROOT} ({e}), runs are limited by rlimits only")
+            _setup["cgroups"] = ok
+        return _setup["cgroups"]
+
+
+def disable_boost():
+    """Switch off CPU frequency boost if allowed (once per process); the previous settings are returned."""
+    with _setup_lock:
+        if "boost" in _setup:
+            return _setup["boost"]
+        previous = {}
+        for path, value in BOOST_SWITCHES:
+            try:
+                with open(path) as f:
+                    old = f.read().strip()
+                _write(path, value)
+                previous[path] = old
+                print(f"🧊 Frequency boost disabled ({path})")
+            except OSError:
+                continue
+        _setup["boost"] = previous
+        return previous
+
+
+def restore_boost():
+    """Undo disable_boost."""
+    for path, value in (_setup.get("boost") or {}).items():
+        try:
+            _write(path, value)
+        except OSError:
+            pass
+
+
+class RunCgroup:
+    """A cgroup for one program run; processes started with child_setup(cgroup=...) join it."""
+
+    def __init__(self, cpus=None):
+        self.path = os.path.join(CGROUP_ROOT, f"run-{os.getpid()}-{next(_counter)}")
+        os.mkdir(self.path)
+        try:
+            _write(os.path.join(self.path, "memory.max"), str(RUN_MEMORY_MB << 20))
+            _write(os.path.join(self.path, "pids.max"), str(RUN_MAX_PIDS))
+            for name, value in (("memory.swap.max", "0"),
+                                ("cpuset.cpus", ",".join(map(str, sorted(cpus))) if cpus else None),
+                                ("cpu.max", f"{int(RUN_CPU_QUOTA * 100000)} 100000" if RUN_CPU_QUOTA else None)):
+                if value is not None and os.path.exists(os.path.join(self.path, name)):
+                    _write(os.path.join(self.path, name), value)
+        except OSError:
+            self.close()
+            raise
+
+    def join(self):
+        """Move the calling process into the cgroup (runs in the child before exec)."""
+        _write(os.path.join(self.path, "cgroup.procs"), str(os.getpid()))
+
+    def events(self):
+        """memory.events counters (oom_kill, max, ...)."""
+        try:
+            with open(os.path.join(self.path, "memory.events")) as f:
+                return {k: int(v) for k, v in (line.split() for line in f)}
+        except OSError:
+            return {}
+
+    def kill(self):
+        """Kill every process in the cgroup, including ones that left the session."""
+        try:
+            _write(os.path.join(self.path, "cgroup.kill"), "1")
+        except OSError:
+            try:
+                with open(os.path.join(self.path, "cgroup.procs")) as f:
+                    for pid in f.read().split():
+                        os.kill(int(pid), 9)
+            except OSError:
+                pass
+
+    def close(self):
+        try:
+            os.rmdir(self.path)
+        except OSError:
+            self.kill()
+            try:
+                os.rmdir(self.path)
+            except OSError:
+                pass
+
+
+def _unshare_network():
+    # Fails where unprivileged user namespaces are disabled; the run keeps its network then
+    ctypes.CDLL(None, use_errno=True).unshare(CLONE_NEWUSER | CLONE_NEWNET)
+
+
+def child_setup(cpus=None, cgroup=None, timeout=None, limit_address_space=True, background=False):
+    """preexec_fn for a run: cgroup, core pinning, rlimits and optionally no network.
+
+    Sanitizer builds reserve terabytes of shadow address space, so their
+    runs pass limit_address_space=False (a cgroup still caps their memory).
+    A background run gets the lowest nice level.
+    """
+    def setup():
+        if cgroup:
+            cgroup.join()
+        if cpus and hasattr(os, "sched_setaffinity"):
+            os.sched_setaffinity(0, cpus)
+        resource.setrlimit(resource.RLIMIT_CORE, (0, 0))
+        size = RUN_MAX_FILE_MB << 20
+        resource.setrlimit(resource.RLIMIT_FSIZE, (size, size))
+        if not cgroup and limit_address_space:
+            # Without a cgroup, address space is the closest memory cap there is
+            memory = RUN_MEMORY_MB << 20
+            resource.setrlimit(resource.RLIMIT_AS, (memory, memory))
+        if timeout:
+            # CPU-time backstop in case the wall-clock kill is missed
+            cores = len(cpus) if cpus else len(os.sched_getaffinity(0)) if hasattr(os, "sched_getaffinity") \
+                else os.cpu_count() or 1
+            seconds = int(timeout * cores) + 1
+            resource.setrlimit(resource.RLIMIT_CPU, (seconds, seconds))
+        if background:
+            os.nice(19)
+        if RUN_NO_NETWORK:
+            _unshare_network()
+    return setup
@@ -0,0 +1,111 @@
+import os
+import shutil
+import tempfile
+import threading
+import time
+import traceback
+import uuid
+from concurrent.futures import ThreadPoolExecutor
+from fastapi import HTTPException
+
+# Optimization jobs run on this pool, off the FastAPI event loop. Each job is
+# mostly subprocesses and network calls, so threads are enough.
+JOB_WORKERS = int(os.getenv("OPTIMIZER_JOB_WORKERS", "2"))
+# Finished jobs (and their upload/output directories) are kept this long in seconds.
+JOB_TTL = int(os.getenv("OPTIMIZER_JOB_TTL", "3600"))
+
+_executor = ThreadPoolExecutor(max_workers=JOB_WORKERS)
+_jobs = {}
+_lock = threading.Lock()
+
+
+class Job:
+    """State of one submitted optimization: status, progress events and result."""
+
+    def __init__(self):
+        self.id = uuid.uuid4().hex
+        self.dir = tempfile.mkdtemp(prefix=f"cppopt_{self.id[:8]}_")
+        self.status = "queued"
+        self.events = []
+        self.result = None
+        self.error = None
+        self.created = time.time()
+        self.finished = None
+
+    def emit(self, event):
+        """Record a progress event (used as the `progress` callback of the pipeline)."""
+        with _lock:
+            self.events.append({**event, "time": time.time()})
+
+    def snapshot(self, since=0):
+        """JSON-safe view of the job, with events from index `since` onwards."""
+        with _lock:
+            return {
+                "job_id": self.id,
+                "status": self.status,
+                "error": self.error,
+                "events": self.events[since:],
+                "next_event": len(self.events),
+                "summary": self.result.get("summary") if self.result else None,
+            }
+
+
+def create_job():
+    """Register a new job and give it a private directory for uploads and output."""
+    cleanup_expired()
+    job = Job()
+    with _lock:
+        _jobs[job.id] = job
+    return job
+
+
+def get_job(job_id):
+    """Look up a job or raise 404."""
+    with _lock:
+        job = _jobs.get(job_id)
+    if job is None:
+        raise HTTPException(status_code=404, detail=f"Unknown job: {job_id}")
+    return job
+
+
+def submit(job, fn):
+    """Run fn(job) on the worker pool; its return value becomes job.result."""
+    def run():
+        job.status = "running"
+        job.emit({"stage": "started"})
+        status = "failed"
+        try:
+            job.result = fn(job)
+            status = "done"
+        except HTTPException as e:
+            job.error = e.detail
+        except Exception as e:
+            print("ERROR during job:\n", traceback.format_exc())
+            job.error = str(e)
+        finally:
+            # Status and final event change together so streams never miss the end
+            with _lock:
+                job.status = status
+                job.finished = time.time()
+                job.events.append({"stage": status, "error": job.error, "time": job.finished})
+
+    _executor.submit(run)
+    return job
+
+
+def discard(job):
+    """Drop a job that never got submitted (e.g. its upload was rejected)."""
+    with _lock:
+        _jobs.pop(job.id, None)
+    shutil.rmtree(job.dir, ignore_errors=True)
+
+
+def cleanup_expired():
+    """Forget finished jobs older than JOB_TTL and delete their directories."""
+    now = time.time()
+    with _lock:
+        expired = [j for j in _jobs.values() if j.finished and now - j.finished > JOB_TTL]
+        for job in expired:
+            del _jobs[job.id]
+    for job in expired:
+        shutil.rmtree(job.dir, ignore_errors=True)
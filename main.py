@@ -1,11 +1,29 @@
+import asyncio
+import atexit
+import json
 import os
+import shutil
+import sqlite3
 import tempfile
 import zipfile
 from pathlib import Path
-from fastapi import FastAPI, UploadFile, File, Form, HTTPException
-from fastapi.responses import FileResponse
+from fastapi import FastAPI, UploadFile, File, Form, HTTPException, Depends
+from fastapi.responses import FileResponse, StreamingResponse
+from starlette.background import BackgroundTask
+from starlette.concurrency import run_in_threadpool
 from analyze import analyze_cpp_project
-from utils import json_to_cpp
+from utils import json_to_cpp, compile_flags
+from writeback import write_zip, write_patch
+from compdb import find_compile_commands, generate_compile_commands, load_compile_commands, shared_flags
+from antipatterns import most_severe
+from objectives import parse_objectives, time_only, format_objectives
+from workloads import parse_workloads, DEFAULT_AGGREGATE
+from search import DEFAULT_BEAM_WIDTH, DEFAULT_PATIENCE, ABLATION
+from history import HISTORY_ENABLED, project_hash, known_best, record_run, list_runs, get_run, previous_run_id, \
+    compare_runs
+from isolation import DISABLE_BOOST, disable_boost, restore_boost
+from uploads import stream_upload, extract_archive, remove_quietly, SKIP_DIRS
+import jobs
 
 app = FastAPI(title="C++ Optimizer API", description="Optimize C++ projects using AI")
 
@@ -20,11 +38,106 @@ app.add_middleware(
     allow_headers=["*"],
 )
 
-def process_project(project_root: Path, filepaths: list, include_paths: list, run_args: list, work_dir: str = None, skip_execution: bool = False):
-    """Common processing logic for both upload methods."""
-    if not filepaths:
-        raise HTTPException(status_code=400, detail="No C++ source files found in upload")
-    
+# Frequency boost stays off for the server's lifetime (see isolation.py)
+if DISABLE_BOOST:
+    disable_boost()
+    atexit.register(restore_boost)
+
+# Static findings (see antipatterns.py) included in a result summary
+MAX_SUMMARY_FINDINGS = 50
+# The synchronous endpoints only fit a few summary fields in their response
+# header (servers and proxies cap headers at ~8KB); the full summary is
+# /runs/{run_id}, or the job status of the /jobs endpoints
+HEADER_SUMMARY_FIELDS = ("baseline_time", "best_time", "build_flags", "rewrites", "changed_files")
+MAX_HEADER_SUMMARY_BYTES = 2048
+
+# Download name and media type of each output format
+OUTPUT_FORMATS = {
+    "combined": ("project_combined.cpp", "text/x-c"),
+    "zip": ("project_optimized.zip", "application/zip"),
+    "patch": ("optimized.patch", "text/x-diff"),
+}
+
+def optimization_options(
+    parallel_candidates: int = Form(1, description="Candidates requested and benchmarked concurrently per iteration"),
+    output_files: str = Form("", description="Comma-separated files the program writes (relative to the working dir), checked against the baseline"),
+    float_tolerance: float = Form(0.0, description="Relative/absolute tolerance for numbers when comparing output (0 = exact)"),
+    output_format: str = Form("combined", description="combined (one project_combined.cpp), zip (the project with changes written back into its own files) or patch (unified diff of those changes)"),
+    tune_flags: bool = Form(False, description="Search extra build flags (-march=native, -flto, ...) before the AI loop"),
+    rewrites: bool = Form(True, description="Try mechanical rewrites (std::endl -> '\\n', const& container parameters, reserve, emplace_back, unsynced iostreams) before the AI loop, each kept only if it helps"),
+    allow_fast_math: bool = Form(False, description="Let flag tuning try -ffast-math (output must still match within float_tolerance)"),
+    pgo: bool = Form(False, description="Rebuild the result with profile-guided optimization (and BOLT when available) on the program_args workload; the output becomes a zip with the profile and build recipe"),
+    asm_diff: bool = Form(False, description="Add asm_diff.txt: disassembly of the hot functions, baseline vs best, with instruction counts, SIMD width and sampled hot loops; the output becomes a zip"),
+    beam_width: int = Form(DEFAULT_BEAM_WIDTH, description="Lineages the AI loop keeps (1 = greedy); with more, candidates are spread over them and independent per-function edits are combined"),
+    patience: int = Form(DEFAULT_PATIENCE, description="Stop the AI loop after this many iterations without a new best (0 = run every iteration)"),
+    ablation: bool = Form(ABLATION, description="Time a candidate that changed several functions one function at a time, and finish with a composite of the best version of each function"),
+    sanitize: bool = Form(True, description="Build every AI candidate with ASan+UBSan (and TSan if it uses threads) while it is timed; any sanitizer report rejects it"),
+    parallelize: bool = Form(False, description="Parallelization mode: point the model at loops with independent iterations for OpenMP, std::execution or a thread pool; builds get -fopenmp (and TBB), candidates are timed at 1 and N threads (unless workloads are given) and race-checked with ThreadSanitizer"),
+    microbench: bool = Form(False, description="Time individual functions in a generated benchmark harness instead of the whole program (works without main or for interactive programs)"),
+    bench_inputs: str = Form("", description='JSON object of C++ argument lists per function for microbench mode, e.g. {"solve": "std::vector<int>(1000, 7), 3"} or a list of them'),
+    objectives: str = Form("time", description="What to optimize: time, rss, allocations, size, comma-separated with optional weights, e.g. time:1,allocations:0.5"),
+    workloads: str = Form("", description='JSON workload matrix benchmarked instead of program_args: a list of {"args", "threads", "env", "name"} or {"args": [["small.txt"], ["large.txt"]], "threads": [1, 4]} (threads sets OMP_NUM_THREADS)'),
+    workload_aggregate: str = Form(DEFAULT_AGGREGATE, description="How workload runtimes combine into the score: geomean, total or worst (geomean, but a candidate must be faster on every workload)"),
+    project: str = Form("", description="Name the run is tracked under in the results history, e.g. the service name (default: the uploaded ZIP's or files' names)"),
+    reuse: bool = Form(True, description="If an earlier run optimized exactly these sources, check its result first and return it without calling the model when it still holds"),
+    compile_commands: str = Form("", description="Path of compile_commands.json in the project (default: found in the upload or exported by CMake; otherwise every directory is an include path)")
+):
+    """Pipeline settings shared by every optimize endpoint (passed on to analyze_cpp_project)."""
+    if output_format not in OUTPUT_FORMATS:
+        raise HTTPException(status_code=400, detail=f"output_format must be one of: {', '.join(OUTPUT_FORMATS)}")
+    try:
+        inputs = json.loads(bench_inputs) if bench_inputs.strip() else {}
+    except ValueError:
+        raise HTTPException(status_code=400, detail="bench_inputs must be a JSON object")
+    if not isinstance(inputs, dict):
+        raise HTTPException(status_code=400, detail="bench_inputs must be a JSON object")
+    try:
+        weights = parse_objectives(objectives)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"objectives: {e}")
+    if beam_width < 1 or patience < 0:
+        raise HTTPException(status_code=400, detail="beam_width must be at least 1 and patience at least 0")
+    try:
+        matrix = parse_workloads(workloads, workload_aggregate)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"workloads: {e}")
+    return {
+        "output_format": output_format,
+        "parallel_candidates": parallel_candidates,
+        "output_files": [p.strip() for p in output_files.split(",") if p.strip()],
+        "float_tolerance": float_tolerance,
+        "tune_flags": tune_flags,
+        "rewrites": rewrites,
+        "allow_fast_math": allow_fast_math,
+        "pgo": pgo,
+        "asm_diff": asm_diff,
+        "parallelize": parallelize,
+        "sanitize": sanitize,
+        "beam_width": beam_width,
+        "patience": patience,
+        "ablation": ablation,
+        "microbench": microbench,
+        "bench_inputs": inputs,
+        "objectives": weights,
+        "workloads": matrix,
+        "compile_commands": compile_commands.strip(),
+        "project": project.strip(),
+        "reuse": reuse,
+    }
+
+
+def project_name(name, uploads):
+    """Name of a run in the history: the project field, else the names of the uploaded ZIP or files."""
+    return name or ",".join(sorted(Path(u.filename).stem for u in uploads))
+
+
+def project_clang_args(project_root: Path, filepaths: list, include_paths: list, compile_commands: str, build_dir: str):
+    """(clang_args for builds, {source realpath: clang_args} for parsing each TU).
+
+    Flags come from the project's compile_commands.json (given, found in the
+    upload or exported by CMake into build_dir); without one, the project
+    root and every subdirectory become include paths.
+    """
     # Build clang arguments
     clang_args = [
         "-std=c++17",
@@ -35,13 +148,39 @@ def process_project(project_root: Path, filepaths: list, include_paths: list, ru
     for inc in include_paths:
         clang_args.append(f"-I{inc}")
     
+    if compile_commands:
+        # The path comes from the user: it must stay inside the upload
+        root = os.path.realpath(project_root)
+        compdb_path = os.path.realpath(os.path.join(root, compile_commands))
+        if os.path.commonpath([root, compdb_path]) != root:
+            raise HTTPException(status_code=400, detail="compile_commands must be a path inside the project")
+        if not os.path.isfile(compdb_path):
+            raise HTTPException(status_code=400, detail=f"compile_commands '{compile_commands}' not found in project")
+    else:
+        compdb_path = find_compile_commands(str(project_root)) or \
+            generate_compile_commands(str(project_root), os.path.join(build_dir, "cmake"))
+    per_tu = load_compile_commands(compdb_path, str(project_root), filepaths) if compdb_path else {}
+    if per_tu:
+        tu_args = {fp: clang_args + flags for fp, flags in per_tu.items()}
+        return clang_args + shared_flags(per_tu), tu_args
+    
     # Add project root and all subdirectories as include paths
     clang_args.append(f"-I{project_root}")
     for root, dirs, _ in os.walk(project_root):
-        dirs[:] = [d for d in dirs if not d.startswith('.') and d not in ['__pycache__', '__MACOSX']]
+        dirs[:] = [d for d in dirs if not d.startswith('.') and d not in SKIP_DIRS]
         for dir_name in dirs:
             dir_path = os.path.join(root, dir_name)
             clang_args.append(f"-I{dir_path}")
+    return clang_args, {}
+
+
+def process_project(project_root: Path, filepaths: list, include_paths: list, run_args: list, work_dir: str = None, skip_execution: bool = False, progress=None, output_format: str = "combined", **options):
+    """Common processing logic for both upload methods."""
+    if not filepaths:
+        raise HTTPException(status_code=400, detail="No C++ source files found in upload")
+    compile_commands = options.pop("compile_commands", "")
+    project = options.pop("project", "") or "project"
+    reuse = options.pop("reuse", True)
     
     print(f"\n{'='*60}")
     print(f"🔧 Compiling {len(filepaths)} C++ file(s)")
@@ -52,6 +191,35 @@ def process_project(project_root: Path, filepaths: list, include_paths: list, ru
         print(f"⚙️  Runtime args: {', '.join(run_args)}")
     if skip_execution:
         print(f"⏭️  Execution: SKIPPED (compile-only mode)")
+    if options.get("parallel_candidates", 1) > 1:
+        print(f"🔀 Candidates per iteration: {options['parallel_candidates']}")
+    if options.get("tune_flags"):
+        print(f"🎛️  Flag tuning: on{' (fast-math allowed)' if options.get('allow_fast_math') else ''}")
+    if not options.get("rewrites", True):
+        print("🪄  Mechanical rewrites: off")
+    if options.get("pgo"):
+        print("📈 PGO: on")
+    if options.get("asm_diff"):
+        print("🔍 Assembly diff: on")
+    if options.get("parallelize"):
+        print("🧵 Parallelization mode: on")
+    if options.get("beam_width", 1) > 1:
+        print(f"🌿 Beam search: width {options['beam_width']}")
+    if not options.get("ablation", True):
+        print("🔬 Per-function ablation: off")
+    if not options.get("sanitize", True):
+        print("🧪 Sanitizer checks: off")
+    if options.get("objectives") and not time_only(options["objectives"]):
+        print(f"🎯 Objectives: {format_objectives(options['objectives'])}")
+    if options.get("workloads"):
+        matrix = options["workloads"]
+        print(f"📊 Workloads ({matrix['aggregate']}): {', '.join(r['name'] for r in matrix['runs'])}")
+    if options.get("microbench"):
+        print("🔬 Microbenchmark mode: timing functions instead of the whole program")
+    if output_format != "combined":
+        print(f"📦 Output: {output_format} (changes written back into the original files)")
+    if options.get("output_files"):
+        print(f"📝 Checked output files: {', '.join(options['output_files'])}")
     print(f"{'='*60}\n")
     
     # Determine execution directory
@@ -62,20 +230,336 @@ def process_project(project_root: Path, filepaths: list, include_paths: list, ru
             detail=f"Working directory '{work_dir}' not found in project"
         )
     
-    # Change to execution directory
-    original_dir = os.getcwd()
-    os.chdir(execution_dir)
-    
-    try:
+    if skip_execution:
+        options["workloads"] = None
+
+    # Hashed before anything runs: the program may write into the project
+    source_hash = project_hash(str(project_root)) if HISTORY_ENABLED else None
+    settings = {**options, "run_args": run_args, "work_dir": work_dir, "include_paths": include_paths,
+                "skip_execution": skip_execution, "output_format": output_format, "compile_commands": compile_commands}
+    known = None
+    if source_hash and reuse and not skip_execution:
+        try:
+            known = known_best(source_hash, settings)
+        except (sqlite3.Error, OSError) as e:
+            print(f"⚠️  Results history unavailable: {e}")
+    if known:
+        print(f"♻️  Run {known['run_id']} optimized these exact sources ({known['best_time']:.6f}s)")
+
+    events = []
+
+    def track(event):
+        events.append(event)
+        if progress:
+            progress(event)
+
+    # Each job gets its own build directory and runs from execution_dir via
+    # cwd=, so concurrent jobs in one server process never share state.
+    with tempfile.TemporaryDirectory(prefix="cppopt_job_") as build_root:
+        clang_args, tu_args = project_clang_args(project_root, filepaths, include_paths, compile_commands, build_root)
         results = analyze_cpp_project(
             filepaths,
             with_ai=True,
             clang_args=clang_args,
-            run_args=run_args if not skip_execution else None
+            tu_args=tu_args,
+            run_args=run_args if not skip_execution else None,
+            work_dir=str(execution_dir),
+            build_root=build_root,
+            progress=track,
+            # zip/patch output keeps the project's files, so candidates are built that way too
+            project_root=str(project_root) if output_format != "combined" else None,
+            known_best=known["best_json"] if known else None,
+            **options
         )
-        return results
+    if source_hash:
+        results["history"] = record_history(project, source_hash, settings, results, events, known)
+    return results
+
+
+def record_history(project, source_hash, settings, results, events, known=None):
+    """Store a finished run in the results history and compare it with the project's previous run.
+
+    Returns what the summary reports about it (run ids, regressions), or None
+    if the database is unavailable.
+    """
+    reused = results.get("ai_feedback", {}).get("reused")
+    try:
+        run_id = record_run(project, source_hash, settings, results, result_summary(results), events)
+        previous = previous_run_id(run_id)
+        comparison = compare_runs(get_run(run_id), get_run(previous)) if previous else None
+    except (sqlite3.Error, OSError) as e:
+        print(f"⚠️  Results history unavailable: {e}")
+        return None
+    print(f"🗄️  Recorded as run {run_id} of '{project}'")
+    history = {"run_id": run_id, "project": project, "previous_run_id": previous,
+               "reused_run": known["run_id"] if known and reused else None}
+    if comparison:
+        change = comparison["metrics"]["baseline"].get("median")
+        history.update({
+            "baseline_change": change,
+            "baseline_regression": comparison["baseline_regression"],
+            "best_regression": comparison["best_regression"],
+        })
+        if comparison["baseline_regression"]:
+            print(f"📉 Baseline regressed {change:+.1%} since run {previous}")
+        elif change is not None:
+            print(f"📊 Baseline {change:+.1%} vs run {previous}")
+    return history
+
+
+def run_analysis(*args, **kwargs):
+    """process_project with unexpected errors turned into HTTP 500s."""
+    try:
+        return process_project(*args, **kwargs)
+    except HTTPException:
+        raise
+    except Exception as e:
+        import traceback
+        print("ERROR during analysis:\n", traceback.format_exc())
+        raise HTTPException(status_code=500, detail=f"Analysis failed: {str(e)}")
+
+
+def write_optimized_file(results, out_dir, output_format="combined"):
+    """Write the optimized project into out_dir in the requested format.
+
+    Returns {"file", "filename", "media_type", "changed_files"}; changed_files
+    is None for the combined format.
+    """
+    if "ai_feedback" not in results:
+        raise HTTPException(status_code=500, detail="AI optimization failed")
+
+    final_json = results["ai_feedback"]["best_json"]
+    layout = results["ai_feedback"].get("layout")
+    filename, media_type = OUTPUT_FORMATS[output_format]
+    path = os.path.join(out_dir, filename)
+    changed_files = None
+
+    # results itself is the original code state the locations refer to
+    if output_format == "zip":
+        changed_files = write_zip(layout, results, final_json, path)
+    elif output_format == "patch":
+        changed_files = write_patch(layout, results, final_json, path)
+    else:
+        json_to_cpp(final_json, filename=path)
+        build_flags = results["ai_feedback"].get("build_flags")
+        with open(path, "a") as f:
+            f.write("\n\n// Optimized by Aadesh's C++ AI Assistant")
+            if build_flags:
+                f.write(f"\n// Build with: clang++ {' '.join(compile_flags(build_flags))}")
+
+    pgo = results["ai_feedback"].get("pgo")
+    asm = results["ai_feedback"].get("asm")
+    if pgo or asm:
+        path, filename, media_type = bundle_artifacts(path, output_format, pgo, asm, out_dir)
+
+    print(f"\n Optimization complete! Generated: {path}\n")
+    if changed_files is not None:
+        print(f"📝 Changed files: {', '.join(changed_files) or 'none'}")
+    return {"file": path, "filename": filename, "media_type": media_type, "changed_files": changed_files}
+
+
+def bundle_artifacts(path, output_format, pgo, asm, out_dir):
+    """Add the PGO profile(s) and build recipe under pgo/ and the assembly diff next to the optimized output.
+
+    A zip output gets them added; other formats are wrapped in a new zip.
+    Returns the (path, filename, media_type) to send.
+    """
+    if output_format == "zip":
+        bundle, filename = path, OUTPUT_FORMATS["zip"][0]
+    else:
+        filename = "optimized_with_pgo.zip" if pgo else "optimized_with_asm.zip"
+        bundle = os.path.join(out_dir, filename)
+    with zipfile.ZipFile(bundle, "a" if output_format == "zip" else "w", zipfile.ZIP_DEFLATED) as zf:
+        if output_format != "zip":
+            zf.write(path, os.path.basename(path))
+        if pgo:
+            for name, data in pgo["artifacts"].items():
+                zf.writestr(f"pgo/{name}", data)
+            zf.writestr("pgo/build.sh", "#!/bin/sh\nset -e\n" + "\n".join(pgo["recipe"]) + "\n")
+        if asm:
+            zf.writestr("asm_diff.txt", asm["report"])
+    return bundle, filename, "application/zip"
+
+
+def result_summary(results):
+    """Timings, peak RSS, allocations, binary size and hardware counters of baseline and best candidate."""
+    feedback = results.get("ai_feedback", {})
+
+    def metrics(stats):
+        if not stats:
+            return None
+        return {
+            "median": stats["median"],
+            "ci": [stats["ci_low"], stats["ci_high"]],
+            "cpu_median": stats["cpu_median"],
+            "peak_rss_kb": stats.get("peak_rss_kb"),
+            "counters": stats.get("counters"),
+            "functions": stats.get("functions"),
+            "allocations": stats.get("allocations"),
+            "allocated_bytes": stats.get("allocated_bytes"),
+            "binary_size": stats.get("binary_size"),
+            # Scaling curve of a workload matrix (see workloads.py)
+            "workloads": [{"name": w["name"], "args": w["args"], "threads": w["threads"], "median": w["median"],
+                           "ci": [w["ci_low"], w["ci_high"]]} for w in stats["workloads"]]
+                         if stats.get("workloads") else None,
+        }
+
+    best_time = feedback.get("best_time")
+    return {
+        "baseline_time": feedback.get("baseline_time"),
+        "best_time": best_time if best_time != float("inf") else None,
+        "baseline": metrics(feedback.get("baseline_stats")),
+        "best": metrics(feedback.get("best_stats")),
+        # Extra flags the best result was built with (on top of -O3 -std=c++17)
+        "build_flags": feedback.get("build_flags", []),
+        "flag_tuning": feedback.get("flag_tuning"),
+        # Mechanical rewrites kept before the AI loop (see rewrites.py)
+        "rewrites": [t["rewrite"] for t in feedback.get("rewrites") or [] if t["accepted"]],
+        "pgo": {"stages": feedback["pgo"]["stages"], "recipe": feedback["pgo"]["recipe"]}
+               if feedback.get("pgo") else None,
+        "objectives": feedback.get("objectives"),
+        "pareto": feedback.get("pareto"),
+        # Per hot function: instructions, vector instructions and SIMD width, baseline vs best
+        "asm": [{"symbol": f["symbol"],
+                 **{side: {k: f[side][k] for k in ("instructions", "vector_instructions", "simd_width")}
+                    if f[side] else None for side in ("baseline", "best")}}
+                for f in feedback["asm"]["functions"]] if feedback.get("asm") else None,
+        # Capped: the summary is stored with every run and returned with every job
+        "findings": most_severe(results.get("findings", []), MAX_SUMMARY_FINDINGS),
+        # Run id in the results history and how it compares with the project's last run
+        "history": results.get("history"),
+    }
+
+
+def header_summary(summary):
+    """The X-Optimizer-Summary header: headline fields of a summary and where to fetch the rest."""
+    run_id = (summary.get("history") or {}).get("run_id")
+    header = {k: summary.get(k) for k in HEADER_SUMMARY_FIELDS}
+    header.update(run_id=run_id, summary_url=f"/runs/{run_id}" if run_id else None)
+    # Long lists (a big project's changed files) are dropped first
+    for key in ("changed_files", "rewrites", "build_flags"):
+        if len(json.dumps(header)) <= MAX_HEADER_SUMMARY_BYTES:
+            break
+        header[key] = None
+        header["truncated"] = True
+    return json.dumps(header)
+
+
+def optimized_file_response(results, output_format="combined"):
+    """Write the optimized output to a per-request output dir and return a FileResponse that removes it."""
+    out_dir = tempfile.mkdtemp(prefix="cppopt_out_")
+    try:
+        written = write_optimized_file(results, out_dir, output_format)
+    except Exception:
+        shutil.rmtree(out_dir, ignore_errors=True)
+        raise
+    # Headline metrics travel in a header so the body stays the plain source file
+    summary = {**result_summary(results), "changed_files": written["changed_files"]}
+    return FileResponse(written["file"], media_type=written["media_type"], filename=written["filename"],
+                        headers={"X-Optimizer-Summary": header_summary(summary)},
+                        background=BackgroundTask(shutil.rmtree, out_dir, ignore_errors=True))
+
+
+def parse_options(program_args: str, include_dirs: str):
+    """Split the comma-separated form fields and validate include paths."""
+    include_paths = [p.strip() for p in include_dirs.split(",") if p.strip()]
+    run_args = [a.strip() for a in program_args.split(",") if a.strip()]
+
+    for path in include_paths:
+        if not os.path.exists(path):
+            raise HTTPException(status_code=400, detail=f"Include path not found: {path}")
+
+    return include_paths, run_args
+
+
+async def save_zip_upload(project_zip: UploadFile, project_root: Path):
+    """Extract an uploaded project ZIP into project_root, returning the source files to compile."""
+    if not project_zip.filename.endswith('.zip'):
+        raise HTTPException(status_code=400, detail="File must be a .zip archive")
+
+    source_exts = (".cpp", ".cc", ".c", ".cxx")
+    
+    print(f"\n📦 Uploading project to: {project_root}")
+    print(f"📦 Extracting ZIP: {project_zip.filename}")
+    
+    # Stream the upload to disk, then extract entry by entry (nothing is held in memory)
+    zip_path = project_root / ".upload.zip"
+    await stream_upload(project_zip, zip_path)
+    try:
+        await run_in_threadpool(extract_archive, zip_path, str(project_root))
     finally:
-        os.chdir(original_dir)
+        remove_quietly(zip_path)
+    
+    # Find all files
+    filepaths = []
+    all_files = []
+    
+    header_exts = (".h", ".hpp", ".hxx", ".hh", ".H")
+    skip_files = ("Makefile", "CMakeLists.txt", "README", "LICENSE")
+    
+    for root, dirs, files_in_dir in os.walk(project_root):
+        dirs[:] = [d for d in dirs if not d.startswith('.') and d not in SKIP_DIRS]
+        
+        for file in files_in_dir:
+            if file.startswith('.') or file.startswith('._') or file in skip_files:
+                continue
+                
+            file_path = Path(root) / file
+            rel_path = file_path.relative_to(project_root)
+            all_files.append(str(rel_path))
+            
+            if file.endswith(source_exts) and not file.endswith(header_exts):
+                filepaths.append(str(file_path))
+                print(f"   {rel_path} (will compile)")
+            elif file.endswith(header_exts):
+                print(f"  📋 {rel_path} (header - will be available for #include)")
+            else:
+                print(f"  📄 {rel_path}")
+    
+    if not filepaths:
+        raise HTTPException(
+            status_code=400,
+            detail=f"No C++ source files found. Files in ZIP: {', '.join(all_files)}"
+        )
+    return filepaths
+
+
+async def save_file_uploads(cpp_files: list, project_root: Path):
+    """Save individually uploaded source files into project_root, returning their paths."""
+    source_exts = (".cpp", ".cc", ".c", ".cxx")
+    filepaths = []
+    
+    print(f"\n📦 Uploading files to: {project_root}")
+    
+    for upload in cpp_files:
+        if not upload.filename.endswith(source_exts):
+            raise HTTPException(
+                status_code=400,
+                detail=f"File '{upload.filename}' must be a C++ source file (.cpp, .cc, .c, .cxx)"
+            )
+        
+        file_path = project_root / os.path.basename(upload.filename)
+        await stream_upload(upload, file_path)
+        
+        filepaths.append(str(file_path))
+        print(f"  ✅ {upload.filename}")
+    return filepaths
+
+
+def submit_optimization_job(job, project_root: Path, filepaths: list, *args, **options):
+    """Queue process_project for a job; the optimized file is written into the job directory."""
+    def run(job):
+        results = run_analysis(project_root, filepaths, *args, progress=job.emit, **options)
+        written = write_optimized_file(results, job.dir, options["output_format"])
+        return {**written, "summary": {**result_summary(results), "changed_files": written["changed_files"]}}
+
+    jobs.submit(job, run)
+    return {
+        "job_id": job.id,
+        "status_url": f"/jobs/{job.id}",
+        "events_url": f"/jobs/{job.id}/events",
+        "result_url": f"/jobs/{job.id}/result",
+    }
 
 
 @app.get("/")
@@ -87,6 +571,14 @@ async def root():
         "endpoints": {
             "/optimize-zip": "Upload entire project as ZIP (recommended for full projects)",
             "/optimize-files": "Upload individual files (good for quick testing)",
+            "/jobs/optimize-zip": "Submit a ZIP project as a background job, returns a job id",
+            "/jobs/optimize-files": "Submit individual files as a background job, returns a job id",
+            "/jobs/{job_id}": "Poll job status and progress events",
+            "/jobs/{job_id}/events": "Stream job progress as Server-Sent Events",
+            "/jobs/{job_id}/result": "Download the optimized file of a finished job",
+            "/runs": "Recorded optimization runs (filter by project or project_hash)",
+            "/runs/{run_id}": "One run: options, metrics, candidates and accepted diffs",
+            "/runs/{run_id}/compare": "Compare a run with the project's previous run (or ?to=<run_id>)",
             "/docs": "Interactive API documentation"
         }
     }
@@ -98,7 +590,8 @@ async def optimize_zip(
     program_args: str = Form("", description="Comma-separated runtime arguments (e.g., 'data/input.txt')"),
     include_dirs: str = Form("", description="Comma-separated additional include directories"),
     working_dir: str = Form("", description="Subdirectory to run program from (leave empty for root)"),
-    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode, for interactive programs)")
+    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode, for interactive programs)"),
+    options: dict = Depends(optimization_options)
 ):
     """
     **Upload entire project as ZIP** (Recommended for full projects with data files)
@@ -108,146 +601,178 @@ async def optimize_zip(
     2. Upload the ZIP
     3. Set program_args if needed (e.g., "data/input.txt")
     4. Check skip_execution for interactive programs that need user input
+    5. Check pgo to also get a PGO/BOLT build of the result, trained on program_args
     """
-
-    if not project_zip.filename.endswith('.zip'):
-        raise HTTPException(status_code=400, detail="File must be a .zip archive")
-    
-    include_paths = [p.strip() for p in include_dirs.split(",") if p.strip()]
-    run_args = [a.strip() for a in program_args.split(",") if a.strip()]
+    include_paths, run_args = parse_options(program_args, include_dirs)
     work_dir = working_dir.strip() if working_dir else None
 
-    for path in include_paths:
-        if not os.path.exists(path):
-            raise HTTPException(status_code=400, detail=f"Include path not found: {path}")
+    with tempfile.TemporaryDirectory() as tmpdirname:
+        project_root = Path(tmpdirname)
+        filepaths = await save_zip_upload(project_zip, project_root)
+        options["project"] = project_name(options["project"], [project_zip])
+
+        # Blocking work runs on a worker thread so the event loop stays responsive
+        results = await run_in_threadpool(
+            run_analysis, project_root, filepaths, include_paths, run_args, work_dir, skip_execution, **options
+        )
+        return optimized_file_response(results, options["output_format"])
+
+
+@app.post("/optimize-files")
+async def optimize_files(
+    cpp_files: list[UploadFile] = File(..., description="C++ source files (.cpp, .cc, .c)"),
+    program_args: str = Form("", description="Comma-separated runtime arguments"),
+    include_dirs: str = Form("", description="Comma-separated additional include directories"),
+    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode)"),
+    options: dict = Depends(optimization_options)
+):
+    """
+    **Upload individual files** (Good for quick testing of single files)
+    """
+    include_paths, run_args = parse_options(program_args, include_dirs)
 
     with tempfile.TemporaryDirectory() as tmpdirname:
         project_root = Path(tmpdirname)
-        source_exts = (".cpp", ".cc", ".c", ".cxx")
-        
-        print(f"\n📦 Uploading project to: {tmpdirname}")
-        print(f"📦 Extracting ZIP: {project_zip.filename}")
-        
-        # Save and extract ZIP
-        zip_path = project_root / "upload.zip"
-        with open(zip_path, "wb") as f:
-            f.write(await project_zip.read())
-        
-        try:
-            with zipfile.ZipFile(zip_path, 'r') as zip_ref:
-                zip_ref.extractall(project_root)
-        except zipfile.BadZipFile:
-            raise HTTPException(status_code=400, detail="Invalid ZIP file")
-        
-        os.remove(zip_path)
-        
-        # Find all files
-        filepaths = []
-        all_files = []
-        
-        header_exts = (".h", ".hpp", ".hxx", ".hh", ".H")
-        skip_files = ("Makefile", "CMakeLists.txt", "README", "LICENSE")
-        
-        for root, dirs, files_in_dir in os.walk(project_root):
-            dirs[:] = [d for d in dirs if not d.startswith('.') and d not in ['__pycache__', '__MACOSX']]
-            
-            for file in files_in_dir:
-                if file.startswith('.') or file.startswith('._') or file in skip_files:
-                    continue
-                    
-                file_path = Path(root) / file
-                rel_path = file_path.relative_to(project_root)
-                all_files.append(str(rel_path))
-                
-                if file.endswith(source_exts) and not file.endswith(header_exts):
-                    filepaths.append(str(file_path))
-                    print(f"   {rel_path} (will compile)")
-                elif file.endswith(header_exts):
-                    print(f"  📋 {rel_path} (header - will be available for #include)")
-                else:
-                    print(f"  📄 {rel_path}")
-        
-        if not filepaths:
-            raise HTTPException(
-                status_code=400,
-                detail=f"No C++ source files found. Files in ZIP: {', '.join(all_files)}"
-            )
+        filepaths = await save_file_uploads(cpp_files, project_root)
+        options["project"] = project_name(options["project"], cpp_files)
 
-        try:
-            results = process_project(project_root, filepaths, include_paths, run_args, work_dir, skip_execution)
-        except Exception as e:
-            import traceback
-            print("ERROR during analysis:\n", traceback.format_exc())
-            raise HTTPException(status_code=500, detail=f"Analysis failed: {str(e)}")
+        results = await run_in_threadpool(
+            run_analysis, project_root, filepaths, include_paths, run_args, None, skip_execution, **options
+        )
+        return optimized_file_response(results, options["output_format"])
 
-        if "ai_feedback" not in results:
-            raise HTTPException(status_code=500, detail="AI optimization failed")
 
-        final_json = results["ai_feedback"]["best_json"]
-        cpp_file = json_to_cpp(final_json, filename="project_combined.cpp")
+@app.post("/jobs/optimize-zip")
+async def submit_zip_job(
+    project_zip: UploadFile = File(..., description="ZIP file containing your entire C++ project"),
+    program_args: str = Form("", description="Comma-separated runtime arguments (e.g., 'data/input.txt')"),
+    include_dirs: str = Form("", description="Comma-separated additional include directories"),
+    working_dir: str = Form("", description="Subdirectory to run program from (leave empty for root)"),
+    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode, for interactive programs)"),
+    options: dict = Depends(optimization_options)
+):
+    """
+    **Submit a ZIP project as a background job.** Returns immediately with a job id;
+    poll `/jobs/{job_id}` or stream `/jobs/{job_id}/events`, then download `/jobs/{job_id}/result`.
+    """
+    include_paths, run_args = parse_options(program_args, include_dirs)
+    work_dir = working_dir.strip() if working_dir else None
 
-        with open(cpp_file, "a") as f:
-            f.write("\n\n// Optimized by Aadesh's C++ AI Assistant")
+    job = jobs.create_job()
+    project_root = Path(job.dir) / "project"
+    project_root.mkdir()
+    try:
+        filepaths = await save_zip_upload(project_zip, project_root)
+        options["project"] = project_name(options["project"], [project_zip])
+    except Exception:
+        jobs.discard(job)
+        raise
 
-        print(f"\n Optimization complete! Generated: {cpp_file}\n")
-        return FileResponse(cpp_file, media_type="text/x-c", filename="project_combined.cpp")
+    return submit_optimization_job(
+        job, project_root, filepaths, include_paths, run_args, work_dir, skip_execution, **options
+    )
 
 
-@app.post("/optimize-files")
-async def optimize_files(
+@app.post("/jobs/optimize-files")
+async def submit_files_job(
     cpp_files: list[UploadFile] = File(..., description="C++ source files (.cpp, .cc, .c)"),
     program_args: str = Form("", description="Comma-separated runtime arguments"),
     include_dirs: str = Form("", description="Comma-separated additional include directories"),
-    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode)")
+    skip_execution: bool = Form(False, description="Skip running the program (compile-only mode)"),
+    options: dict = Depends(optimization_options)
 ):
     """
-    **Upload individual files** (Good for quick testing of single files)
+    **Submit individual files as a background job.** Same flow as `/jobs/optimize-zip`.
     """
-    
-    source_exts = (".cpp", ".cc", ".c", ".cxx")
-    
-    include_paths = [p.strip() for p in include_dirs.split(",") if p.strip()]
-    run_args = [a.strip() for a in program_args.split(",") if a.strip()]
+    include_paths, run_args = parse_options(program_args, include_dirs)
 
-    for path in include_paths:
-        if not os.path.exists(path):
-            raise HTTPException(status_code=400, detail=f"Include path not found: {path}")
+    job = jobs.create_job()
+    project_root = Path(job.dir) / "project"
+    project_root.mkdir()
+    try:
+        filepaths = await save_file_uploads(cpp_files, project_root)
+        options["project"] = project_name(options["project"], cpp_files)
+    except Exception:
+        jobs.discard(job)
+        raise
 
-    with tempfile.TemporaryDirectory() as tmpdirname:
-        project_root = Path(tmpdirname)
-        filepaths = []
-        
-        print(f"\n📦 Uploading files to: {tmpdirname}")
-        
-        for upload in cpp_files:
-            if not upload.filename.endswith(source_exts):
-                raise HTTPException(
-                    status_code=400,
-                    detail=f"File '{upload.filename}' must be a C++ source file (.cpp, .cc, .c, .cxx)"
-                )
-            
-            file_path = project_root / upload.filename
-            with open(file_path, "wb") as f:
-                f.write(await upload.read())
-            
-            filepaths.append(str(file_path))
-            print(f"  ✅ {upload.filename}")
+    return submit_optimization_job(
+        job, project_root, filepaths, include_paths, run_args, None, skip_execution, **options
+    )
 
-        try:
-            results = process_project(project_root, filepaths, include_paths, run_args, None, skip_execution)
-        except Exception as e:
-            import traceback
-            print("ERROR during analysis:\n", traceback.format_exc())
-            raise HTTPException(status_code=500, detail=f"Analysis failed: {str(e)}")
 
-        if "ai_feedback" not in results:
-            raise HTTPException(status_code=500, detail="AI optimization failed")
+@app.get("/jobs/{job_id}")
+async def job_status(job_id: str, since: int = 0):
+    """Job status plus progress events (pass `since` to only get new events)."""
+    return jobs.get_job(job_id).snapshot(since)
 
-        final_json = results["ai_feedback"]["best_json"]
-        cpp_file = json_to_cpp(final_json, filename="project_combined.cpp")
 
-        with open(cpp_file, "a") as f:
-            f.write("\n\n// Optimized by Aadesh's C++ AI Assistant")
+@app.get("/jobs/{job_id}/events")
+async def job_events(job_id: str):
+    """Stream progress events as Server-Sent Events until the job finishes."""
+    job = jobs.get_job(job_id)
+
+    async def stream():
+        since = 0
+        while True:
+            snap = job.snapshot(since)
+            for event in snap["events"]:
+                yield f"data: {json.dumps(event)}\n\n"
+            since = snap["next_event"]
+            if snap["status"] in ("done", "failed"):
+                break
+            await asyncio.sleep(0.5)
+
+    return StreamingResponse(stream(), media_type="text/event-stream")
+
+
+@app.get("/jobs/{job_id}/result")
+async def job_result(job_id: str):
+    """Download the optimized file (or zip/patch) once the job is done."""
+    job = jobs.get_job(job_id)
+    if job.status == "failed":
+        raise HTTPException(status_code=500, detail=job.error)
+    if job.status != "done":
+        raise HTTPException(status_code=409, detail=f"Job is still {job.status}")
+    return FileResponse(job.result["file"], media_type=job.result["media_type"], filename=job.result["filename"])
+
+
+def history_query(query, *args):
+    """Call a results history function, answering 503 if the database can't be opened or read."""
+    try:
+        return query(*args)
+    except (sqlite3.Error, OSError) as e:
+        raise HTTPException(status_code=503, detail=f"Results history unavailable: {e}")
+
+
+@app.get("/runs")
+async def runs(project: str = "", project_hash: str = "", limit: int = 50):
+    """Recorded optimization runs, newest first (filter by project name or source hash)."""
+    return await run_in_threadpool(history_query, list_runs, project or None, project_hash or None, limit)
+
+
+def recorded_run(run_id):
+    """A run of the results history or a 404."""
+    run = history_query(get_run, run_id)
+    if run is None:
+        raise HTTPException(status_code=404, detail=f"Unknown run: {run_id}")
+    return run
+
+
+@app.get("/runs/{run_id}")
+async def run_details(run_id: int):
+    """One recorded run: options, baseline and best metrics, per-iteration candidates and accepted diffs."""
+    return await run_in_threadpool(recorded_run, run_id)
+
+
+@app.get("/runs/{run_id}/compare")
+async def compare_run(run_id: int, to: int = 0):
+    """Compare a run with another one (default: the same project's run before it) to spot regressions."""
+    def compare():
+        run = recorded_run(run_id)
+        previous = to or history_query(previous_run_id, run_id)
+        if not previous:
+            raise HTTPException(status_code=404, detail=f"Run {run_id} has no earlier run of '{run['project']}'")
+        return compare_runs(run, recorded_run(previous))
 
-        print(f"\n Optimization complete! Generated: {cpp_file}\n")
-        return FileResponse(cpp_file, media_type="text/x-c", filename="project_combined.cpp")
\ No newline at end of file
+    return await run_in_threadpool(compare)
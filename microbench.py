@@ -0,0 +1,399 @@
+import functools
+import json
+import os
+import re
+import subprocess
+import tempfile
+from utils import cached_compile, get_code
+from benchmark import run_once, summarize, DEFAULT_TIMEOUT
+from correctness import capture_outputs
+
+# Function-level benchmarking: instead of timing the whole program, wrap the
+# functions found by recursiveSearch in a generated harness (Google Benchmark
+# when installed, a small built-in timer otherwise) and time each call at
+# nanosecond resolution. Works for programs that read stdin and for libraries
+# without a main. Each benchmarked call's result (and the state of its
+# arguments afterwards) is printed once, so candidates are still checked for
+# correctness against the baseline.
+MAX_TARGETS = 8
+MICROBENCH_REPETITIONS = 10
+# The built-in timer grows its batch until one batch takes this long
+MIN_BATCH_NS = 10_000_000
+# Functions that modify their arguments get fresh copies for every call, built
+# (untimed) this many at a time
+FRESH_ARGS_CHUNK = 64
+# Size of generated std::vector/std::string arguments, and the value passed for
+# integers (kept small: it is often a recursion depth or loop bound)
+DEFAULT_INPUT_SIZE = 1 << 16
+DEFAULT_INTEGER = 24
+
+_INTEGRAL = r"(?:unsigned\s+|signed\s+)?(?:int|long|long\s+long|short|size_t|std::size_t|u?int(?:8|16|32|64)_t|std::u?int(?:8|16|32|64)_t|unsigned)"
+_FLOATING = r"(?:float|double|long\s+double)"
+
+
+def split_top_level(text, sep=","):
+    """Split on sep outside (), <>, [] and {}."""
+    parts, depth, cur = [], 0, []
+    for ch in text:
+        if ch in "(<[{":
+            depth += 1
+        elif ch in ")>]}":
+            depth -= 1
+        if ch == sep and depth == 0:
+            parts.append("".join(cur).strip())
+            cur = []
+        else:
+            cur.append(ch)
+    if "".join(cur).strip():
+        parts.append("".join(cur).strip())
+    return parts
+
+
+def parse_signature(code):
+    """(return type, parameter list) of a free function definition, or None if it can't be benchmarked."""
+    head = code.split("{")[0]
+    if re.match(r"\s*template\b", head) or "(" not in head:
+        return None
+    before, _, rest = head.partition("(")
+    if "::" in before.split()[-1] if before.split() else True:
+        # Out-of-line members and qualified definitions can't be called by their bare name
+        return None
+    params = rest.rsplit(")", 1)[0]
+    ret = re.sub(r"\b(static|inline|constexpr|extern)\b", "", before.rsplit(None, 1)[0] if " " in before.strip() else "")
+    return ret.strip(), [p for p in split_top_level(params) if p and p != "void"]
+
+
+def default_argument(param):
+    """A C++ expression for a parameter of a common type (None when the user must supply one)."""
+    # Drop the parameter name and default value, keep the type
+    param = param.split("=")[0].strip()
+    ptype = re.sub(r"\s*\b\w+\s*$", "", param) if re.search(r"[\w>&*]\s+\w+$", param) else param
+    ptype = re.sub(r"\bconst\b|&", "", ptype).strip()
+
+    if re.fullmatch(_INTEGRAL, ptype):
+        return str(DEFAULT_INTEGER)
+    if re.fullmatch(_FLOATING, ptype):
+        return "1.5"
+    if ptype == "bool":
+        return "true"
+    if ptype in ("std::string", "string"):
+        return f"std::string({DEFAULT_INPUT_SIZE}, 'x')"
+    m = re.fullmatch(r"(?:std::)?vector\s*<\s*(.+?)\s*>", ptype)
+    if m and (re.fullmatch(_INTEGRAL, m.group(1)) or re.fullmatch(_FLOATING, m.group(1))):
+        return f"cppopt_iota<{m.group(1)}>({DEFAULT_INPUT_SIZE})"
+    return None
+
+
+def _writable(param):
+    """Whether a parameter lets the function modify the caller's argument (non-const reference or pointer)."""
+    decl = param.split("=")[0]
+    return bool(re.search(r"[&*]", decl)) and not re.match(r"\s*const\b", decl) \
+        and not re.search(r"\bconst\s*[&*]", decl)
+
+
+def plan_benchmarks(functions, inputs=None, names=None):
+    """Benchmarks to run: {bench name: {"function", "args", "void", "fresh"}}.
+
+    inputs maps a function name to a C++ argument list (or a list of them,
+    one benchmark each); other functions get generated arguments when all
+    their parameter types are supported. names limits which functions are
+    considered, hottest first. "fresh" marks functions taking a non-const
+    reference or pointer: each timed call gets newly built arguments, or
+    later calls would run on the first call's output.
+    """
+    inputs = inputs or {}
+    candidates = [n for n in (names or list(inputs) + list(functions)) if n in functions and n != "main"]
+    plan = {}
+    for name in dict.fromkeys(candidates):
+        if len({p["function"] for p in plan.values()}) >= MAX_TARGETS:
+            break
+        sig = parse_signature(get_code(functions[name]))
+        if sig is None:
+            continue
+        ret, params = sig
+        arg_lists = inputs.get(name)
+        if arg_lists is None:
+            args = [default_argument(p) for p in params]
+            if None in args:
+                continue
+            arg_lists = [", ".join(args)]
+        elif isinstance(arg_lists, str):
+            arg_lists = [arg_lists]
+        for i, args in enumerate(arg_lists):
+            plan[f"{name}/{i}"] = {"function": name, "args": args, "void": re.fullmatch(r"void", ret) is not None,
+                                   "fresh": any(_writable(p) for p in params)}
+    return plan
+
+
+@functools.lru_cache(maxsize=None)
+def has_google_benchmark():
+    """True if clang++ can build and link against Google Benchmark."""
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "probe.cpp")
+        with open(src, "w") as f:
+            f.write("#include <benchmark/benchmark.h>\nint main() { return 0; }\n")
+        result = subprocess.run(["clang++", src, "-o", os.path.join(tmp, "probe"), "-lbenchmark", "-lpthread"],
+                                capture_output=True)
+        return result.returncode == 0
+
+
+HARNESS_PRELUDE = r"""
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <vector>
+
+template <class T> std::vector<T> cppopt_iota(std::size_t n) {
+    std::vector<T> v(n);
+    for (std::size_t i = 0; i < n; i++) v[i] = static_cast<T>(i % 97);
+    return v;
+}
+
+// Print a value once for the correctness check: streamable, a range, or opaque
+template <class T> auto cppopt_show(std::ostream& os, const T& v, int) -> decltype(os << v, void()) { os << v; }
+template <class T> auto cppopt_show(std::ostream& os, const T& v, long) -> decltype(std::begin(v), void()) {
+    os << '[';
+    for (const auto& x : v) { cppopt_show(os, x, 0); os << ','; }
+    os << ']';
+}
+template <class T> void cppopt_show(std::ostream& os, const T&, ...) { os << '?'; }
+template <class T> void cppopt_show(std::ostream& os, T* const&, int) { os << "ptr"; }
+
+template <class T> inline void cppopt_keep(T&& value) { asm volatile("" : : "r"(&value) : "memory"); }
+inline void cppopt_clobber() { asm volatile("" : : : "memory"); }
+
+static std::ofstream& cppopt_results() {
+    static std::ofstream out(std::getenv("CPPOPT_RESULT_OUT") ? std::getenv("CPPOPT_RESULT_OUT") : "/dev/null");
+    return out;
+}
+"""
+
+BUILTIN_RUNNER = r"""
+template <class F> static void cppopt_run(const char* name, F body, int reps, std::FILE* out) {
+    using clock = std::chrono::steady_clock;
+    long iters = 1;
+    for (;;) {
+        auto t0 = clock::now();
+        for (long i = 0; i < iters; i++) body();
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+        if (ns >= MIN_BATCH_NS || iters >= (1L << 30)) break;
+        iters = ns > 0 ? std::max(iters * 2, static_cast<long>(iters * (double)MIN_BATCH_NS / ns)) : iters * 10;
+    }
+    for (int r = 0; r < reps; r++) {
+        auto t0 = clock::now();
+        for (long i = 0; i < iters; i++) body();
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+        std::fprintf(out, "%s %.3f\n", name, ns / iters);
+    }
+}
+
+// Like cppopt_run for functions that modify their arguments: every call gets
+// a fresh tuple from make(), built outside the timed stretches
+template <class Make, class Call> static void cppopt_run_fresh(const char* name, Make make, Call call, int reps,
+                                                               std::FILE* out) {
+    using clock = std::chrono::steady_clock;
+    auto timed = [&](long iters) {
+        double ns = 0;
+        for (long done = 0; done < iters;) {
+            long n = std::min(iters - done, static_cast<long>(FRESH_ARGS_CHUNK));
+            std::vector<decltype(make())> args;
+            args.reserve(n);
+            for (long i = 0; i < n; i++) args.push_back(make());
+            auto t0 = clock::now();
+            for (long i = 0; i < n; i++) call(args[i]);
+            ns += std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+            done += n;
+        }
+        return ns;
+    };
+    long iters = 1;
+    for (;;) {
+        double ns = timed(iters);
+        if (ns >= MIN_BATCH_NS || iters >= (1L << 30)) break;
+        iters = ns > 0 ? std::max(iters * 2, static_cast<long>(iters * (double)MIN_BATCH_NS / ns)) : iters * 10;
+    }
+    for (int r = 0; r < reps; r++) std::fprintf(out, "%s %.3f\n", name, timed(iters) / iters);
+}
+"""
+
+
+def harness_source(plan, includes, google_benchmark):
+    """C++ source of the benchmark harness; includes are the TUs defining the benchmarked functions."""
+    lines = [f'#include "{path}"' for path in includes]
+    lines += ["#undef main", HARNESS_PRELUDE]
+    if google_benchmark:
+        lines.append("#include <benchmark/benchmark.h>")
+    else:
+        lines.append(BUILTIN_RUNNER.replace("MIN_BATCH_NS", str(MIN_BATCH_NS))
+                     .replace("FRESH_ARGS_CHUNK", str(FRESH_ARGS_CHUNK)))
+
+    bodies = []
+    for i, (bench, spec) in enumerate(plan.items()):
+        args = split_top_level(spec["args"])
+        setup = " ".join(f"auto a{j} = {a};" for j, a in enumerate(args))
+        call = f"{spec['function']}({', '.join(f'a{j}' for j in range(len(args)))})"
+        keep = f"{call}; cppopt_clobber();" if spec["void"] else f"cppopt_keep({call});"
+        show = [] if spec["void"] else [f"cppopt_show(os, {call}, 0);"]
+        show += [f"os << \" a{j}=\"; cppopt_show(os, a{j}, 0);" for j in range(len(args))]
+        lines.append(
+            f"static void cppopt_check_{i}() {{ {setup} auto& os = cppopt_results(); "
+            f"os << \"{bench} \"; {' '.join(show)} os << '\\n'; }}"
+        )
+        if spec.get("fresh"):
+            # Arguments as a tuple built anew for every call
+            make = f"[] {{ return std::make_tuple({', '.join(args)}); }}"
+            fresh_call = f"{spec['function']}({', '.join(f'std::get<{j}>(t)' for j in range(len(args)))})"
+            fresh_keep = f"{fresh_call}; cppopt_clobber();" if spec["void"] else f"cppopt_keep({fresh_call});"
+            if google_benchmark:
+                lines.append(f"static void cppopt_bench_{i}(benchmark::State& state) {{ auto make = {make}; "
+                             f"auto t = make(); for (auto _ : state) {{ state.PauseTiming(); t = make(); "
+                             f"state.ResumeTiming(); {fresh_keep} }} }}")
+                bodies.append(f'    benchmark::RegisterBenchmark("{bench}", cppopt_bench_{i});')
+            else:
+                lines.append(f"static void cppopt_bench_{i}(int reps, std::FILE* out) {{ "
+                             f"cppopt_run_fresh(\"{bench}\", {make}, [](auto& t) {{ {fresh_keep} }}, reps, out); }}")
+                bodies.append(f"    cppopt_bench_{i}(reps, out);")
+        elif google_benchmark:
+            lines.append(f"static void cppopt_bench_{i}(benchmark::State& state) {{ {setup} "
+                         f"for (auto _ : state) {{ {keep} }} }}")
+            bodies.append(f'    benchmark::RegisterBenchmark("{bench}", cppopt_bench_{i});')
+        else:
+            lines.append(f"static void cppopt_bench_{i}(int reps, std::FILE* out) {{ {setup} "
+                         f"cppopt_run(\"{bench}\", [&] {{ {keep} }}, reps, out); }}")
+            bodies.append(f"    cppopt_bench_{i}(reps, out);")
+
+    lines.append("int main(int argc, char** argv) {")
+    lines.append("    cppopt_results() << std::setprecision(12);")
+    lines += [f"    cppopt_check_{i}();" for i in range(len(plan))]
+    lines.append("    cppopt_results().flush();")
+    if google_benchmark:
+        lines += ["    benchmark::Initialize(&argc, argv);"] + bodies
+        lines += ["    benchmark::RunSpecifiedBenchmarks();", "    return 0;", "}"]
+    else:
+        lines += ["    int reps = argc > 1 ? std::atoi(argv[1]) : 1;",
+                  "    std::FILE* out = std::fopen(std::getenv(\"CPPOPT_BENCH_OUT\"), \"w\");",
+                  "    if (!out) return 1;"] + bodies
+        lines += ["    std::fclose(out);", "    return 0;", "}"]
+    return "\n".join(lines) + "\n"
+
+
+def _defining_file(cpp_files, code):
+    """The source file whose text contains a function's code."""
+    code = code.strip().encode()
+    for path in cpp_files:
+        with open(path, "rb") as f:
+            if code in f.read():
+                return path
+    return None
+
+
+def _read_timings(path, google_benchmark):
+    """{bench name: [ns per call, one per repetition]} from the harness output file."""
+    timings = {}
+    if google_benchmark:
+        with open(path) as f:
+            report = json.load(f)
+        scale = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+        for b in report.get("benchmarks", []):
+            if b.get("run_type", "iteration") == "iteration":
+                timings.setdefault(b["run_name"] if "run_name" in b else b["name"], []).append(
+                    b["real_time"] * scale.get(b.get("time_unit", "ns"), 1.0))
+    else:
+        with open(path) as f:
+            for line in f:
+                name, ns = line.rsplit(None, 1)
+                timings.setdefault(name, []).append(float(ns))
+    return timings
+
+
+def benchmark_functions(filepaths, code_json, plan, clang_args=None, repetitions=MICROBENCH_REPETITIONS,
+                        build_dir=None, cwd=None):
+    """Build the harness around the current code and time every planned benchmark.
+
+    Returns stats in the shape of benchmark.summarize (seconds; each sample is
+    the sum over all benchmarks of one repetition's time per call), plus
+    stats["functions"] = {bench name: median ns per call}. None on failure.
+    """
+    cpp_files = [fp for fp in filepaths if fp.endswith((".cpp", ".cc", ".c", ".cxx"))]
+    functions = code_json.get("functions", {})
+    includes = []
+    for spec in plan.values():
+        path = _defining_file(cpp_files, get_code(functions.get(spec["function"], "")))
+        if path is None:
+            print(f"⚠️  Could not find where {spec['function']} is defined")
+            return None
+        if path not in includes:
+            includes.append(path)
+
+    workdir = tempfile.mkdtemp(prefix="microbench_", dir=build_dir)
+    google_benchmark = has_google_benchmark()
+    harness = os.path.join(workdir, "cppopt_harness.cpp")
+    with open(harness, "w") as f:
+        f.write(harness_source(plan, [os.path.abspath(p) for p in includes], google_benchmark))
+
+    # The harness provides main: the program's own is renamed away wherever it is
+    flags = list(clang_args or []) + ["-Dmain=cppopt_user_main"]
+    if google_benchmark:
+        flags += ["-lbenchmark", "-lpthread"]
+    exe = os.path.join(workdir, "microbench_bin")
+    sources = [harness] + [fp for fp in cpp_files if fp not in includes]
+    if not cached_compile(sources, exe, flags)[0]:
+        return None
+
+    timings_out = os.path.join(workdir, "timings.out")
+    results_out = os.path.join(workdir, "results.out")
+    env = dict(os.environ, CPPOPT_BENCH_OUT=timings_out, CPPOPT_RESULT_OUT=results_out)
+    if google_benchmark:
+        cmd = [exe, f"--benchmark_repetitions={repetitions}", f"--benchmark_out={timings_out}",
+               "--benchmark_out_format=json"]
+    else:
+        cmd = [exe, str(repetitions)]
+    try:
+        result = run_once(cmd, timeout=DEFAULT_TIMEOUT * 4, cwd=cwd, env=env)
+    except subprocess.TimeoutExpired:
+        print("⚠️  Microbenchmark timed out")
+        return None
+    if result["returncode"] != 0 or not os.path.exists(timings_out):
+        print(f"⚠️  Microbenchmark exited with {result['returncode']}")
+        return None
+
+    timings = _read_timings(timings_out, google_benchmark)
+    if set(timings) != set(plan) or len({len(t) for t in timings.values()}) != 1:
+        print("⚠️  Microbenchmark output incomplete")
+        return None
+
+    with open(results_out, "rb") as f:
+        checked = f.read()
+    samples = [sum(reps) * 1e-9 for reps in zip(*timings.values())]
+    # The harness reports wall time only; CPU time is unavailable
+    stats = summarize(samples, None, output=capture_outputs([checked], [b""]))
+    stats["functions"] = {name: sorted(t)[len(t) // 2] for name, t in timings.items()}
+    return stats
+
+
+def profile_from_stats(stats):
+    """Profile rows (see profiler.py) weighting each benchmarked function by its share of the time."""
+    if not stats or not stats.get("functions"):
+        return None
+    per_function = {}
+    for bench, ns in stats["functions"].items():
+        name = bench.rsplit("/", 1)[0]
+        per_function[name] = per_function.get(name, 0.0) + ns
+    total = sum(per_function.values()) or 1.0
+    rows = [{"symbol": name, "self_pct": round(100 * ns / total, 2), "total_pct": round(100 * ns / total, 2)}
+            for name, ns in per_function.items()]
+    return sorted(rows, key=lambda r: r["self_pct"], reverse=True)
+
+
+def format_functions(stats):
+    """One-line per-benchmark timing summary."""
+    if not stats or not stats.get("functions"):
+        return ""
+    return ", ".join(f"{name} {ns:.1f}ns" for name, ns in stats["functions"].items())
@@ -0,0 +1,123 @@
+from benchmark import is_significant_improvement, DEFAULT_MIN_IMPROVEMENT
+
+# What the AI loop optimizes for. Each objective is a metric of the stats
+# dict (lower is better) with a name for logs and a goal for the prompt.
+# Several objectives are combined into a weighted score relative to the
+# baseline; the candidates not dominated on any objective form a Pareto front.
+OBJECTIVES = {
+    "time": ("median", "runtime", "reduce execution time"),
+    "rss": ("peak_rss_kb", "peak RSS",
+            "reduce peak memory (RSS): compact data types and containers, release or stream data instead of holding it"),
+    "allocations": ("allocations", "heap allocations",
+                    "eliminate heap allocations, above all in hot loops (reserve, reuse buffers, stack or arena storage)"),
+    "size": ("binary_size", "binary size",
+             "reduce binary size: fewer template instantiations and inlined copies, no dead code"),
+}
+DEFAULT_OBJECTIVES = {"time": 1.0}
+
+
+def parse_objectives(spec):
+    """Weights from a spec like "time", "time,allocations" or "time:1,rss:0.5"; ValueError if invalid."""
+    weights = {}
+    for part in (spec or "").split(","):
+        name, _, weight = part.strip().partition(":")
+        if not name:
+            continue
+        if name not in OBJECTIVES:
+            raise ValueError(f"unknown objective '{name}' (choose from {', '.join(OBJECTIVES)})")
+        weights[name] = float(weight) if weight else 1.0
+        if weights[name] < 0:
+            raise ValueError(f"objective weight must not be negative: {part}")
+    if not any(weights.values()):
+        return dict(DEFAULT_OBJECTIVES)
+    return weights
+
+
+def time_only(weights):
+    """Whether weights select runtime alone (the classic acceptance rule)."""
+    return [n for n, w in (weights or {}).items() if w] in ([], ["time"])
+
+
+def metrics(stats, weights):
+    """{objective: value} of stats for the weighted objectives (None where unmeasured)."""
+    return {name: stats.get(OBJECTIVES[name][0]) for name in weights} if stats else {}
+
+
+def _ratio(value, reference):
+    if value is None or reference is None:
+        return 1.0
+    if reference == 0:
+        return 1.0 if value == 0 else float("inf")
+    return value / reference
+
+
+def score(stats, baseline_stats, weights, time_reference=None):
+    """Weighted mean of stats' metrics relative to the baseline (1.0 = baseline, lower is better).
+
+    time_reference replaces stats' runtime, which is how runtime changes
+    within measurement noise are kept out of the score.
+    """
+    total = sum(weights.values()) or 1.0
+    value = 0.0
+    for name, weight in weights.items():
+        key = OBJECTIVES[name][0]
+        metric = (time_reference or stats)[key] if name == "time" else stats.get(key)
+        value += weight * _ratio(metric, baseline_stats.get(key) if baseline_stats else None)
+    return value / total
+
+
+def improves(best_stats, stats, baseline_stats, weights):
+    """Whether stats beats best_stats on the objectives.
+
+    Runtime alone keeps the significance test; combined, the score must drop
+    by at least DEFAULT_MIN_IMPROVEMENT, counting runtime only when it
+    changed significantly.
+    """
+    if time_only(weights):
+        return is_significant_improvement(best_stats, stats)
+    if best_stats is None:
+        return True
+    changed = is_significant_improvement(best_stats, stats) or is_significant_improvement(stats, best_stats)
+    candidate = score(stats, baseline_stats, weights, None if changed else best_stats)
+    return candidate < score(best_stats, baseline_stats, weights) * (1 - DEFAULT_MIN_IMPROVEMENT)
+
+
+def ranking_key(baseline_stats, weights):
+    """Sort key picking the best of several candidates."""
+    if time_only(weights):
+        return lambda stats: stats["median"]
+    return lambda stats: score(stats, baseline_stats, weights)
+
+
+def update_front(front, entry, weights):
+    """Add entry ({"metrics": ..., ...}) to a Pareto front if no member dominates it; returns the new front."""
+    names = [n for n in weights if entry["metrics"].get(n) is not None]
+
+    def dominates(a, b):
+        pairs = [(a["metrics"].get(n), b["metrics"].get(n)) for n in names]
+        pairs = [(x, y) for x, y in pairs if x is not None and y is not None]
+        return bool(pairs) and all(x <= y for x, y in pairs) and any(x < y for x, y in pairs)
+
+    if any(dominates(member, entry) for member in front):
+        return front
+    return [m for m in front if not dominates(entry, m)] + [entry]
+
+
+def objective_prompt(weights, stats):
+    """Prompt lines naming what to optimize ('' for runtime alone, the default prompt's goal)."""
+    if time_only(weights):
+        return ""
+    lines = []
+    for name, weight in sorted(weights.items(), key=lambda w: -w[1]):
+        if not weight:
+            continue
+        key, label, goal = OBJECTIVES[name]
+        current = stats.get(key) if stats else None
+        now = f" (currently {current:.6g})" if current is not None else ""
+        lines.append(f"- {label}, weight {weight:g}{now}: {goal}")
+    return "Objectives (all count, by weight):\n" + "\n".join(lines) + "\n"
+
+
+def format_objectives(weights):
+    """e.g. 'runtime×1, heap allocations×0.5'."""
+    return ", ".join(f"{OBJECTIVES[n][1]}×{w:g}" for n, w in weights.items() if w)
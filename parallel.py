@@ -0,0 +1,290 @@
+import ctypes.util
+import json
+import os
+import re
+from clang import cindex
+from benchmark import bench_cpus
+
+# Parallelization mode: loops whose iterations look independent are found on
+# the libclang AST of each function and handed to the model as findings;
+# builds get OpenMP (and TBB for the parallel standard algorithms),
+# candidates are timed at 1 and parallel_threads() threads (see workloads.py)
+# and must pass a ThreadSanitizer run (see sanitize.py). The scan is a
+# heuristic: iterations may only write elements indexed by the loop
+# variable, locals and reduction variables, and must not leave the loop.
+PARALLEL_THREADS = int(os.getenv("OPTIMIZER_PARALLEL_THREADS", "0"))
+OPENMP_FLAGS = ["-fopenmp"]
+
+PARALLEL_CODE = re.compile(r"#\s*pragma\s+omp\b|\bomp_\w+\(|std::execution::|std::(thread|jthread|async)\b")
+SCALAR_TYPES = {cindex.TypeKind.BOOL, cindex.TypeKind.CHAR_S, cindex.TypeKind.CHAR_U, cindex.TypeKind.SCHAR,
+                cindex.TypeKind.UCHAR, cindex.TypeKind.SHORT, cindex.TypeKind.USHORT, cindex.TypeKind.INT,
+                cindex.TypeKind.UINT, cindex.TypeKind.LONG, cindex.TypeKind.ULONG, cindex.TypeKind.LONGLONG,
+                cindex.TypeKind.ULONGLONG, cindex.TypeKind.FLOAT, cindex.TypeKind.DOUBLE,
+                cindex.TypeKind.LONGDOUBLE}
+REDUCTIONS = {"+=": "+", "-=": "+", "*=": "*", "|=": "|", "&=": "&", "^=": "^", "++": "+", "--": "+"}
+EXITS = (cindex.CursorKind.BREAK_STMT, cindex.CursorKind.RETURN_STMT, cindex.CursorKind.GOTO_STMT,
+         cindex.CursorKind.CXX_THROW_EXPR)
+# Calls with side effects outside the iteration (I/O, global state, container growth)
+SIDE_EFFECTS = {"printf", "fprintf", "puts", "putchar", "fputs", "fwrite", "fread", "scanf", "fscanf", "getline",
+                "rand", "srand", "exit", "abort", "operator<<", "operator>>", "push_back", "emplace_back",
+                "emplace", "insert", "erase", "pop_back", "push", "pop", "clear", "resize", "reserve",
+                "lock", "unlock"}
+# Loops with a constant trip count below this aren't worth a parallel region
+MIN_TRIP_COUNT = 1000
+WRAPPERS = (cindex.CursorKind.UNEXPOSED_EXPR, cindex.CursorKind.PAREN_EXPR)
+
+
+def parallel_threads():
+    """Threads parallel candidates are timed with: OPTIMIZER_PARALLEL_THREADS, else the benchmark cores or all cores."""
+    return PARALLEL_THREADS or len(bench_cpus()) or os.cpu_count() or 1
+
+
+def parallel_prompt(threads):
+    """System prompt addition for parallelization mode."""
+    return (
+        f"\nThe program runs on a machine with {threads} cores and is benchmarked at 1 and {threads} threads "
+        "(the score combines both). Parallelize loops with independent iterations: OpenMP "
+        "(#pragma omp parallel for, with reduction/private/schedule clauses as needed; the build uses -fopenmp), "
+        "C++17 parallel algorithms (std::execution::par_unseq, add <execution> to 'headers') or a work-stealing "
+        "thread pool. Keep shared writes race-free (reductions, per-thread buffers merged afterwards, atomics): "
+        "every candidate is run under ThreadSanitizer. Don't hard-code the thread count; OMP_NUM_THREADS is set."
+    )
+
+
+def _code_text(code_json):
+    return json.dumps({k: code_json.get(k) for k in ("functions", "classes", "globals")})
+
+
+def uses_parallelism(code_json):
+    """Whether a code state uses OpenMP, parallel algorithms or threads (and so needs a race check)."""
+    return bool(PARALLEL_CODE.search(_code_text(code_json)))
+
+
+def build_flags(code_json):
+    """Link flags a code state needs beyond OPENMP_FLAGS: libstdc++ runs parallel algorithms on TBB."""
+    if "std::execution::" in _code_text(code_json) and ctypes.util.find_library("tbb"):
+        return ["-ltbb"]
+    return []
+
+
+def _strip(node):
+    while node.kind in WRAPPERS:
+        children = list(node.get_children())
+        if len(children) != 1:
+            break
+        node = children[0]
+    return node
+
+
+def _tokens(node):
+    return [t.spelling for t in node.get_tokens()]
+
+
+def _operator(node):
+    """Operator token of a binary or compound assignment operator (the first token after its lhs)."""
+    children = list(node.get_children())
+    if len(children) != 2:
+        return None
+    end = children[0].extent.end.offset
+    for token in node.get_tokens():
+        if token.extent.start.offset >= end:
+            return token.spelling
+    return None
+
+
+def _inside(cursor, scope):
+    """Whether a declaration lies within scope's source range."""
+    loc = cursor.location
+    if loc.file is None or scope.extent.start.file is None or loc.file.name != scope.extent.start.file.name:
+        return False
+    return scope.extent.start.offset <= loc.offset <= scope.extent.end.offset
+
+
+def _referenced_var(node):
+    node = _strip(node)
+    if node.kind == cindex.CursorKind.DECL_REF_EXPR and node.referenced is not None \
+            and node.referenced.kind in (cindex.CursorKind.VAR_DECL, cindex.CursorKind.PARM_DECL):
+        return node.referenced
+    return None
+
+
+def _subscript(node):
+    """(base node, base text, index node) of a[i] or a container's operator[], else None."""
+    node = _strip(node)
+    children = list(node.get_children())
+    if node.kind == cindex.CursorKind.ARRAY_SUBSCRIPT_EXPR and len(children) == 2:
+        return children[0], " ".join(_tokens(children[0])), children[1]
+    if node.kind == cindex.CursorKind.CALL_EXPR and node.spelling == "operator[]" and len(children) >= 2:
+        base = [c for c in children if _strip(c).spelling != "operator[]"]
+        if len(base) == 2:
+            return base[0], " ".join(_tokens(base[0])), base[1]
+    return None
+
+
+def _mentions(node, var):
+    return any(n.kind == cindex.CursorKind.DECL_REF_EXPR and n.referenced is not None and n.referenced == var
+               for n in node.walk_preorder())
+
+
+class _Loop:
+    """Dependence check of one loop body; ok is False once something rules parallelization out."""
+
+    def __init__(self, body, var, elementwise):
+        # elementwise: var is a range-for reference, so writes through it touch only this element
+        self.body, self.var, self.elementwise = body, var, elementwise
+        self.ok = True
+        self.reductions = {}
+        self.sites = {}
+        self.writes = {}
+        self.work = False
+
+    def target(self, node, op):
+        """Classify the target of a write in the body."""
+        node = _strip(node)
+        sub = _subscript(node)
+        if sub is not None:
+            owner, base, index = sub
+            owner = _referenced_var(owner)
+            if owner is not None and _inside(owner, self.body):
+                return
+            # c[i][j] is this iteration's as long as some subscript is i; a[idx[i]] may be anyone's
+            if self.elementwise or not _mentions(node, self.var) or "[" in _tokens(index):
+                self.ok = False
+                return
+            self.writes.setdefault(base, set()).add(" ".join(_tokens(index)))
+            self.work = True
+            return
+        if node.kind == cindex.CursorKind.MEMBER_REF_EXPR:
+            children = list(node.get_children())
+            if children:
+                # p.x: as local as p (a[i].x is an element write)
+                return self.target(children[0], op)
+            self.ok = False  # a member of *this, shared by every iteration
+            return
+        var = _referenced_var(node)
+        if var is None:
+            self.ok = False  # *p, a global through a call, ...
+            return
+        if var == self.var:
+            self.ok = self.elementwise
+            self.work = self.work or self.elementwise
+            return
+        if _inside(var, self.body):
+            return
+        if op in REDUCTIONS and var.type.get_canonical().kind in SCALAR_TYPES:
+            self.reductions.setdefault(var.spelling, set()).add(REDUCTIONS[op])
+            self.sites.setdefault(var.hash, [var, 0])[1] += 1
+            self.work = True
+            return
+        self.ok = False
+
+    def check(self):
+        reads = {}
+        for node in self.body.walk_preorder():
+            if not self.ok:
+                break
+            kind = node.kind
+            if kind in EXITS or kind.name.startswith("OMP_"):
+                self.ok = False
+            elif kind == cindex.CursorKind.BINARY_OPERATOR and _operator(node) == "=":
+                self.target(next(node.get_children()), "=")
+            elif kind == cindex.CursorKind.COMPOUND_ASSIGNMENT_OPERATOR:
+                self.target(next(node.get_children()), _operator(node))
+            elif kind == cindex.CursorKind.UNARY_OPERATOR:
+                tokens = _tokens(node)
+                op = next((t for t in (tokens[:1] + tokens[-1:]) if t in ("++", "--")), None)
+                if op:
+                    self.target(next(node.get_children()), op)
+            elif kind == cindex.CursorKind.CALL_EXPR:
+                if node.spelling in SIDE_EFFECTS:
+                    self.ok = False
+                elif node.spelling in ("operator=", "operator+=", "operator-=", "operator*="):
+                    children = [c for c in node.get_children() if _strip(c).spelling != node.spelling]
+                    if children:
+                        self.target(children[0], node.spelling[len("operator"):])
+            sub = _subscript(node) if kind in (cindex.CursorKind.ARRAY_SUBSCRIPT_EXPR,
+                                               cindex.CursorKind.CALL_EXPR) else None
+            if sub is not None:
+                reads.setdefault(sub[1], set()).add(" ".join(_tokens(sub[2])))
+
+        # A reduction variable must not be read anywhere but in its updates
+        for var, updates in self.sites.values():
+            uses = sum(1 for n in self.body.walk_preorder()
+                       if n.kind == cindex.CursorKind.DECL_REF_EXPR and n.referenced == var)
+            if uses > updates:
+                self.ok = False
+        # a[i] = a[i - 1] ...: an element written and read at another index is loop-carried
+        for base, indices in self.writes.items():
+            if reads.get(base, set()) - indices:
+                self.ok = False
+        return self.ok and self.work
+
+
+def _small_trip_count(cond):
+    tokens = _tokens(cond) if cond is not None else []
+    return bool(tokens) and tokens[-1].isdigit() and int(tokens[-1]) < MIN_TRIP_COUNT
+
+
+def _for_parts(loop):
+    """(loop variable, condition, body) of a counted for (int i = ...; ...; ...), else None."""
+    children = list(loop.get_children())
+    if len(children) < 3 or children[0].kind != cindex.CursorKind.DECL_STMT:
+        return None
+    decls = list(children[0].get_children())
+    if len(decls) != 1 or decls[0].kind != cindex.CursorKind.VAR_DECL \
+            or decls[0].type.get_canonical().kind not in SCALAR_TYPES:
+        return None
+    return decls[0], children[1] if len(children) == 4 else None, children[-1]
+
+
+def _nested(body):
+    return any(n.kind in (cindex.CursorKind.FOR_STMT, cindex.CursorKind.WHILE_STMT, cindex.CursorKind.DO_STMT,
+                          cindex.CursorKind.CXX_FOR_RANGE_STMT) for n in body.walk_preorder())
+
+
+def scan_parallel_loops(cursor, name, path, item):
+    """Findings (rule "parallel_loop", same fields as antipatterns.scan_function) for the outermost loops
+    of a function definition whose iterations look independent."""
+    findings = []
+
+    def report(node, loop, var, body, fix):
+        reductions = ", ".join(sorted(f"{op}:{v}" for v, ops in loop.reductions.items() for op in ops))
+        clause = f" reduction({reductions})" if reductions else ""
+        findings.append({
+            "rule": "parallel_loop",
+            "severity": "high" if _nested(body) else "medium",
+            "message": f"the loop over '{var.spelling}' has independent iterations"
+                       + (f" (reduction {reductions})" if reductions else ""),
+            "fix": fix.format(clause=clause),
+            "function": name,
+            "item": item,
+            "file": path,
+            "line": node.location.line,
+            "name": var.spelling,
+        })
+
+    def walk(node):
+        for child in node.get_children():
+            if child.kind == cindex.CursorKind.LAMBDA_EXPR or child.kind.name.startswith("OMP_"):
+                continue
+            if child.kind == cindex.CursorKind.FOR_STMT:
+                parts = _for_parts(child)
+                if parts and not _small_trip_count(parts[1]):
+                    var, _, body = parts
+                    loop = _Loop(body, var, elementwise=False)
+                    if loop.check():
+                        report(child, loop, var, body, "parallelize it with #pragma omp parallel for{clause}")
+                        continue
+            elif child.kind == cindex.CursorKind.CXX_FOR_RANGE_STMT:
+                children = list(child.get_children())
+                if len(children) >= 3 and children[0].kind == cindex.CursorKind.VAR_DECL:
+                    var, body = children[0], children[-1]
+                    loop = _Loop(body, var, elementwise=var.type.kind == cindex.TypeKind.LVALUEREFERENCE)
+                    if loop.check():
+                        report(child, loop, var, body, "use std::for_each(std::execution::par_unseq, ...)"
+                               " or an index loop with #pragma omp parallel for{clause}")
+                        continue
+            walk(child)
+
+    walk(cursor)
+    return findings
@@ -0,0 +1,106 @@
+import os
+import threading
+from collections import OrderedDict
+from clang import cindex
+from clang.cindex import TranslationUnit
+
+# Long-lived libclang TranslationUnits, so a candidate can be re-analyzed by
+# reparsing only what it edited: TUs are kept with a precompiled preamble
+# (their leading #includes) and reparse() feeds edited files in as unsaved
+# files, which costs milliseconds instead of a full parse.
+MAX_UNITS = int(os.getenv("OPTIMIZER_PARSE_CACHE", "32"))
+PARSE_OPTIONS = (TranslationUnit.PARSE_DETAILED_PROCESSING_RECORD
+                 | TranslationUnit.PARSE_PRECOMPILED_PREAMBLE
+                 | TranslationUnit.PARSE_CACHE_COMPLETION_RESULTS)
+
+
+def _without_pch(args):
+    """args minus -include-pch <file>, which only makes a parse faster and doesn't change its result."""
+    kept, skip = [], False
+    for arg in args:
+        if skip:
+            skip = False
+        elif arg == "-include-pch":
+            skip = True
+        elif not arg.startswith("-include-pch="):
+            kept.append(arg)
+    return kept
+
+
+class _Unit:
+    def __init__(self, tu, args):
+        self.tu = tu
+        self.args = args
+        self.lock = threading.Lock()  # a TU must only be used by one thread at a time
+        self.includes = {os.path.normpath(i.include.name) for i in tu.get_includes()}
+
+
+class ParseService:
+    """TranslationUnits by main file path, least recently used evicted beyond max_units."""
+
+    def __init__(self, max_units=MAX_UNITS):
+        self.max_units = max_units
+        self._index = None
+        self._units = OrderedDict()
+        self._lock = threading.Lock()
+
+    def _get(self, path):
+        with self._lock:
+            if self._index is None:
+                self._index = cindex.Index.create()
+            unit = self._units.get(path)
+            if unit:
+                self._units.move_to_end(path)
+            return unit
+
+    def _put(self, path, unit):
+        with self._lock:
+            self._units[path] = unit
+            self._units.move_to_end(path)
+            while len(self._units) > self.max_units:
+                self._units.popitem(last=False)
+
+    def parse(self, path, args, unsaved=None, use=None):
+        """Parse path (reparsing a kept TU built with the same args), then call use(tu) under its lock.
+
+        unsaved is {path: text} of files whose contents differ from disk; a
+        TU only visits them if they are its main file or one of its includes.
+        Returns use's result (the TU itself if use is None, which is only
+        safe without concurrent parses of the same path).
+        """
+        path = os.path.normpath(path)
+        args = list(args)
+        files = [(p, text) for p, text in (unsaved or {}).items()]
+        unit = self._get(path)
+        # Kept TUs come from the PCH-backed baseline parse, candidates are parsed without it
+        if unit is None or unit.args != _without_pch(args):
+            tu = self._index.parse(path, args=args, unsaved_files=files, options=PARSE_OPTIONS)
+            unit = _Unit(tu, _without_pch(args))
+            self._put(path, unit)
+            with unit.lock:
+                return use(unit.tu) if use else unit.tu
+        with unit.lock:
+            unit.tu.reparse(unsaved_files=files)
+            return use(unit.tu) if use else unit.tu
+
+    def depends_on(self, path, files):
+        """Whether the kept TU of path includes any of files (True if it isn't kept)."""
+        unit = self._get(os.path.normpath(path))
+        if unit is None:
+            return True
+        return os.path.normpath(path) in files or bool(unit.includes & set(files))
+
+    def discard(self, root):
+        """Drop the TUs of files under root (a finished job's directory)."""
+        root = os.path.normpath(root) + os.sep
+        with self._lock:
+            for path in [p for p in self._units if p.startswith(root)]:
+                del self._units[path]
+
+
+PARSER = ParseService()
+
+
+def error_messages(tu):
+    """Spellings of the errors libclang reports for tu."""
+    return {d.spelling for d in tu.diagnostics if d.severity >= 3}
@@ -0,0 +1,79 @@
+import difflib
+import re
+
+# Unified diffs for single code items (a function body, a class definition):
+# the prompt sends what changed as diffs, and the model may answer in the
+# same form instead of repeating whole bodies.
+
+_HUNK = re.compile(r"^@@ -(\d+)(?:,\d+)? \+\d+(?:,\d+)? @@")
+
+
+def make_diff(old, new, name):
+    """Unified diff between two versions of one item ('' if they are equal)."""
+    lines = difflib.unified_diff(old.splitlines(), new.splitlines(), f"a/{name}", f"b/{name}", n=2, lineterm="")
+    return "\n".join(lines)
+
+
+def _hunks(diff):
+    """[(old start line or None, old lines, new lines)] of a unified diff."""
+    hunks, current = [], None
+    lines = diff.splitlines()
+    header = False
+    for i, line in enumerate(lines):
+        m = _HUNK.match(line)
+        # File header: only a ---/+++ pair right before an @@ line; otherwise "---x;" removes "--x;"
+        if current is None and line.startswith("---") and i + 2 < len(lines) \
+                and lines[i + 1].startswith("+++") and _HUNK.match(lines[i + 2]):
+            header = True
+            continue
+        if header:
+            header = False
+            continue
+        if m:
+            current = (int(m.group(1)) - 1, [], [])
+            hunks.append(current)
+        elif line.startswith("\\"):
+            continue
+        else:
+            if current is None:
+                # Hunk header missing (common in model output): treat as one hunk
+                current = (None, [], [])
+                hunks.append(current)
+            tag, text = (line[:1], line[1:]) if line[:1] in " +-" else (" ", line)
+            if tag in " -":
+                current[1].append(text)
+            if tag in " +":
+                current[2].append(text)
+    return hunks
+
+
+def _find(lines, block, hint, normalize):
+    """Index where block occurs in lines, closest to hint; None if absent."""
+    if not block:
+        return hint if hint is not None else len(lines)
+    key = [normalize(l) for l in block]
+    hits = [i for i in range(len(lines) - len(block) + 1)
+            if [normalize(l) for l in lines[i:i + len(block)]] == key]
+    if not hits:
+        return None
+    return min(hits, key=lambda i: abs(i - hint)) if hint is not None else hits[0]
+
+
+def apply_diff(text, diff):
+    """Apply a unified diff to text, locating hunks by content (line numbers are only a hint).
+
+    Raises ValueError when a hunk's context can't be found.
+    """
+    lines = text.splitlines()
+    offset = 0
+    for start, old, new in _hunks(diff):
+        hint = start + offset if start is not None else None
+        at = _find(lines, old, hint, lambda l: l)
+        if at is None:
+            # Models often get indentation or trailing spaces slightly wrong
+            at = _find(lines, old, hint, lambda l: " ".join(l.split()))
+        if at is None:
+            raise ValueError(f"diff context not found: {old[:1]}")
+        lines[at:at + len(old)] = new
+        offset += len(new) - len(old)
+    return "\n".join(lines)
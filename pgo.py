@@ -0,0 +1,207 @@
+import glob
+import os
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+from utils import benchmark_project, compile_project, compile_flags
+from workloads import run_workloads
+from benchmark import run_once, run_benchmark, is_significant_improvement, format_stats, \
+    DEFAULT_TIMEOUT, DEFAULT_WARMUP, DEFAULT_REPETITIONS
+from correctness import outputs_match
+
+# Profile-guided build pipeline: instrumented build -> training run on the
+# user's workload -> rebuild with the profile (clang IR PGO), then optionally
+# a BOLT post-link pass trained the same way. Every stage is benchmarked and
+# checked against the baseline's output like any other candidate.
+USE_BOLT = os.getenv("OPTIMIZER_BOLT", "1") != "0"
+BOLT_OPTIONS = ["-reorder-blocks=ext-tsp", "-reorder-functions=hfsort", "-split-functions",
+                "-split-all-cold", "-split-eh", "-dyno-stats"]
+
+
+def find_tool(name):
+    """Path of an LLVM tool, from PATH or (on macOS) xcrun; None if unavailable."""
+    path = shutil.which(name)
+    if path:
+        return path
+    if sys.platform == "darwin" and shutil.which("xcrun"):
+        result = subprocess.run(["xcrun", "-f", name], capture_output=True, text=True)
+        if result.returncode == 0:
+            return result.stdout.strip()
+    return None
+
+
+def _train(cmd, cwd, env):
+    """Run the training workload once; True if it exited cleanly."""
+    try:
+        result = run_once(cmd, timeout=DEFAULT_TIMEOUT * 4, cwd=cwd, env=env)
+    except subprocess.TimeoutExpired:
+        print("⚠️  Training run timed out")
+        return False
+    if result["returncode"] != 0:
+        print(f"⚠️  Training run exited with {result['returncode']}")
+        return False
+    return True
+
+
+def _stage(name, stats, best_stats, baseline_stats, float_tolerance):
+    """Stage record: timing, speedup over the baseline and whether it beat the best so far."""
+    record = {"stage": name, "median": stats["median"] if stats else None, "speedup": None,
+              "accepted": False, "reason": None}
+    if stats is None:
+        record["reason"] = "build or run failed"
+        return record
+    if baseline_stats:
+        record["speedup"] = round(baseline_stats["median"] / stats["median"], 3) if stats["median"] else None
+    ok, reason = outputs_match(baseline_stats.get("output") if baseline_stats else None, stats.get("output"),
+                               float_tolerance)
+    if not ok:
+        record["reason"] = f"output differs: {reason}"
+    elif not is_significant_improvement(best_stats, stats):
+        record["reason"] = "no significant improvement"
+    else:
+        record["accepted"] = True
+    print(f"    {name}: {format_stats(stats)} -> {'kept' if record['accepted'] else record['reason']}")
+    return record
+
+
+def _profile_instr(filepaths, run_args, clang_args, cwd, workdir):
+    """Instrumented build + training run, returning the merged .profdata path (or None)."""
+    profdata_tool = find_tool("llvm-profdata")
+    if not profdata_tool:
+        print("⚠️  llvm-profdata not found, skipping PGO")
+        return None
+
+    exe = os.path.join(workdir, "instrumented_bin")
+    if not compile_project(filepaths, exe, list(clang_args or []) + ["-fprofile-instr-generate"]):
+        return None
+    env = dict(os.environ, LLVM_PROFILE_FILE=os.path.join(workdir, "train-%p.profraw"))
+    if not _train([exe] + (run_args or []), cwd, env):
+        return None
+
+    raw = glob.glob(os.path.join(workdir, "train-*.profraw"))
+    profdata = os.path.join(workdir, "merged.profdata")
+    if not raw or subprocess.run([profdata_tool, "merge", "-output=" + profdata] + raw,
+                                 capture_output=True).returncode != 0:
+        print("⚠️  Could not merge the training profile")
+        return None
+    return profdata
+
+
+def _bolt(exe, run_args, cwd, workdir):
+    """Instrument exe with BOLT and train it, returning (optimized binary, .fdata) paths or (None, None)."""
+    bolt = find_tool("llvm-bolt")
+    fdata = os.path.join(workdir, "bolt.fdata")
+    instrumented = exe + ".inst"
+    if subprocess.run([bolt, exe, "-instrument", f"--instrumentation-file={fdata}", "-o", instrumented],
+                      capture_output=True).returncode != 0:
+        print("⚠️  BOLT instrumentation failed")
+        return None, None
+    if not _train([instrumented] + (run_args or []), cwd, None) or not os.path.exists(fdata):
+        return None, None
+
+    optimized = exe + ".bolt"
+    if subprocess.run([bolt, exe, "-o", optimized, f"-data={fdata}"] + BOLT_OPTIONS,
+                      capture_output=True).returncode != 0:
+        print("⚠️  BOLT optimization failed")
+        return None, None
+    return optimized, fdata
+
+
+def build_recipe(sources, flags, run_args, pgo, bolt):
+    """Shell commands that reproduce the winning build outside the optimizer."""
+    base = "clang++ " + " ".join(shlex.quote(f) for f in compile_flags(flags))
+    srcs = " ".join(shlex.quote(s) for s in sources)
+    args = " ".join(shlex.quote(a) for a in run_args or [])
+    recipe = []
+    if pgo:
+        recipe += [
+            f"{base} -fprofile-instr-generate {srcs} -o app_instrumented",
+            f"LLVM_PROFILE_FILE=train-%p.profraw ./app_instrumented {args}".rstrip(),
+            "llvm-profdata merge -output=merged.profdata train-*.profraw",
+        ]
+    use = " -fprofile-instr-use=merged.profdata" if pgo else ""
+    relocs = " -Wl,--emit-relocs" if bolt else ""
+    recipe.append(f"{base}{use}{relocs} {srcs} -o app")
+    if bolt:
+        recipe += [
+            "llvm-bolt app -instrument --instrumentation-file=bolt.fdata -o app.inst",
+            f"./app.inst {args}".rstrip(),
+            f"llvm-bolt app -o app.bolt -data=bolt.fdata {' '.join(BOLT_OPTIONS)}",
+        ]
+    return recipe
+
+
+def pgo_pipeline(filepaths, run_args=None, clang_args=None, baseline_stats=None, start_stats=None,
+                 warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, build_root=None, cwd=None,
+                 output_files=None, float_tolerance=0.0, use_bolt=USE_BOLT, recipe_sources=None,
+                 recipe_flags=None, progress=None, workloads=None):
+    """Build filepaths with PGO (and BOLT), measuring each stage.
+
+    start_stats is the plain build of filepaths; stages must beat it (and the
+    best stage before them) significantly. Returns {"stages", "stats",
+    "recipe", "artifacts"}; artifacts maps file names (merged.profdata,
+    bolt.fdata) to their bytes, so they outlive build_root.
+    Training runs use run_args; stages are measured on the workload matrix,
+    if given (see workloads.py).
+    """
+    workdir = tempfile.mkdtemp(prefix="cppopt_pgo_", dir=build_root)
+    best_stats = start_stats
+    stages, artifacts = [], {}
+    used_pgo = used_bolt = False
+    try:
+        print("\n📈 PGO: instrumented build and training run...")
+        if progress:
+            progress({"stage": "pgo", "step": "train"})
+        pgo_flags = []
+        profdata = _profile_instr(filepaths, run_args, clang_args, cwd, workdir)
+        if profdata:
+            pgo_flags = [f"-fprofile-instr-use={profdata}"]
+            build_dir = tempfile.mkdtemp(prefix="pgo_", dir=workdir)
+            stats = benchmark_project(filepaths, run_args=run_args, clang_args=list(clang_args or []) + pgo_flags,
+                                      warmup=warmup, repetitions=repetitions, build_dir=build_dir, cwd=cwd,
+                                      output_files=output_files, workloads=workloads)
+            stage = _stage("pgo", stats, best_stats, baseline_stats, float_tolerance)
+            stages.append(stage)
+            if stage["accepted"]:
+                best_stats, used_pgo = stats, True
+                with open(profdata, "rb") as f:
+                    artifacts["merged.profdata"] = f.read()
+            else:
+                pgo_flags = []
+        else:
+            stages.append({"stage": "pgo", "median": None, "speedup": None, "accepted": False,
+                           "reason": "instrumented build or training failed"})
+
+        # BOLT rewrites the linked binary; it needs relocations and ELF, i.e. Linux
+        if use_bolt and not (sys.platform.startswith("linux") and find_tool("llvm-bolt")):
+            print("ℹ️  llvm-bolt not available, skipping BOLT")
+        elif use_bolt:
+            if progress:
+                progress({"stage": "pgo", "step": "bolt"})
+            exe = os.path.join(workdir, "bolt_input")
+            stats = None
+            if compile_project(filepaths, exe, list(clang_args or []) + pgo_flags + ["-Wl,--emit-relocs"]):
+                optimized, fdata = _bolt(exe, run_args, cwd, workdir)
+                if optimized and workloads:
+                    stats = run_workloads(optimized, workloads, warmup=warmup, repetitions=repetitions, cwd=cwd,
+                                          output_files=output_files)
+                elif optimized:
+                    stats = run_benchmark([optimized] + (run_args or []), warmup=warmup, repetitions=repetitions,
+                                          cwd=cwd, output_files=output_files)
+            stage = _stage("bolt", stats, best_stats, baseline_stats, float_tolerance)
+            stages.append(stage)
+            if stage["accepted"]:
+                best_stats, used_bolt = stats, True
+                with open(fdata, "rb") as f:
+                    artifacts["bolt.fdata"] = f.read()
+
+        recipe = build_recipe(recipe_sources or [os.path.basename(f) for f in filepaths],
+                              recipe_flags or [], run_args, used_pgo, used_bolt)
+        if progress:
+            progress({"stage": "pgo_done", "stages": stages,
+                      "time": best_stats["median"] if best_stats else None})
+        return {"stages": stages, "stats": best_stats, "recipe": recipe, "artifacts": artifacts}
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
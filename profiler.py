@@ -0,0 +1,295 @@
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+from utils import compile_project, get_code
+from benchmark import run_once, DEFAULT_TIMEOUT
+
+# Hot functions (and their callees) shown to the LLM instead of the whole project
+DEFAULT_TOP_K = 5
+# Sampling frequency for perf record (Hz)
+PERF_FREQUENCY = 999
+
+# Fallback when perf is unavailable: -finstrument-functions hooks that keep
+# per-function self/inclusive time and dump it at exit. Built as C, and never
+# instrumented itself.
+INSTRUMENT_RUNTIME = r"""
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NI __attribute__((no_instrument_function))
+#define SLOTS 65536
+#define DEPTH 4096
+
+typedef struct { uintptr_t fn; uint64_t self_ns, total_ns, calls; } slot_t;
+typedef struct { uintptr_t fn; uint64_t start, child; } frame_t;
+
+static slot_t table[SLOTS];
+static __thread frame_t stack[DEPTH];
+static __thread int depth;
+
+static NI uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static NI slot_t *lookup(uintptr_t fn) {
+    size_t i = (fn >> 4) & (SLOTS - 1);
+    for (size_t n = 0; n < SLOTS; n++, i = (i + 1) & (SLOTS - 1)) {
+        uintptr_t cur = __atomic_load_n(&table[i].fn, __ATOMIC_ACQUIRE);
+        if (cur == fn) return &table[i];
+        if (cur == 0) {
+            uintptr_t expected = 0;
+            if (__atomic_compare_exchange_n(&table[i].fn, &expected, fn, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+                || expected == fn)
+                return &table[i];
+        }
+    }
+    return NULL;
+}
+
+NI void __cyg_profile_func_enter(void *fn, void *site) {
+    (void)site;
+    if (depth < DEPTH) {
+        stack[depth].fn = (uintptr_t)fn;
+        stack[depth].start = now();
+        stack[depth].child = 0;
+    }
+    depth++;
+}
+
+NI void __cyg_profile_func_exit(void *fn, void *site) {
+    (void)fn; (void)site;
+    if (--depth >= DEPTH || depth < 0) return;
+    frame_t *f = &stack[depth];
+    uint64_t total = now() - f->start;
+    slot_t *s = lookup(f->fn);
+    if (s) {
+        __atomic_fetch_add(&s->total_ns, total, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->self_ns, total - f->child, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    }
+    if (depth > 0) stack[depth - 1].child += total;
+}
+
+/* One line per function: symbol-or-offset self_ns total_ns calls */
+NI __attribute__((destructor)) static void dump(void) {
+    const char *path = getenv("OPTIMIZER_PROFILE_OUT");
+    FILE *out = path ? fopen(path, "w") : NULL;
+    if (!out) return;
+    for (size_t i = 0; i < SLOTS; i++) {
+        if (!table[i].fn) continue;
+        Dl_info info = {0};
+        int found = dladdr((void *)table[i].fn, &info);
+        if (found && info.dli_sname && (uintptr_t)info.dli_saddr == table[i].fn)
+            fprintf(out, "%s", info.dli_sname);
+        else
+            fprintf(out, "0x%lx", (unsigned long)(table[i].fn - (found ? (uintptr_t)info.dli_fbase : 0)));
+        fprintf(out, " %llu %llu %llu\n", (unsigned long long)table[i].self_ns,
+                (unsigned long long)table[i].total_ns, (unsigned long long)table[i].calls);
+    }
+    fclose(out);
+}
+"""
+
+
+def _perf_profile(exe, run_args, cwd, workdir):
+    """Sample the program with perf, returning [(symbol, self_pct, total_pct)] or None."""
+    if not shutil.which("perf"):
+        return None
+    data = os.path.join(workdir, "perf.data")
+    record = ["perf", "record", "-F", str(PERF_FREQUENCY), "-g", "-o", data, "--", exe] + (run_args or [])
+    # The program under perf is a candidate like any other: same limits as a benchmark run
+    try:
+        result = run_once(record, timeout=DEFAULT_TIMEOUT * 2, cwd=cwd)
+    except subprocess.TimeoutExpired:
+        return None
+    if result["returncode"] != 0 or not os.path.exists(data):
+        return None
+
+    report = subprocess.run(
+        ["perf", "report", "-i", data, "--stdio", "--children", "--sort", "symbol", "-g", "none",
+         "--percent-limit", "0.1"],
+        capture_output=True, text=True
+    )
+    rows = []
+    # "    45.10%    12.30%  [.] Grid::step(int)" -- children (inclusive), self, symbol
+    for line in report.stdout.splitlines():
+        m = re.match(r"^\s*([\d.]+)%\s+([\d.]+)%\s+\[\.\]\s+(.+?)\s*$", line)
+        if m:
+            rows.append((m.group(3), float(m.group(2)), float(m.group(1))))
+    return rows or None
+
+
+def _demangle(names):
+    """Demangle a batch of symbols with c++filt (names unchanged if it is missing)."""
+    if not names or not shutil.which("c++filt"):
+        return names
+    result = subprocess.run(["c++filt"], input="\n".join(names), capture_output=True, text=True)
+    out = result.stdout.splitlines()
+    return out if len(out) == len(names) else names
+
+
+def _symbol_offsets(exe):
+    """Map of code offsets to demangled symbol names, from nm."""
+    result = subprocess.run(["nm", "-C", "--defined-only", exe], capture_output=True, text=True)
+    offsets = {}
+    for line in result.stdout.splitlines():
+        parts = line.split(" ", 2)
+        if len(parts) == 3 and parts[1] in "tTwW":
+            offsets[int(parts[0], 16)] = parts[2]
+    return offsets
+
+
+def _instrumented_profile(filepaths, run_args, clang_args, cwd, workdir):
+    """Profile with -finstrument-functions, returning [(symbol, self_pct, total_pct)] or None."""
+    runtime_src = os.path.join(workdir, "cppopt_instrument.c")
+    runtime_obj = os.path.join(workdir, "cppopt_instrument.o")
+    with open(runtime_src, "w") as f:
+        f.write(INSTRUMENT_RUNTIME)
+    if subprocess.run(["clang++", "-x", "c", "-O2", "-fPIC", "-c", runtime_src, "-o", runtime_obj],
+                      capture_output=True).returncode != 0:
+        return None
+
+    exe = os.path.join(workdir, "profiled_bin")
+    flags = list(clang_args or []) + ["-finstrument-functions", "-fPIE", "-pie", runtime_obj, "-ldl"]
+    if not compile_project(filepaths, exe, flags):
+        return None
+
+    out = os.path.join(workdir, "profile.txt")
+    env = dict(os.environ, OPTIMIZER_PROFILE_OUT=out)
+    try:
+        result = run_once([exe] + (run_args or []), timeout=DEFAULT_TIMEOUT * 4, cwd=cwd, env=env)
+    except subprocess.TimeoutExpired:
+        return None
+    if result["returncode"] != 0 or not os.path.exists(out):
+        return None
+
+    raw = []
+    with open(out) as f:
+        for line in f:
+            sym, self_ns, total_ns, _ = line.split()
+            raw.append((sym, int(self_ns), int(total_ns)))
+    if not raw:
+        return None
+
+    # Resolve offsets through nm, demangle names reported by dladdr
+    offsets = _symbol_offsets(exe)
+    named = _demangle([s for s, _, _ in raw if not s.startswith("0x")])
+    names = iter(named)
+    grand_total = sum(self_ns for _, self_ns, _ in raw) or 1
+    rows = []
+    for sym, self_ns, total_ns in raw:
+        name = offsets.get(int(sym, 16), sym) if sym.startswith("0x") else next(names)
+        rows.append((name, 100.0 * self_ns / grand_total, 100.0 * total_ns / grand_total))
+    return rows
+
+
+def profile_project(filepaths, run_args=None, clang_args=None, build_dir=None, cwd=None):
+    """Rank functions by self time, with perf sampling or -finstrument-functions as a fallback.
+
+    Returns a list of {"symbol", "self_pct", "total_pct"} sorted hottest first, or None.
+    """
+    workdir = tempfile.mkdtemp(prefix="cppopt_profile_", dir=build_dir)
+    try:
+        # Frame pointers + debug info give perf usable call chains and symbols
+        exe = os.path.join(workdir, "sampled_bin")
+        rows = None
+        if compile_project(filepaths, exe, list(clang_args or []) + ["-g", "-fno-omit-frame-pointer"]):
+            rows = _perf_profile(exe, run_args, cwd, workdir)
+        if rows is None:
+            print("ℹ️  perf unavailable, profiling with -finstrument-functions")
+            rows = _instrumented_profile(filepaths, run_args, clang_args, cwd, workdir)
+        if rows is None:
+            print("⚠️  Profiling failed, sending the whole project to the AI")
+            return None
+
+        rows.sort(key=lambda r: r[1], reverse=True)
+        return [{"symbol": s, "self_pct": round(sp, 2), "total_pct": round(tp, 2)}
+                for s, sp, tp in rows if tp >= 0.1]
+    except Exception as e:
+        print(f"⚠️  Profiling error: {e}")
+        return None
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+def split_symbol(symbol):
+    """'ns::Grid::step(int) const' -> ['ns', 'Grid', 'step'] (template arguments stripped)."""
+    depth, name = 0, []
+    for ch in symbol:
+        if ch == "<":
+            depth += 1
+        elif ch == ">":
+            depth -= 1
+        elif ch == "(" and depth == 0:
+            break
+        elif depth == 0:
+            name.append(ch)
+    return [p for p in "".join(name).strip().split("::") if p]
+
+
+def match_symbol(symbol, code_json):
+    """Find the extracted item a profiled symbol belongs to: ("functions", name) or ("classes", class, method)."""
+    parts = split_symbol(symbol)
+    if not parts:
+        return None
+    classes = code_json.get("classes", {})
+    if len(parts) >= 2 and parts[-2] in classes:
+        return ("classes", parts[-2], parts[-1])
+    if parts[-1] in code_json.get("functions", {}):
+        return ("functions", parts[-1])
+    return None
+
+
+def _calls(code, names):
+    """Names from `names` that appear called in a code snippet."""
+    return {n for n in re.findall(r"\b(\w+)\s*\(", code) if n in names}
+
+
+def hot_subset(code_json, profile, top_k=DEFAULT_TOP_K):
+    """Reduce the code state to the top-K hot functions, their callees and the classes they touch."""
+    functions = code_json.get("functions", {})
+    classes = code_json.get("classes", {})
+    hot_funcs, hot_classes = set(), set()
+
+    for row in profile:
+        if len(hot_funcs) + len(hot_classes) >= top_k:
+            break
+        match = match_symbol(row["symbol"], code_json)
+        if match and match[0] == "functions":
+            hot_funcs.add(match[1])
+        elif match:
+            hot_classes.add(match[1])
+
+    if not hot_funcs and not hot_classes:
+        return None
+
+    # Direct callees of the hot code, so the model sees what the hot loops call
+    hot_code = [get_code(functions[f]) for f in hot_funcs]
+    hot_code += [get_code(classes[c]) for c in hot_classes]
+    for code in list(hot_code):
+        hot_funcs |= _calls(code, functions)
+
+    # Classes used by the selected functions
+    selected = "\n".join(get_code(functions[f]) for f in hot_funcs)
+    hot_classes |= {c for c in classes if re.search(rf"\b{re.escape(c)}\b", selected)}
+
+    subset = {k: v for k, v in code_json.items() if k not in ("functions", "classes", "diagnostics")}
+    subset["functions"] = {f: functions[f] for f in functions if f in hot_funcs}
+    subset["classes"] = {c: classes[c] for c in classes if c in hot_classes}
+    return subset
+
+
+def format_profile(profile, top_k=DEFAULT_TOP_K):
+    """Profile table for the prompt."""
+    lines = ["Profile (self% / inclusive%):"]
+    for row in profile[:top_k * 2]:
+        lines.append(f"  {row['self_pct']:6.2f}% / {row['total_pct']:6.2f}%  {row['symbol']}")
+    return "\n".join(lines)
@@ -0,0 +1,142 @@
+import os
+import re
+
+# Loop vectorizer remarks of clang (-Rpass*), so the model learns which of
+# its loops the compiler vectorized and why the others were not. Builds
+# parse them from the compiler's stderr with file paths relative to the
+# sources' directory (cached results stay valid in another sandbox); they
+# are attributed to the extracted functions by finding each item's code in
+# the compiled files.
+VECTORIZE_REMARKS = os.getenv("OPTIMIZER_REMARKS", "1") != "0"
+REMARK_FLAGS = ["-Rpass=loop-vectorize", "-Rpass-missed=loop-vectorize", "-Rpass-analysis=loop-vectorize"]
+MAX_PROMPT_REMARKS = 15
+
+REMARK_LINE = re.compile(r"^(.+?):(\d+):(\d+): remark: (.*?) \[-Rpass(|-missed|-analysis)=loop-vectorize\]\s*$")
+
+
+def source_root(filepaths):
+    """Directory remark paths are relative to."""
+    dirs = [os.path.dirname(os.path.abspath(fp)) for fp in filepaths]
+    return os.path.commonpath(dirs) if dirs else os.getcwd()
+
+
+def parse_remarks(stderr, filepaths):
+    """Vectorizer remarks in compiler output: list of {"file", "line", "col", "status", "detail"}.
+
+    A missed remark and the analysis remarks at the same loop are merged,
+    the analysis giving the reason.
+    """
+    root = source_root(filepaths)
+    loops = {}
+    for line in stderr.splitlines():
+        m = REMARK_LINE.match(line)
+        if not m:
+            continue
+        path, lineno, col, message, kind = m.groups()
+        path = os.path.abspath(path)
+        if path.startswith(root + os.sep):
+            path = os.path.relpath(path, root)
+        loop = loops.setdefault((path, int(lineno), int(col)), {
+            "file": path, "line": int(lineno), "col": int(col), "status": "not vectorized", "detail": []})
+        if kind == "":
+            loop["status"] = "vectorized"
+            loop["detail"] = [message.replace("vectorized loop", "").strip(" ()")]
+        elif kind == "-analysis" and loop["status"] != "vectorized":
+            reason = message.split(":", 1)[1].strip() if ":" in message else message
+            if reason not in loop["detail"]:
+                loop["detail"].append(reason)
+    return [{**loop, "detail": "; ".join(d for d in loop["detail"] if d)} for loop in loops.values()]
+
+
+def _code(item):
+    # utils.get_code, which can't be imported here: utils builds with these remarks
+    return item if isinstance(item, str) else item.get("code", item.get("definition", ""))
+
+
+def _item_spans(code_json):
+    """(item, function, code) of every function, class and method of a code state."""
+    for name, code in code_json.get("functions", {}).items():
+        yield f"functions/{name}", name, _code(code)
+    for name, data in code_json.get("classes", {}).items():
+        yield f"classes/{name}", name, _code(data)
+        for method, code in (data.get("methods", {}) if isinstance(data, dict) else {}).items():
+            yield f"classes/{name}", f"{name}::{method}", _code(code)
+
+
+def attribute_remarks(remarks, code_json, filepaths):
+    """Remarks that fall inside an extracted item, with "item", "function" and the line within its code.
+
+    filepaths are the files that were compiled; remarks already attributed
+    are kept as they are.
+    """
+    if not remarks:
+        return remarks
+    root = source_root(filepaths)
+    sources = [fp for fp in filepaths if fp.endswith((".cpp", ".cc", ".c", ".cxx"))]
+    texts, attributed = {}, []
+    for remark in remarks:
+        if "item" in remark:
+            attributed.append(remark)
+            continue
+        path = remark["file"] if os.path.isabs(remark["file"]) else os.path.join(root, remark["file"])
+        if not os.path.exists(path) and len(sources) == 1:
+            # A combined TU under another candidate's name (cached result)
+            path = sources[0]
+        if path not in texts:
+            try:
+                with open(path, errors="replace") as f:
+                    texts[path] = f.read()
+            except OSError:
+                texts[path] = ""
+        text = texts[path]
+
+        best = None
+        for item, function, code in _item_spans(code_json):
+            code = code.strip()
+            pos = text.find(code) if code else -1
+            if pos < 0:
+                continue
+            first = text.count("\n", 0, pos) + 1
+            last = first + code.count("\n")
+            if first <= remark["line"] <= last and (best is None or last - first < best[1] - best[0]):
+                best = (first, last, item, function)
+        if best:
+            attributed.append({**remark, "item": best[2], "function": best[3],
+                               "function_line": remark["line"] - best[0] + 1})
+    return attributed
+
+
+def _describe(remark):
+    where = f"loop at {remark['function']} line {remark['function_line']} ({os.path.basename(remark['file'])}:{remark['line']})"
+    if remark["status"] == "vectorized":
+        return f"{where} vectorized" + (f" ({remark['detail']})" if remark["detail"] else "")
+    return f"{where} not vectorized" + (f": {remark['detail']}" if remark["detail"] else "")
+
+
+def format_remarks(remarks, items=None, limit=MAX_PROMPT_REMARKS):
+    """Prompt lines for attributed remarks (within items, if given), loops that weren't vectorized first."""
+    shown = [r for r in remarks or [] if "item" in r and (items is None or r["item"] in items)]
+    shown.sort(key=lambda r: (r["status"] == "vectorized", r["function"], r["function_line"]))
+    return "\n".join(f"- {_describe(r)}" for r in shown[:limit])
+
+
+def vectorized_counts(remarks):
+    """{function: (vectorized loops, loops not vectorized)}."""
+    counts = {}
+    for r in remarks or []:
+        if "item" in r:
+            done, missed = counts.get(r["function"], (0, 0))
+            counts[r["function"]] = (done + 1, missed) if r["status"] == "vectorized" else (done, missed + 1)
+    return counts
+
+
+def remark_changes(before, after):
+    """Sentence on how a candidate changed vectorization per function ('' when it didn't)."""
+    old, new = vectorized_counts(before), vectorized_counts(after)
+    changes = []
+    for function in sorted(set(old) | set(new)):
+        if old.get(function, (0, 0))[0] != new.get(function, (0, 0))[0]:
+            changes.append(f"{function} {old.get(function, (0, 0))[0]} -> {new.get(function, (0, 0))[0]}")
+    if not changes:
+        return ""
+    return f"Vectorized loops: {', '.join(changes)}."
@@ -0,0 +1,398 @@
+import copy
+import re
+from utils import get_code
+from feedback import evaluate_candidate, flat_state, candidate_errors, sanitizer_failure, PARSE_CHECK
+from benchmark import format_stats
+from correctness import outputs_match
+from objectives import improves
+from sanitize import SANITIZE_CANDIDATES
+from microbench import split_top_level
+
+# Mechanical source rewrites tried before the AI loop. Each one is a text
+# edit of the extracted free functions, mostly at the sites the static
+# analyzer (antipatterns.py) reported; it is applied to every site at once,
+# built, checked against the baseline's output and kept only if it improves
+# the objectives over the best state so far. Rewrites that are accepted
+# stack, like flag tuning, and the AI loop starts from the result.
+
+# Members that change a container, so its parameter can't become const&
+MUTATORS = ("push_back", "emplace_back", "pop_back", "insert", "emplace", "erase", "clear", "resize",
+            "assign", "swap", "reserve", "shrink_to_fit", "push_front", "pop_front", "append", "sort",
+            "splice", "merge", "remove", "remove_if", "unique", "reverse")
+# Library calls that only read their arguments, so passing a parameter keeps it const
+READ_ONLY_CALLS = ("printf", "fprintf", "sprintf", "snprintf", "max", "min", "abs", "fabs", "sqrt", "to_string")
+# C stdio calls whose order against std::cout would change without sync_with_stdio
+C_STDIO = re.compile(r"\b(printf|puts|putchar|fputs|fprintf|fwrite|scanf|getchar|fgets|fread|fscanf|gets)\s*\(")
+IOSTREAM = re.compile(r"\b(?:std::)?(cin|cout)\b")
+ENDL = re.compile(r"<<\s*(?:std::)?endl\b")
+# for (int i = 0; i < n; ++i) with a side-effect-free bound
+COUNTED_LOOP = re.compile(r"\bfor\s*\(\s*(?:(?:unsigned|signed|const)\s+)*(?:int|long|long\s+long|short|unsigned|"
+                          r"size_t|std::size_t|u?int(?:32|64)_t|std::u?int(?:32|64)_t|auto)\s+(\w+)\s*=\s*0\s*;"
+                          r"\s*(\w+)\s*<\s*([\w\s.:+\-*/]+?(?:\.size\(\))?)\s*;\s*(?:\+\+\s*(\w+)|(\w+)\s*\+\+)\s*\)\s*\{")
+LOOP_KEYWORD = re.compile(r"\b(for|while|do)\b")
+SEQUENCE_DECL = re.compile(r"\b(?:std::)?(?:vector|deque|list)\s*<")
+MAKE_VALUE = re.compile(r"(std::make_pair|std::make_tuple|std::pair\s*<.*>|std::tuple\s*<.*>|std::string|"
+                        r"(?:\w+::)*[A-Z]\w*(?:\s*<.*>)?)\s*\(", re.S)
+
+
+def _matching(code, start, open_ch="(", close_ch=")"):
+    """Index of the bracket closing the one at start (skipping string and char literals), or -1."""
+    depth, i = 0, start
+    while i < len(code):
+        ch = code[i]
+        if ch in "\"'":
+            i += 1
+            while i < len(code) and code[i] != ch:
+                i += 2 if code[i] == "\\" else 1
+        elif ch == open_ch:
+            depth += 1
+        elif ch == close_ch:
+            depth -= 1
+            if depth == 0:
+                return i
+        i += 1
+    return -1
+
+
+def _body(code):
+    """Offsets of a function definition's {...} body, or None."""
+    head = code.find("(")
+    close = _matching(code, head) if head >= 0 else -1
+    start = code.find("{", close) if close >= 0 else -1
+    end = _matching(code, start, "{", "}") if start >= 0 else -1
+    return (start, end) if end > 0 else None
+
+
+def endl_to_newline(name, code, findings, state):
+    """std::endl -> '\\n' in functions with endl in a loop (stdout is flushed at exit anyway)."""
+    if not any(f["rule"] == "endl_in_loop" and f["item"] == f"functions/{name}" for f in findings):
+        return None
+    return ENDL.sub(lambda m: "<< '\\n'", code)
+
+
+def sync_stdio(name, code, findings, state):
+    """Untie C++ streams from C stdio at the top of a main that uses std::cin/std::cout."""
+    if name != "main" or not IOSTREAM.search(code) or "sync_with_stdio" in code:
+        return None
+    # Mixing printf and cout is only ordered while the streams stay synchronized
+    if any(C_STDIO.search(c) for c in state.values()):
+        return None
+    body = _body(code)
+    if body is None:
+        return None
+    indent = re.search(r"\n([ \t]+)\S", code[body[0]:])
+    indent = indent.group(1) if indent else "    "
+    lines = f"\n{indent}std::ios::sync_with_stdio(false);\n{indent}std::cin.tie(nullptr);"
+    return code[:body[0] + 1] + lines + code[body[0] + 1:]
+
+
+def _signature_params(code):
+    """Parameter declarations of a function definition."""
+    open_paren = code.find("(")
+    close_paren = _matching(code, open_paren) if open_paren >= 0 else -1
+    return split_top_level(code[open_paren + 1:close_paren]) if close_paren > 0 else []
+
+
+def _non_const_ref(decl):
+    """Whether a declaration binds a reference or pointer through which the target can be written."""
+    return bool(re.search(r"[&*]", decl)) and not re.match(r"\s*const\b", decl) \
+        and not re.search(r"\bconst\s*[&*]", decl)
+
+
+def _accessor_end(code, i):
+    """End of the [...] subscripts, .member / ->member accesses and calls following offset i."""
+    while True:
+        j = len(code) - len(code[i:].lstrip())
+        if code.startswith("[", j) or code.startswith("(", j):
+            close = _matching(code, j, code[j], "]" if code[j] == "[" else ")")
+            if close < 0:
+                return j
+            i = close + 1
+            continue
+        member = re.match(r"(?:\.|->)\s*\w+", code[j:])
+        if not member:
+            return j
+        i = j + member.end()
+
+
+def _modified(param, body, state):
+    """Whether body may write param or anything in it, or lets it escape to code that can.
+
+    Conservative on purpose: any assignment or increment through the name
+    (subscripted or not), a mutating member call, std::move, non-const
+    iterators, the address taken, a non-const reference or pointer bound to
+    it, or a call that may take it by non-const reference all count.
+    """
+    p = re.escape(param)
+    if re.search(rf"\b{p}\s*\.\s*(?:{'|'.join(MUTATORS)}|begin|end|rbegin|rend|data)\s*\(|"
+                 rf"std::move\s*\(\s*{p}\b", body):
+        return True
+    functions = {k.split("/", 1)[1]: c for k, c in state.items() if k.startswith("functions/")}
+    for m in re.finditer(rf"(?<![\w.])(?<!->)(?<!::){p}\b", body):
+        before = body[:m.start()].rstrip()
+        # ++p[i], &p, &p[i]; a binary & follows a name or a closing bracket
+        if before.endswith(("++", "--")) or \
+                before.endswith("&") and not before.endswith("&&") and not re.search(r"[\w)\]]\s*&$", before):
+            return True
+        end = _accessor_end(body, m.end())
+        if re.match(r"\s*(?:[-+*/%&|^]|<<|>>)?=(?!=)|\s*(?:\+\+|--)", body[end:]):
+            return True
+        # T& r = p[i];  T* q(p);  for (T& x : p)
+        bound = re.search(r"[&*]\s*(?:\w+|\[[^\]]*\])\s*(?:=|\(|\{|:)\s*$", before)
+        if bound:
+            statement = re.split(r"[;{}(,]", before[:bound.start() + 1])[-1]
+            if _non_const_ref(statement):
+                return True
+    # Passed to a call: only project functions taking it by value or const& are known safe
+    for call in re.finditer(r"\b(\w+)\s*\(", body):
+        if call.group(1) in ("if", "while", "for", "switch", "return", "sizeof", "catch") \
+                or call.group(1) in READ_ONLY_CALLS and call.group(1) not in functions:
+            continue
+        close = _matching(body, call.end() - 1)
+        args = split_top_level(body[call.end():close]) if close > 0 else []
+        for i, arg in enumerate(args):
+            if not re.fullmatch(rf"{p}\s*(?:\[.*\]\s*)*", arg, re.S):
+                continue
+            params = _signature_params(functions[call.group(1)]) if call.group(1) in functions else []
+            if i >= len(params) or _non_const_ref(params[i]):
+                return True
+    return False
+
+
+def const_ref_params(name, code, findings, state):
+    """Containers passed by value -> const&, for parameters the function doesn't modify."""
+    params = {f["name"] for f in findings
+              if f["rule"] == "container_by_value" and f["item"] == f"functions/{name}" and f.get("name")}
+    body = _body(code) if params else None
+    if body is None:
+        return None
+    open_paren = code.find("(")
+    close_paren = _matching(code, open_paren)
+    signature = split_top_level(code[open_paren + 1:close_paren])
+    body_text = code[body[0]:body[1]]
+    changed = False
+    for i, param in enumerate(signature):
+        decl = param.split("=")[0].strip()
+        m = re.fullmatch(r"(.+?)\s*\b(\w+)", decl, re.S)
+        if not m or m.group(2) not in params or re.search(r"[&*]", m.group(1)):
+            continue
+        if _modified(m.group(2), body_text, state):
+            continue
+        qualified = m.group(1) if m.group(1).startswith("const ") else f"const {m.group(1)}"
+        default = param[len(param.split("=")[0]):]
+        signature[i] = f"{qualified}& {m.group(2)}" + (f" {default}" if default else "")
+        changed = True
+    if not changed:
+        return None
+    return code[:open_paren + 1] + ", ".join(signature) + code[close_paren:]
+
+
+def _starts_statement(code, pos):
+    """Whether pos starts a statement of a {...} block: after a {, } or ; with only comments in between."""
+    before = code[:pos]
+    while True:
+        before = before.rstrip()
+        last_line = before[before.rfind("\n") + 1:]
+        if before.endswith("*/") and "/*" in before:
+            before = before[:before.rfind("/*")]
+        elif "//" in last_line and not re.search(r"[\"']", last_line.split("//")[0]):
+            before = before[:len(before) - len(last_line) + last_line.index("//")]
+        else:
+            return before.endswith(("{", "}", ";"))
+
+
+def reserve_before_loops(name, code, findings, state):
+    """reserve() ahead of counted loops that push_back once per iteration into a reported container."""
+    grown = {f["name"]: f["severity"] for f in findings
+             if f["rule"] == "push_back_without_reserve" and f["item"] == f"functions/{name}" and f.get("name")}
+    if not grown:
+        return None
+    loops = []
+    for m in COUNTED_LOOP.finditer(code):
+        var, cond_var, bound = m.group(1), m.group(2), m.group(3).strip()
+        if cond_var != var or (m.group(4) or m.group(5)) != var or re.search(rf"\b{var}\b", bound):
+            continue
+        end = _matching(code, m.end() - 1, "{", "}")
+        if end < 0:
+            continue
+        loops.append((m.start(), m.end(), end, bound))
+
+    inserts = []
+    for start, body_start, end, bound in loops:
+        body = code[body_start:end]
+        # A loop that is the braceless body of if/else/while would lose the
+        # condition to the inserted statement
+        if LOOP_KEYWORD.search(body) or not _starts_statement(code, start):
+            continue
+        for target, severity in sorted(grown.items()):
+            t = re.escape(target)
+            # One growth site in the whole function, reported at loop depth 1
+            # (so this loop is not nested): the trip count is the growth
+            if severity != "medium" or len(re.findall(rf"\b{t}\s*\.\s*(?:push_back|emplace_back)\s*\(", body)) != 1 \
+                    or len(re.findall(rf"\b{t}\s*\.\s*(?:push_back|emplace_back)\s*\(", code)) != 1 \
+                    or re.search(rf"\b{t}\b", bound):
+                continue
+            # Declared inside the loop: nothing to reserve ahead of it
+            if re.search(rf"[\w>&*]\s+{t}\s*[;({{=\[]", body):
+                continue
+            line_start = code.rfind("\n", 0, start) + 1
+            indent = re.match(r"[ \t]*", code[line_start:]).group(0)
+            inserts.append((start, f"if (({bound}) > 0) {target}.reserve({target}.size() + ({bound}));\n{indent}"))
+    if not inserts:
+        return None
+    for pos, text in sorted(inserts, reverse=True):
+        code = code[:pos] + text + code[pos:]
+    return code
+
+
+def _element_type(container, sources):
+    """Element type of the sequence container declared as container in sources, or None.
+
+    None as well when the name is declared with different element types.
+    """
+    types = set()
+    for text in sources:
+        for m in SEQUENCE_DECL.finditer(text):
+            close = _matching(text, m.end() - 1, "<", ">")
+            if close < 0 or not re.match(rf"\s*[&*]?\s*{re.escape(container)}\b", text[close + 1:]):
+                continue
+            args = split_top_level(text[m.end():close])
+            if args:
+                types.add(re.sub(r"\s+", "", args[0]))
+    return types.pop() if len(types) == 1 else None
+
+
+def emplace_back(name, code, findings, state):
+    """v.push_back(T(args)) / push_back(std::make_pair(a, b)) -> v.emplace_back(args).
+
+    Only where v is declared as a sequence of exactly T (a pair or tuple for
+    make_pair / make_tuple): emplace_back constructs the element type from
+    args, which for any other T would skip T's constructor and conversion.
+    """
+    classes = {k.split("/", 1)[1] for k in state if k.startswith("classes/")}
+    sources = [code] + list(state.values())
+    out, pos, changed = [], 0, False
+    for m in re.finditer(r"(\w+)\s*\.\s*push_back\s*\(", code):
+        if m.start() < pos:
+            continue
+        close = _matching(code, m.end() - 1)
+        if close < 0:
+            continue
+        arg = code[m.end():close].strip()
+        value = MAKE_VALUE.match(arg)
+        # A capitalized callee must be one of the project's classes, not a factory function
+        if value and value.group(1)[0].isupper() and re.sub(r"\s*<.*", "", value.group(1), flags=re.S) not in classes:
+            continue
+        if not value or _matching(arg, value.end() - 1) != len(arg) - 1:
+            continue
+        element = _element_type(m.group(1), sources)
+        made = re.sub(r"\s+", "", value.group(1))
+        family = {"std::make_pair": ("std::pair<", "pair<"), "std::make_tuple": ("std::tuple<", "tuple<")}.get(made)
+        if element is None or (not element.startswith(family) if family else element != made):
+            continue
+        out.append(code[pos:m.start()] + f"{m.group(1)}.emplace_back({arg[value.end():-1].strip()})")
+        pos = close + 1
+        changed = True
+    if not changed:
+        return None
+    return "".join(out) + code[pos:]
+
+
+# Tried in this order, each on top of the ones kept before it
+REWRITES = [
+    ("endl", "std::endl -> '\\n'", endl_to_newline),
+    ("sync_stdio", "std::ios::sync_with_stdio(false) in main", sync_stdio),
+    ("const_ref", "container parameters by const&", const_ref_params),
+    ("reserve", "reserve() before counted push_back loops", reserve_before_loops),
+    ("emplace_back", "push_back(T(...)) -> emplace_back(...)", emplace_back),
+]
+
+
+def apply_rewrite(rewrite, code_json, findings):
+    """(rewritten code state, changed function names) for one rewrite; (None, []) if nothing applies."""
+    state = flat_state(code_json)
+    result, changed = None, []
+    for fname, code in code_json.get("functions", {}).items():
+        new = rewrite(fname, get_code(code), findings, state)
+        if new is None or new.strip() == get_code(code).strip():
+            continue
+        if result is None:
+            result = copy.deepcopy(code_json)
+        result["functions"][fname] = new
+        changed.append(fname)
+    return result, changed
+
+
+def rewrite_prepass(original_json, start_stats, clang_args=None, run_args=None, work_dir=None, build_root=None,
+                    output_files=None, float_tolerance=0.0, layout=None, microbench=None, objectives=None,
+                    progress=None, workloads=None, sanitize=SANITIZE_CANDIDATES, parallelize=False):
+    """Try each of REWRITES on its own build and keep the ones that help.
+
+    A rewrite that helps must still pass the run's sanitizer gate (sanitize,
+    parallelize: see feedback.sanitizer_failure) before it is kept.
+    Returns {"json", "stats", "trials"}: the code state to continue from, its
+    statistics and one entry per rewrite that applied anywhere.
+    """
+    findings = original_json.get("findings", [])
+    objectives = objectives or {"time": 1.0}
+    best_json, best_stats = original_json, start_stats
+    trials = []
+    baseline_errors = None
+    if PARSE_CHECK:
+        try:
+            baseline_errors = candidate_errors(original_json, "rewrite_base", clang_args, layout, original_json,
+                                               build_root)
+        except Exception as e:
+            print(f"⚠️  Parse check unavailable: {e}")
+
+    for key, description, rewrite in REWRITES:
+        candidate, changed = apply_rewrite(rewrite, best_json, findings)
+        if candidate is None:
+            continue
+        print(f"\n🪄  Trying {description} in {', '.join(changed)}")
+        if progress:
+            progress({"stage": "rewrite", "rewrite": key, "functions": changed})
+
+        trial = {"rewrite": key, "functions": changed, "median": None, "accepted": False, "reason": None}
+        errors = None
+        if baseline_errors is not None:
+            try:
+                errors = candidate_errors(candidate, "rewrite", clang_args, layout, original_json,
+                                          build_root) - baseline_errors
+            except Exception:
+                errors = None
+        stats = None
+        if errors:
+            trial["reason"] = f"does not compile: {'; '.join(sorted(errors)[:3])}"
+        else:
+            stats = evaluate_candidate(candidate, f"rewrite_{key}", clang_args, run_args, work_dir=work_dir,
+                                       build_root=build_root, output_files=output_files, layout=layout,
+                                       original_json=original_json, microbench=microbench, workloads=workloads)
+            trial["median"] = stats["median"] if stats else None
+            if stats is None:
+                trial["reason"] = "build or run failed"
+            else:
+                ok, reason = outputs_match(start_stats.get("output") if start_stats else None,
+                                           stats.get("output"), float_tolerance)
+                if not ok:
+                    trial["reason"] = f"output differs: {reason}"
+                elif not improves(best_stats, stats, start_stats, objectives):
+                    trial["reason"] = "no significant improvement"
+                else:
+                    # Skipped for microbenchmarked runs, like the AI loop's gate
+                    failure = None if microbench else sanitizer_failure(
+                        candidate, f"rewrite_{key}", clang_args, run_args, work_dir, build_root, layout,
+                        original_json, output_files, sanitize, parallelize)
+                    if failure:
+                        trial["reason"] = " ".join(failure.splitlines()[:2])
+                    else:
+                        trial["accepted"] = True
+                        best_json, best_stats = candidate, stats
+
+        print(f"    {format_stats(stats)} -> {'kept' if trial['accepted'] else trial['reason']}")
+        trials.append(trial)
+
+    kept = [t["rewrite"] for t in trials if t["accepted"]]
+    if kept:
+        print(f"🪄  Kept rewrites: {', '.join(kept)}")
+    return {"json": best_json, "stats": best_stats, "trials": trials}
@@ -0,0 +1,113 @@
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+from utils import compile_project
+from benchmark import run_once, untimed_slot, DEFAULT_TIMEOUT
+from parallel import uses_parallelism
+
+# Sanitizer builds as a correctness gate: a candidate is built once more
+# with sanitizers and run on the primary workload; a report fails it. Rewrites
+# toward speed (raw pointers, dropped bounds checks, aliasing tricks) bring
+# in undefined behaviour that often happens to work at -O3. These builds run
+# next to the timed ones at the lowest priority and never hold a benchmark
+# core (see untimed_slot).
+SANITIZE_CANDIDATES = os.getenv("OPTIMIZER_SANITIZE", "1") != "0"
+SANITIZERS = {
+    "address": {
+        "flags": ["-g", "-fno-omit-frame-pointer", "-fsanitize=address,undefined",
+                  "-fno-sanitize-recover=undefined"],
+        # Leaks aren't undefined behaviour, and many programs never free at exit
+        "env": {"ASAN_OPTIONS": "halt_on_error=1:exitcode=66:detect_leaks=0",
+                "UBSAN_OPTIONS": "halt_on_error=1:exitcode=66:print_stacktrace=1"},
+        "name": "AddressSanitizer/UndefinedBehaviorSanitizer",
+    },
+    "thread": {
+        "flags": ["-g", "-fsanitize=thread"],
+        # The OpenMP and TBB runtimes aren't instrumented; their own synchronization would be reported
+        "env": {"TSAN_OPTIONS": "halt_on_error=1:exitcode=66:ignore_noninstrumented_modules=1"},
+        "name": "ThreadSanitizer",
+    },
+}
+SANITIZER_EXIT = 66
+# Instrumented programs run several times slower
+SANITIZER_TIMEOUT = DEFAULT_TIMEOUT * 10
+MAX_REPORT_LINES = 12
+
+REPORT_START = re.compile(r"^(WARNING|ERROR): \w+Sanitizer: |^SUMMARY: \w+Sanitizer: |: runtime error: ")
+PID_PREFIX = re.compile(r"^==\d+==")
+# "ERROR: AddressSanitizer: heap-buffer-overflow on ...", "f.cpp:3:5: runtime error: signed integer overflow: ..."
+ERROR_KIND = re.compile(r"Sanitizer: (.+?)(?: on | \(|$)|: runtime error: ([^:]+)", re.M)
+# "#0 0x4c51 in sum(int*) main.cpp:5:12" (ASan/UBSan), "#0 worker() main.cpp:4 (a.out+0x1)" (TSan)
+TOP_FRAME = re.compile(r"#\d+ (?:0x[0-9a-f]+ in )?(.+?) \S+:\d+")
+
+
+def candidate_sanitizers(code_json, sanitize=SANITIZE_CANDIDATES, race_check=False):
+    """Sanitizers (keys of SANITIZERS) a code state is checked with: ASan+UBSan if sanitize, and TSan
+    for code that uses threads if sanitize or race_check (parallelization mode's gate)."""
+    sanitizers = ["address"] if sanitize else []
+    if (sanitize or race_check) and uses_parallelism(code_json):
+        sanitizers.append("thread")
+    return sanitizers
+
+
+def _report(stderr):
+    """The first sanitizer report in stderr: its headline and top frames."""
+    lines = [PID_PREFIX.sub("", l) for l in stderr.splitlines()]
+    for i, line in enumerate(lines):
+        if REPORT_START.search(line):
+            return "\n".join(l for l in lines[i:i + MAX_REPORT_LINES] if l.strip() and not l.startswith("=="))
+    return None
+
+
+def report_signature(report):
+    """(error kind, function of the top stack frame) of a report; frames, unlike lines, survive edits."""
+    kind = ERROR_KIND.search(report or "")
+    frame = TOP_FRAME.search(report or "")
+    return (kind.group(1) or kind.group(2) if kind else None, frame.group(1) if frame else None)
+
+
+def new_report(baseline_report, report):
+    """Whether a candidate's report is a different error (kind or place) than the baseline's.
+
+    Reports halt the program, so a candidate that hits the baseline's error
+    first can't be checked past it.
+    """
+    return report_signature(report) != report_signature(baseline_report)
+
+
+def sanitizer_check(filepaths, sanitizer, clang_args=None, run_args=None, cwd=None, build_dir=None, env=None,
+                    output_files=None):
+    """Build with a sanitizer (a key of SANITIZERS) and run once, returning (verdict, report).
+
+    verdict is True for a clean run, False for a sanitizer report (report is
+    its text) and None if the check couldn't run (build failure, timeout).
+    """
+    config = SANITIZERS[sanitizer]
+    workdir = tempfile.mkdtemp(prefix=f"cppopt_{sanitizer}_", dir=build_dir)
+    try:
+        exe = os.path.join(workdir, f"{sanitizer}_bin")
+        if not compile_project(filepaths, exe, list(clang_args or []) + config["flags"]):
+            return None, f"{config['name']} build failed"
+        run_env = dict(env or os.environ)
+        for var, options in config["env"].items():
+            run_env[var] = ":".join(o for o in (run_env.get(var), options) if o)
+        try:
+            with untimed_slot(output_files) as cpus:
+                run = run_once([exe] + (run_args or []), timeout=SANITIZER_TIMEOUT, cwd=cwd, env=run_env,
+                               cpus=cpus, limit_address_space=False, background=True)
+        except subprocess.TimeoutExpired:
+            return None, f"{config['name']} run timed out"
+        report = _report(run["stderr"])
+        if report:
+            # Paths relative to the sources, as the model knows them
+            root = os.path.commonpath([os.path.dirname(os.path.abspath(fp)) for fp in filepaths])
+            report = report.replace(root + os.sep, "")
+        if report or run["returncode"] == SANITIZER_EXIT:
+            return False, report or f"{config['name']} reported an error"
+        if run["returncode"] != 0:
+            return None, f"{config['name']} run exited with {run['returncode']}: {run['limit'] or run['stderr'][-300:]}"
+        return True, None
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
@@ -0,0 +1,181 @@
+import copy
+import json
+import os
+from benchmark import is_significant_improvement
+
+# Search beyond greedy hill climbing. With a beam the loop keeps the
+# beam_width best correct code states (lineages) instead of only the best
+# one, and spreads each iteration's candidates over them, so a candidate
+# that only pays off after a second edit, or a lineage that lost to one
+# lucky sample, stays alive. Every candidate significantly faster than its
+# parent is kept in an edit pool (the items it changed, per function or
+# class); edits to different items, all made against the code the current
+# best still has, are independent and get combined into one more candidate
+# per iteration.
+# The best result itself is still only replaced on a significant improvement.
+DEFAULT_BEAM_WIDTH = int(os.getenv("OPTIMIZER_BEAM_WIDTH", "1"))
+# Stop after this many iterations without a new best (0 = never)
+DEFAULT_PATIENCE = int(os.getenv("OPTIMIZER_PATIENCE", "0"))
+MAX_COMBINED_EDITS = 6
+ITEM_KINDS = ("functions", "classes")
+
+
+def _key(value):
+    return json.dumps(value, sort_keys=True)
+
+
+def state_key(code_json):
+    """Identity of a code state's functions, classes and headers."""
+    return _key({k: code_json.get(k) for k in ITEM_KINDS + ("headers",)})
+
+
+def changed_items(parent_json, child_json):
+    """{(kind, name): child's entry} of the functions and classes child_json changed or added."""
+    changes = {}
+    for kind in ITEM_KINDS:
+        before = parent_json.get(kind, {})
+        for name, value in child_json.get(kind, {}).items():
+            if name not in before or _key(before[name]) != _key(value):
+                changes[(kind, name)] = value
+    return changes
+
+
+def record_edit(pool, parent_json, parent_stats, child_json, child_stats):
+    """Add a candidate significantly faster than its parent to the edit pool (a list, best speedup first).
+
+    A raw median difference would pool noise, which combine_edits then
+    spends builds on.
+    """
+    if not parent_stats or not is_significant_improvement(parent_stats, child_stats):
+        return
+    changes = changed_items(parent_json, child_json)
+    if not changes:
+        return
+    edit = {
+        "changes": changes,
+        # The parent's version of each item: the edit applies cleanly where the code still has it
+        "parents": {item: _key(parent_json.get(item[0], {}).get(item[1])) for item in changes},
+        "headers": sorted(set(child_json.get("headers", [])) - set(parent_json.get("headers", []))),
+        "speedup": parent_stats["median"] / child_stats["median"],
+    }
+    signature = _key(sorted((f"{k}/{n}", _key(v)) for (k, n), v in changes.items()))
+    if any(e["signature"] == signature for e in pool):
+        return
+    edit["signature"] = signature
+    pool.append(edit)
+    pool.sort(key=lambda e: -e["speedup"])
+
+
+def combine_edits(pool, base_json, limit=MAX_COMBINED_EDITS):
+    """(code state, edits) of base_json with the best pooled edits that apply to it independently.
+
+    An edit applies if base_json still has the parent version of every item
+    it changes and no edit picked before touches those items; None if none
+    does. The result may be a state that was already measured (an edit on
+    its own parent), which the caller skips.
+    """
+    picked, touched = [], set()
+    for edit in pool:
+        items = set(edit["changes"])
+        if items & touched:
+            continue
+        if any(_key(base_json.get(kind, {}).get(name)) != edit["parents"][(kind, name)] for kind, name in items):
+            continue
+        picked.append(edit)
+        touched |= items
+        if len(picked) == limit:
+            break
+    if not picked:
+        return None
+    combined = copy.deepcopy(base_json)
+    for edit in picked:
+        for (kind, name), value in edit["changes"].items():
+            combined.setdefault(kind, {})[name] = copy.deepcopy(value)
+        if edit["headers"]:
+            combined["headers"] = sorted(set(combined.get("headers", [])) | set(edit["headers"]))
+    return combined, picked
+
+
+def select_beam(entries, width, rank):
+    """The width best distinct code states of entries ({"json", "stats"}), best first (unmeasured last)."""
+    beam, seen = [], set()
+    ranked = sorted((e for e in entries if e["stats"]), key=lambda e: rank(e["stats"]))
+    for entry in ranked + [e for e in entries if not e["stats"]]:
+        key = state_key(entry["json"])
+        if key not in seen:
+            seen.add(key)
+            beam.append(entry)
+        if len(beam) == width:
+            break
+    return beam
+
+
+# One-at-a-time ablation: a candidate that changed several items is split
+# into one state per item (its parent with just that item changed) and each
+# is timed, so the win in one function isn't lost to a regression in another
+# the same answer changed. Each item keeps a pool of its measured versions,
+# scored by their speedup chained over the versions they replaced; the loop
+# ends with a composite of the best version of every item. Only correct,
+# sanitizer-clean candidates are split, promoted or not (a rejected answer
+# may hold the round's best version of a function); each costs up to
+# MAX_ABLATED_ITEMS timed builds, for at most MAX_ABLATED_CANDIDATES a round.
+ABLATION = os.getenv("OPTIMIZER_ABLATION", "1") != "0"
+MAX_ABLATED_ITEMS = 4
+MAX_ABLATED_CANDIDATES = 2
+
+
+def single_edits(parent_json, child_json, limit=MAX_ABLATED_ITEMS):
+    """[(item, code state)] of parent_json with one item changed as in child_json, or [] if it changed fewer than two.
+
+    Items child_json added (helpers) and its new headers go into every state.
+    """
+    changes = changed_items(parent_json, child_json)
+    added = {item: v for item, v in changes.items() if item[1] not in parent_json.get(item[0], {})}
+    changed = sorted(item for item in changes if item not in added)
+    if len(changed) < 2:
+        return []
+    headers = sorted(set(parent_json.get("headers", [])) | set(child_json.get("headers", [])))
+    singles = []
+    for kind, name in changed[:limit]:
+        single = copy.deepcopy(parent_json)
+        for (k, n), value in list(added.items()) + [((kind, name), changes[(kind, name)])]:
+            single.setdefault(k, {})[n] = copy.deepcopy(value)
+        if headers:
+            single["headers"] = headers
+        singles.append(((kind, name), single))
+    return singles
+
+
+def record_variant(variants, parent_json, item, single_json, speedup):
+    """Add the version of item single_json has, measured speedup times faster than parent_json, to variants."""
+    kind, name = item
+    versions = variants.setdefault(item, {})
+    before = parent_json[kind][name]
+    base = versions.setdefault(_key(before), {"value": before, "speedup": 1.0, "extras": {}, "headers": []})
+    # Helpers and headers the version came with
+    extras = {i: v for i, v in changed_items(parent_json, single_json).items()
+              if i != item and i[1] not in parent_json.get(i[0], {})}
+    headers = sorted(set(single_json.get("headers", [])) - set(parent_json.get("headers", [])))
+    key, chained = _key(single_json[kind][name]), base["speedup"] * speedup
+    if key not in versions or versions[key]["speedup"] < chained:
+        versions[key] = {"value": single_json[kind][name], "speedup": chained, "extras": extras, "headers": headers}
+
+
+def composite(variants, base_json):
+    """(code state, changed items) of base_json with each pooled item at its best version, or None."""
+    result, changed = copy.deepcopy(base_json), []
+    for (kind, name), versions in sorted(variants.items()):
+        current = _key(result.get(kind, {}).get(name))
+        # Only items still at a version the pool knows, so its score is comparable
+        if current not in versions:
+            continue
+        best = max(versions.values(), key=lambda v: v["speedup"])
+        if current == _key(best["value"]):
+            continue
+        result[kind][name] = copy.deepcopy(best["value"])
+        for (k, n), value in best["extras"].items():
+            result.setdefault(k, {}).setdefault(n, copy.deepcopy(value))
+        if best["headers"]:
+            result["headers"] = sorted(set(result.get("headers", [])) | set(best["headers"]))
+        changed.append(f"{kind}/{name}")
+    return (result, changed) if changed else None
@@ -0,0 +1,18 @@
+import unittest
+from asmdiff import loops
+
+
+class LoopsTest(unittest.TestCase):
+    def test_x86_backward_jumps(self):
+        code = [(0x10, "mov %eax,%ebx"), (0x14, "jne    10 <f+0x0>"), (0x18, "call   10 <f>"),
+                (0x1c, "jmp    30 <f+0x20>")]
+        self.assertEqual(loops(code), [(0x10, 0x14)])
+
+    def test_arm64_branches(self):
+        code = [(0x10, "add\tw0, w0, #1"), (0x14, "b.ne\t10 <f>"), (0x18, "cbnz\tw1, 14 <f+0x4>"),
+                (0x1c, "tbz\tw0, #3, 10 <f>"), (0x20, "bl\t10 <f>"), (0x24, "b\t8 <f-0x8>"), (0x28, "ret")]
+        self.assertEqual(loops(code), [(0x10, 0x14), (0x14, 0x18), (0x10, 0x1c), (0x8, 0x24)])
+
+
+if __name__ == "__main__":
+    unittest.main()
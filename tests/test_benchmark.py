@@ -0,0 +1,58 @@
+import unittest
+from benchmark import mann_whitney_p, is_significant_improvement
+
+
+def stats(samples):
+    return {"median": sorted(samples)[len(samples) // 2], "samples": samples}
+
+
+class MannWhitneyTest(unittest.TestCase):
+    def test_fully_separated_samples(self):
+        # Exact distribution: 1 of the C(10, 5) = 252 orderings has every faster sample first
+        faster, slower = [1.0, 1.1, 1.2, 1.3, 1.4], [2.0, 2.1, 2.2, 2.3, 2.4]
+        self.assertAlmostEqual(mann_whitney_p(faster, slower), 1 / 252)
+
+    def test_reversed_samples_are_not_faster(self):
+        self.assertAlmostEqual(mann_whitney_p([2.0, 2.1, 2.2], [1.0, 1.1, 1.2]), 1.0)
+
+    def test_interleaved_samples_are_not_significant(self):
+        self.assertGreater(mann_whitney_p([1.0, 1.2, 1.4, 1.6], [1.1, 1.3, 1.5, 1.7]), 0.05)
+
+    def test_ties_use_the_normal_approximation(self):
+        p = mann_whitney_p([1.0] * 10 + [1.5] * 10, [2.0] * 10 + [1.5] * 10)
+        self.assertLess(p, 0.05)
+        self.assertGreater(p, 0.0)
+
+
+class SignificantImprovementTest(unittest.TestCase):
+    def test_clear_speedup_is_accepted(self):
+        self.assertTrue(is_significant_improvement(stats([2.0, 2.1, 2.2, 2.3, 2.4]),
+                                                   stats([1.0, 1.1, 1.2, 1.3, 1.4])))
+
+    def test_noise_is_rejected(self):
+        self.assertFalse(is_significant_improvement(stats([1.1, 1.3, 1.5, 1.7, 1.9]),
+                                                    stats([1.0, 1.2, 1.4, 1.6, 1.8])))
+
+    def test_speedup_below_the_minimum_is_rejected(self):
+        best = stats([1.000, 1.001, 1.002, 1.003, 1.004])
+        candidate = stats([0.995, 0.996, 0.997, 0.998, 0.999])
+        self.assertFalse(is_significant_improvement(best, candidate))
+
+    def test_missing_candidate_or_best(self):
+        self.assertFalse(is_significant_improvement(stats([1.0, 1.1]), None))
+        self.assertTrue(is_significant_improvement(None, stats([1.0, 1.1])))
+
+    def test_single_samples_compare_medians(self):
+        self.assertTrue(is_significant_improvement(stats([2.0]), stats([1.0])))
+
+    def test_worst_aggregate_needs_every_workload_faster(self):
+        fast, slow = stats([1.0, 1.1, 1.2, 1.3, 1.4]), stats([2.0, 2.1, 2.2, 2.3, 2.4])
+        best = dict(stats([2.0, 2.1, 2.2, 2.3, 2.4]), workloads=[slow, slow])
+        candidate = dict(stats([1.0, 1.1, 1.2, 1.3, 1.4]), aggregate="worst", workloads=[fast, slow])
+        self.assertFalse(is_significant_improvement(best, candidate))
+        candidate["workloads"] = [fast, fast]
+        self.assertTrue(is_significant_improvement(best, candidate))
+
+
+if __name__ == "__main__":
+    unittest.main()
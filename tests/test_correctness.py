@@ -0,0 +1,66 @@
+import os
+import shutil
+import tempfile
+import unittest
+from correctness import outputs_match, capture_outputs, read_output_file
+
+
+def output(stdout=(b"ok\n",), files=None):
+    """Output record of runs printing stdout, with {path: [contents per run]} as output files."""
+    files = files or {}
+    return capture_outputs(list(stdout), [b""] * len(stdout), list(files), file_runs=files)
+
+
+class StreamTest(unittest.TestCase):
+    def test_identical_output(self):
+        self.assertEqual(outputs_match(output(), output()), (True, None))
+
+    def test_volatile_baseline_lines_are_skipped(self):
+        reference = output([b"took 1.2s\nresult 5\n", b"took 1.4s\nresult 5\n"])
+        self.assertTrue(outputs_match(reference, output([b"took 0.3s\nresult 5\n"]))[0])
+        self.assertFalse(outputs_match(reference, output([b"took 0.3s\nresult 6\n"]))[0])
+
+    def test_float_tolerance(self):
+        reference = output([b"pi 3.14159\n"])
+        self.assertFalse(outputs_match(reference, output([b"pi 3.14160\n"]))[0])
+        self.assertTrue(outputs_match(reference, output([b"pi 3.14160\n"]), 1e-4)[0])
+
+
+class OutputFileTest(unittest.TestCase):
+    def test_file_contents_are_compared_by_line(self):
+        reference = output(files={"out.txt": [b"a\n1.000\n"]})
+        ok, reason = outputs_match(reference, output(files={"out.txt": [b"a\n1.001\n"]}))
+        self.assertFalse(ok)
+        self.assertIn("output file out.txt line 2", reason)
+        self.assertTrue(outputs_match(reference, output(files={"out.txt": [b"a\n1.001\n"]}), 0.01)[0])
+
+    def test_volatile_file_lines_are_skipped(self):
+        reference = output(files={"log.txt": [b"started 10:01\ndone\n", b"started 10:02\ndone\n"]})
+        self.assertTrue(outputs_match(reference, output(files={"log.txt": [b"started 11:00\ndone\n"]}))[0])
+
+    def test_missing_file(self):
+        reference = output(files={"out.txt": [b"1\n"]})
+        self.assertEqual(outputs_match(reference, output(files={"out.txt": [None]})),
+                         (False, "output file out.txt was not written"))
+
+    def test_file_the_baseline_doesnt_write(self):
+        reference = output(files={"out.txt": [None, None]})
+        self.assertTrue(outputs_match(reference, output(files={"out.txt": [None]}))[0])
+        self.assertEqual(outputs_match(reference, output(files={"out.txt": [b"1\n"]})),
+                         (False, "output file out.txt was written"))
+
+    def test_large_files_by_digest(self):
+        d = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, d)
+        path = os.path.join(d, "big.bin")
+        with open(path, "wb") as f:
+            f.write(b"x" * (5 << 20))
+        big = read_output_file(path)
+        self.assertIsInstance(big, str)
+        self.assertTrue(outputs_match(output(files={"big.bin": [big]}), output(files={"big.bin": [big]}))[0])
+        self.assertFalse(outputs_match(output(files={"big.bin": [big]}),
+                                       output(files={"big.bin": [b"x"]}))[0])
+
+
+if __name__ == "__main__":
+    unittest.main()
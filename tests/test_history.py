@@ -0,0 +1,60 @@
+import os
+import shutil
+import tempfile
+import unittest
+from unittest import mock
+import history
+
+SETTINGS = {"run_args": ["in.txt"], "work_dir": None, "include_paths": [], "compile_commands": "",
+            "output_files": [], "float_tolerance": 0.0, "allow_fast_math": False, "parallelize": False,
+            "sanitize": True, "microbench": False, "bench_inputs": {}, "objectives": {"time": 1.0},
+            "workloads": None, "beam_width": 1, "output_format": "combined"}
+
+
+def record(source_hash, settings, baseline_time=2.0, best_time=1.0, code="int f() { return 1; }"):
+    best_json = {"functions": {"f": code}}
+    results = {"functions": {"f": "int f() { return 0; }"}, "ai_feedback": {"best_json": best_json}}
+    summary = {"baseline_time": baseline_time, "best_time": best_time}
+    return history.record_run("svc", source_hash, settings, results, summary, [])
+
+
+class KnownBestTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        patcher = mock.patch.object(history, "HISTORY_DB", os.path.join(self.dir, "history.sqlite"))
+        patcher.start()
+        self.addCleanup(patcher.stop)
+        self.addCleanup(shutil.rmtree, self.dir, ignore_errors=True)
+
+    def test_latest_speedup_of_the_same_sources(self):
+        record("abc", SETTINGS, code="int f() { return 1; }")
+        run_id = record("abc", SETTINGS, code="int f() { return 2; }")
+        record("other", SETTINGS)
+        known = history.known_best("abc", SETTINGS)
+        self.assertEqual(known["run_id"], run_id)
+        self.assertEqual(known["best_json"], {"functions": {"f": "int f() { return 2; }"}})
+        self.assertEqual(known["best_time"], 1.0)
+
+    def test_runs_without_a_speedup_are_not_reused(self):
+        record("abc", SETTINGS, baseline_time=1.0, best_time=1.0)
+        self.assertIsNone(history.known_best("abc", SETTINGS))
+
+    def test_unknown_sources(self):
+        self.assertIsNone(history.known_best("abc", SETTINGS))
+
+    def test_result_options_must_match(self):
+        record("abc", SETTINGS)
+        for key, value in (("run_args", ["big.txt"]), ("sanitize", False), ("parallelize", True),
+                           ("objectives", {"time": 1.0, "rss": 0.5}), ("workloads", {"runs": [{"args": []}]}),
+                           ("include_paths", ["include"]), ("microbench", True)):
+            with self.subTest(key=key):
+                self.assertIsNone(history.known_best("abc", dict(SETTINGS, **{key: value})))
+
+    def test_search_and_output_options_dont_matter(self):
+        run_id = record("abc", SETTINGS)
+        settings = dict(SETTINGS, beam_width=3, output_format="zip")
+        self.assertEqual(history.known_best("abc", settings)["run_id"], run_id)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,69 @@
+import resource
+import subprocess
+import sys
+import unittest
+from unittest import mock
+import benchmark
+import isolation
+from benchmark import run_once
+
+
+def limits(**kwargs):
+    """getrlimit soft limits seen by a child started with child_setup(**kwargs)."""
+    code = ("import resource; print(' '.join(str(resource.getrlimit(getattr(resource, r))[0]) "
+            "for r in ('RLIMIT_CORE', 'RLIMIT_FSIZE', 'RLIMIT_AS', 'RLIMIT_CPU')))")
+    out = subprocess.run([sys.executable, "-c", code], capture_output=True, text=True, check=True,
+                         preexec_fn=isolation.child_setup(**kwargs)).stdout
+    return dict(zip(("core", "fsize", "as", "cpu"), map(int, out.split())))
+
+
+class ChildSetupTest(unittest.TestCase):
+    def test_rlimits(self):
+        got = limits(timeout=2)
+        self.assertEqual(got["core"], 0)
+        self.assertEqual(got["fsize"], isolation.RUN_MAX_FILE_MB << 20)
+        self.assertEqual(got["as"], isolation.RUN_MEMORY_MB << 20)
+        self.assertGreaterEqual(got["cpu"], 3)
+
+    def test_sanitizer_runs_keep_their_address_space(self):
+        self.assertEqual(limits(limit_address_space=False)["as"], resource.getrlimit(resource.RLIMIT_AS)[0])
+
+    def test_no_cpu_limit_without_timeout(self):
+        self.assertEqual(limits()["cpu"], resource.getrlimit(resource.RLIMIT_CPU)[0])
+
+    def test_background_runs_get_the_lowest_priority(self):
+        nice = subprocess.run([sys.executable, "-c", "import os; print(os.nice(0))"], capture_output=True,
+                              text=True, check=True, preexec_fn=isolation.child_setup(background=True)).stdout
+        self.assertEqual(int(nice), 19)
+
+
+@mock.patch.object(isolation, "CGROUP_ROOT", "")
+class RunOnceLimitsTest(unittest.TestCase):
+    def test_file_size_limit_is_reported(self):
+        with mock.patch.object(isolation, "RUN_MAX_FILE_MB", 1):
+            # Not Python: it ignores SIGXFSZ
+            run = run_once(["head", "-c", str(2 << 20), "/dev/zero"], timeout=20)
+        self.assertNotEqual(run["returncode"], 0)
+        self.assertEqual(run["limit"], "file size limit exceeded")
+
+    def test_memory_cap_without_cgroup(self):
+        with mock.patch.object(isolation, "RUN_MEMORY_MB", 256):
+            run = run_once([sys.executable, "-c", "bytearray(1 << 30)"], timeout=20)
+        self.assertNotEqual(run["returncode"], 0)
+
+    def test_untimed_runs_dont_wait_for_the_benchmark_core(self):
+        cores = benchmark._take_cores(1)
+        try:
+            with benchmark.untimed_slot():
+                run = run_once([sys.executable, "-c", "pass"], timeout=20, background=True)
+        finally:
+            benchmark._return_cores(cores)
+        self.assertEqual(run["returncode"], 0)
+
+    def test_timeout_kills_the_program(self):
+        with self.assertRaises(subprocess.TimeoutExpired):
+            run_once([sys.executable, "-c", "import time; time.sleep(30)"], timeout=0.5)
+
+
+if __name__ == "__main__":
+    unittest.main()
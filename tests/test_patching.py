@@ -0,0 +1,55 @@
+import unittest
+from patching import _hunks, apply_diff, make_diff
+
+
+class HunksTest(unittest.TestCase):
+    def test_header_pair_before_hunk_is_skipped(self):
+        diff = "--- a/f\n+++ b/f\n@@ -2,2 +2,2 @@\n-a;\n+b;\n c;"
+        self.assertEqual(_hunks(diff), [(1, ["a;", "c;"], ["b;", "c;"])])
+
+    def test_headerless_removal_of_decrement_is_kept(self):
+        # "---x;" removes the line "--x;", it is not a file header
+        self.assertEqual(_hunks("---x;\n+++x;\n y;"), [(None, ["--x;", "y;"], ["++x;", "y;"])])
+
+    def test_removal_of_decrement_inside_hunk(self):
+        diff = "--- a/f\n+++ b/f\n@@ -1,2 +1,1 @@\n---i;\n return i;"
+        self.assertEqual(_hunks(diff), [(0, ["--i;", "return i;"], ["return i;"])])
+
+    def test_missing_hunk_header_is_one_hunk(self):
+        self.assertEqual(_hunks(" a;\n-b;\n+c;"), [(None, ["a;", "b;"], ["a;", "c;"])])
+
+    def test_no_newline_marker_is_ignored(self):
+        diff = "@@ -1 +1 @@\n-a;\n\\ No newline at end of file\n+b;"
+        self.assertEqual(_hunks(diff), [(0, ["a;"], ["b;"])])
+
+    def test_several_hunks(self):
+        diff = "@@ -1,1 +1,1 @@\n-a\n+A\n@@ -5,1 +5,1 @@\n-e\n+E"
+        self.assertEqual(_hunks(diff), [(0, ["a"], ["A"]), (4, ["e"], ["E"])])
+
+
+class ApplyDiffTest(unittest.TestCase):
+    OLD = "int f(int x) {\n    --x;\n    return x;\n}"
+
+    def test_round_trip(self):
+        new = "int f(int x) {\n    ++x;\n    return x * 2;\n}"
+        self.assertEqual(apply_diff(self.OLD, make_diff(self.OLD, new, "functions/f")), new)
+
+    def test_removes_decrement_line(self):
+        new = "int f(int x) {\n    return x;\n}"
+        self.assertEqual(apply_diff(self.OLD, make_diff(self.OLD, new, "functions/f")), new)
+
+    def test_wrong_line_numbers_are_only_a_hint(self):
+        diff = "@@ -40,2 +40,2 @@\n     --x;\n-    return x;\n+    return -x;"
+        self.assertEqual(apply_diff(self.OLD, diff), "int f(int x) {\n    --x;\n    return -x;\n}")
+
+    def test_whitespace_differences_are_tolerated(self):
+        diff = "@@ -3 +3 @@\n-  return   x;\n+    return x + 1;"
+        self.assertIn("return x + 1;", apply_diff(self.OLD, diff))
+
+    def test_missing_context_raises(self):
+        with self.assertRaises(ValueError):
+            apply_diff(self.OLD, "@@ -1 +1 @@\n-nothing like this\n+x")
+
+
+if __name__ == "__main__":
+    unittest.main()
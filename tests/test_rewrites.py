@@ -0,0 +1,120 @@
+import unittest
+from rewrites import endl_to_newline, sync_stdio, const_ref_params, reserve_before_loops, emplace_back
+
+
+def finding(rule, item, name=None, severity="medium"):
+    return {"rule": rule, "item": f"functions/{item}", "name": name, "severity": severity}
+
+
+class EndlTest(unittest.TestCase):
+    def test_replaced_where_reported(self):
+        code = "void f() { for (int i = 0; i < 3; ++i) std::cout << i << std::endl; }"
+        self.assertEqual(endl_to_newline("f", code, [finding("endl_in_loop", "f")], {}),
+                         "void f() { for (int i = 0; i < 3; ++i) std::cout << i << '\\n'; }")
+
+    def test_not_reported(self):
+        self.assertIsNone(endl_to_newline("f", "void f() { cout << endl; }", [], {}))
+
+
+class SyncStdioTest(unittest.TestCase):
+    def test_inserted_in_main(self):
+        code = "int main() {\n    std::cout << 1;\n}"
+        new = sync_stdio("main", code, [], {"functions/main": code})
+        self.assertIn("std::ios::sync_with_stdio(false);\n    std::cin.tie(nullptr);\n    std::cout", new)
+
+    def test_skipped_when_c_stdio_is_mixed_in(self):
+        code = "int main() { std::cout << 1; }"
+        state = {"functions/main": code, "functions/g": "void g() { printf(\"x\"); }"}
+        self.assertIsNone(sync_stdio("main", code, [], state))
+
+
+class ConstRefTest(unittest.TestCase):
+    def rewrite(self, code, state=None):
+        findings = [finding("container_by_value", "f", "a")]
+        return const_ref_params("f", code, findings, dict({"functions/f": code}, **(state or {})))
+
+    def test_read_only_parameter(self):
+        self.assertEqual(self.rewrite("int f(std::vector<int> a) { return a[0] + a.size(); }"),
+                         "int f(const std::vector<int>& a) { return a[0] + a.size(); }")
+
+    def test_writes_are_kept_by_value(self):
+        for body in ("a[0] = 1;", "a[i][j] = 1;", "a[i][j] += 1;", "++a[i];", "a[i]--;", "a.front() = 2;",
+                     "a = b;", "a.push_back(1);", "int* p = &a[0];", "auto& r = a[0];", "int &r = a[1];",
+                     "for (auto& x : a) x = 0;", "std::sort(a.begin(), a.end());", "g(std::move(a));",
+                     "auto& [x, y] = a;"):
+            with self.subTest(body=body):
+                self.assertIsNone(self.rewrite(f"void f(std::vector<int> a, std::vector<int> b, int i, int j) "
+                                               f"{{ {body} }}"))
+
+    def test_reads_and_const_bindings_are_fine(self):
+        for body in ("int s = a[0] == 1;", "const auto& r = a[0];", "for (const auto& x : a) s += x;",
+                     "if (s && a.empty()) return;", "s = s & a[0];", "printf(\"%d\", a[0]);"):
+            with self.subTest(body=body):
+                self.assertIsNotNone(self.rewrite(f"void f(std::vector<int> a) {{ int s = 0; {body} }}"))
+
+    def test_calls_need_a_const_callee(self):
+        code = "void f(std::vector<int> a) { g(a); }"
+        self.assertIsNone(self.rewrite(code, {"functions/g": "void g(std::vector<int>& v) { v.clear(); }"}))
+        self.assertIsNone(self.rewrite(code))  # unknown callee
+        self.assertIsNotNone(self.rewrite(code, {"functions/g": "int g(const std::vector<int>& v) { return 0; }"}))
+
+
+class ReserveTest(unittest.TestCase):
+    findings = [finding("push_back_without_reserve", "f", "v")]
+
+    def test_reserve_inserted_before_the_loop(self):
+        code = "void f(int n) {\n    std::vector<int> v;\n    for (int i = 0; i < n; ++i) {\n        v.push_back(i);\n    }\n}"
+        self.assertIn("    if ((n) > 0) v.reserve(v.size() + (n));\n    for (int i", reserve_before_loops("f", code, self.findings, {}))
+
+    def test_braceless_bodies_are_left_alone(self):
+        for head in ("if (n > 4)", "else", "while (k--)", "if (n) // big\n   "):
+            with self.subTest(head=head):
+                code = (f"void f(int n, int k) {{ std::vector<int> v; if (k) k = 0; {head} "
+                        f"for (int i = 0; i < n; ++i) {{ v.push_back(i); }} }}")
+                self.assertIsNone(reserve_before_loops("f", code, self.findings, {}))
+
+    def test_after_a_comment(self):
+        code = "void f(int n) { std::vector<int> v; // fill\n for (int i = 0; i < n; i++) { v.push_back(i); } }"
+        self.assertIsNotNone(reserve_before_loops("f", code, self.findings, {}))
+
+    def test_nested_loops_are_skipped(self):
+        # The analyzer raises the severity with the loop depth
+        code = ("void f(int n) { std::vector<int> v; for (int i = 0; i < n; ++i) { "
+                "for (int j = 0; j < n; ++j) { v.push_back(j); } } }")
+        findings = [finding("push_back_without_reserve", "f", "v", severity="high")]
+        self.assertIsNone(reserve_before_loops("f", code, findings, {}))
+
+
+class EmplaceBackTest(unittest.TestCase):
+    def test_exact_element_type(self):
+        code = "void f() { std::vector<Point> v; v.push_back(Point(1, 2)); }"
+        self.assertEqual(emplace_back("f", code, [], {"classes/Point": "struct Point {};"}),
+                         "void f() { std::vector<Point> v; v.emplace_back(1, 2); }")
+
+    def test_other_element_type_is_kept(self):
+        # Base(Derived(x)) is not Base(x)
+        code = "void f() { std::vector<Base> v; v.push_back(Derived(1)); }"
+        self.assertIsNone(emplace_back("f", code, [], {"classes/Base": "", "classes/Derived": ""}))
+
+    def test_undeclared_container_is_kept(self):
+        self.assertIsNone(emplace_back("f", "void f() { g().push_back(P(1)); w.push_back(P(1)); }", [],
+                                       {"classes/P": ""}))
+
+    def test_make_pair_needs_a_pair_element(self):
+        code = "void f(int a, int b) { std::vector<std::pair<int, int>> v; v.push_back(std::make_pair(a, b)); }"
+        self.assertIn("v.emplace_back(a, b)", emplace_back("f", code, [], {}))
+        code = "void f(int a, int b) { std::vector<Edge> v; v.push_back(std::make_pair(a, b)); }"
+        self.assertIsNone(emplace_back("f", code, [], {}))
+
+    def test_member_container(self):
+        state = {"classes/Graph": "struct Graph { std::vector<std::string> names; };"}
+        code = "void f(Graph& g, const char* s) { g.names.push_back(std::string(s, 3)); }"
+        self.assertIn("g.names.emplace_back(s, 3)", emplace_back("f", code, [], state))
+
+    def test_factory_functions_are_kept(self):
+        self.assertIsNone(emplace_back("f", "void f() { std::vector<P> v; v.push_back(Make(1)); }", [],
+                                       {"classes/P": ""}))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,158 @@
+import os
+import shutil
+import stat
+import zipfile
+from pathlib import PurePosixPath
+from fastapi import HTTPException
+
+# Upload handling that never holds an archive in memory: uploads are streamed
+# to disk in chunks and extracted entry by entry, skipping build output and
+# binaries, with limits against oversized uploads and zip bombs.
+MAX_UPLOAD_BYTES = int(os.getenv("OPTIMIZER_MAX_UPLOAD_MB", "1024")) << 20
+MAX_UNCOMPRESSED_BYTES = int(os.getenv("OPTIMIZER_MAX_UNCOMPRESSED_MB", "4096")) << 20
+MAX_ZIP_ENTRIES = int(os.getenv("OPTIMIZER_MAX_ZIP_ENTRIES", "20000"))
+# Entries bigger than 1MB that expand more than this are treated as bombs
+MAX_COMPRESSION_RATIO = int(os.getenv("OPTIMIZER_MAX_COMPRESSION_RATIO", "200"))
+CHUNK_SIZE = 1 << 20
+
+# Directories and files that are build output, never inputs of the program.
+# Other directories (e.g. out/) are only skipped when they hold a CMake build
+# tree, i.e. a CMakeCache.txt.
+SKIP_DIRS = {"build", ".git", ".svn", ".hg", ".idea", ".vs", ".vscode", "node_modules",
+             "__pycache__", "__MACOSX", "CMakeFiles"}
+SKIP_DIR_PREFIXES = ("cmake-build-",)
+SKIP_EXTS = (".o", ".obj", ".a", ".lib", ".so", ".dylib", ".dll", ".exe", ".pch", ".gch", ".pdb",
+             ".ilk", ".profraw", ".profdata", ".pyc", ".class")
+BUILD_TREE_MARKER = "CMakeCache.txt"
+# Executables without an extension, recognized by their first bytes (ELF, Mach-O);
+# PE files by the "PE" signature the MZ header points to
+EXECUTABLE_MAGIC = (b"\x7fELF", b"\xcf\xfa\xed\xfe", b"\xce\xfa\xed\xfe", b"\xca\xfe\xba\xbe")
+
+
+def is_executable(head):
+    """Whether a file starting with the bytes head is a native executable."""
+    if head.startswith(EXECUTABLE_MAGIC):
+        return True
+    if head[:2] == b"MZ" and len(head) >= 0x40:
+        pe_offset = int.from_bytes(head[0x3c:0x40], "little")
+        return head[pe_offset:pe_offset + 4] == b"PE\0\0"
+    return False
+
+
+def build_trees(names):
+    """Directories of an archive that hold a CMake build tree (a CMakeCache.txt; not the root, an in-source build)."""
+    return {PurePosixPath(n).parent.parts for n in names
+            if PurePosixPath(n).name == BUILD_TREE_MARKER and PurePosixPath(n).parent.parts}
+
+
+async def stream_upload(upload, dest, max_bytes=MAX_UPLOAD_BYTES):
+    """Write an UploadFile to dest in chunks, rejecting it once it exceeds max_bytes."""
+    written = 0
+    with open(dest, "wb") as f:
+        while True:
+            chunk = await upload.read(CHUNK_SIZE)
+            if not chunk:
+                break
+            written += len(chunk)
+            if written > max_bytes:
+                f.close()
+                os.remove(dest)
+                raise HTTPException(status_code=413, detail=f"Upload exceeds {max_bytes >> 20}MB")
+            f.write(chunk)
+    return written
+
+
+def skipped(name, trees=()):
+    """Why an archive member is not extracted (None if it is); trees as found by build_trees."""
+    parts = PurePosixPath(name).parts
+    if parts[-1] == "compile_commands.json":
+        return None  # usually in build/, and the one build file we use
+    if any(p in SKIP_DIRS or p.startswith(SKIP_DIR_PREFIXES) for p in parts[:-1]):
+        return "build directory"
+    if any(parts[:len(t)] == t for t in trees if len(t) < len(parts)):
+        return "build directory"
+    base = parts[-1]
+    if base.startswith(".") or base.startswith("._"):
+        return "hidden file"
+    if base.endswith(SKIP_EXTS):
+        return "build artifact"
+    return None
+
+
+def _safe_target(root, name):
+    """Destination of an archive member inside root, or raise for absolute/.. paths."""
+    path = PurePosixPath(name.replace("\\", "/"))
+    if path.is_absolute() or ".." in path.parts or (path.parts and ":" in path.parts[0]):
+        raise HTTPException(status_code=400, detail=f"Unsafe path in ZIP: {name}")
+    return os.path.join(root, *path.parts)
+
+
+def check_archive(zf):
+    """Reject archives whose declared contents exceed the limits, before extracting anything."""
+    infos = zf.infolist()
+    if len(infos) > MAX_ZIP_ENTRIES:
+        raise HTTPException(status_code=400, detail=f"ZIP has more than {MAX_ZIP_ENTRIES} entries")
+    total = 0
+    for info in infos:
+        total += info.file_size
+        if info.file_size > 1 << 20 and info.file_size > MAX_COMPRESSION_RATIO * max(info.compress_size, 1):
+            raise HTTPException(status_code=400, detail=f"Suspicious compression ratio for {info.filename}")
+    if total > MAX_UNCOMPRESSED_BYTES:
+        raise HTTPException(status_code=400,
+                            detail=f"ZIP expands to more than {MAX_UNCOMPRESSED_BYTES >> 20}MB")
+
+
+def extract_archive(zip_path, root):
+    """Extract a project archive entry by entry, returning the extracted paths.
+
+    Members in build directories, build artifacts, executables, symlinks and
+    hidden files are skipped. Sizes are counted while writing, so archives
+    that lie about their sizes still stop at MAX_UNCOMPRESSED_BYTES.
+    """
+    try:
+        zf = zipfile.ZipFile(zip_path)
+    except zipfile.BadZipFile:
+        raise HTTPException(status_code=400, detail="Invalid ZIP file")
+
+    extracted, budget = [], MAX_UNCOMPRESSED_BYTES
+    with zf:
+        check_archive(zf)
+        trees = build_trees(i.filename for i in zf.infolist())
+        for info in zf.infolist():
+            if info.is_dir():
+                continue
+            if stat.S_ISLNK(info.external_attr >> 16):
+                print(f"  ⏭️  {info.filename} (symlink, skipped)")
+                continue
+            reason = skipped(info.filename, trees)
+            if reason:
+                print(f"  ⏭️  {info.filename} ({reason}, skipped)")
+                continue
+
+            target = _safe_target(root, info.filename)
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            with zf.open(info) as src, open(target, "wb") as dst:
+                head = src.read(CHUNK_SIZE)
+                if "." not in os.path.basename(target) and is_executable(head):
+                    dst.close()
+                    os.remove(target)
+                    print(f"  ⏭️  {info.filename} (executable, skipped)")
+                    continue
+                chunk = head
+                while chunk:
+                    budget -= len(chunk)
+                    if budget < 0:
+                        raise HTTPException(status_code=400,
+                                            detail=f"ZIP expands to more than {MAX_UNCOMPRESSED_BYTES >> 20}MB")
+                    dst.write(chunk)
+                    chunk = src.read(CHUNK_SIZE)
+            extracted.append(target)
+    return extracted
+
+
+def remove_quietly(path):
+    """Delete a file or directory if it exists."""
+    if os.path.isdir(path):
+        shutil.rmtree(path, ignore_errors=True)
+    elif os.path.exists(path):
+        os.remove(path)
@@ -1,47 +1,119 @@
 import os
+import shutil
 import subprocess
-import time
+import tempfile
+import cache
+from remarks import parse_remarks, REMARK_FLAGS, VECTORIZE_REMARKS
+from workloads import run_workloads
+from benchmark import run_benchmark, pin_unreserved, COUNT_ALLOCATIONS, COLLECT_COUNTERS, DEFAULT_WARMUP, \
+    DEFAULT_REPETITIONS
 
-def compile_and_run_project(filepaths, run_args=None, clang_args=None):
-    """Compile and run C++ project, returning execution time."""
-    # Filter for source files
-    cpp_files = [fp for fp in filepaths if fp.endswith((".cpp", ".cc", ".c", ".cxx"))]
-    if not cpp_files:
-        return None
-
-    exe_path = "optimized_bin"
-    
+def compile_flags(clang_args=None):
+    """Flags every build uses: forced -O3 plus the caller's non -O flags."""
     # FORCE -O3. If we don't use -O3, the AI is optimizing against a slow baseline.
-    compile_cmd = ["clang++", "-O3", "-std=c++17"]
+    flags = ["-O3", "-std=c++17"]
     
     if clang_args:
         # Only add flags that aren't optimization levels
         clean_args = [a for a in clang_args if not a.startswith("-O")]
-        compile_cmd.extend(clean_args)
-        
+        flags.extend(clean_args)
+    return flags
+
+def compile_project(filepaths, exe_path, clang_args=None, remarks=None):
+    """Compile C++ sources into exe_path, returning True on success.
+
+    With a remarks list, the loop vectorizer's remarks are appended to it (see remarks.py).
+    """
+    # Filter for source files
+    cpp_files = [fp for fp in filepaths if fp.endswith((".cpp", ".cc", ".c", ".cxx"))]
+    if not cpp_files:
+        return False
+
+    # Libraries go after the sources, or the linker drops them as unused
+    flags = compile_flags(clang_args)
+    libs = [f for f in flags if f.startswith("-l")]
+    compile_cmd = ["clang++"] + [f for f in flags if not f.startswith("-l")]
+    if remarks is not None:
+        compile_cmd.extend(REMARK_FLAGS)
     compile_cmd.extend(cpp_files)
-    compile_cmd.extend(["-o", exe_path])
-    
+    compile_cmd.extend(libs + ["-o", exe_path])
+
+    # Keep compiles off the cores reserved for timed runs
+    result = subprocess.run(compile_cmd, capture_output=True, text=True, preexec_fn=pin_unreserved())
+    if result.returncode != 0:
+        print(f"Compilation failed:")
+        errors = [l for l in result.stderr.splitlines() if ": remark: " not in l]
+        print("\n".join(errors[:10])) # Print first 10 lines of error
+        return False
+    if remarks is not None:
+        remarks.extend(parse_remarks(result.stderr, cpp_files))
+    return True
+
+def cached_compile(filepaths, exe_path, clang_args=None, remarks=None):
+    """compile_project through the binary cache, returning (success, cache key or None)."""
+    cpp_files = [fp for fp in filepaths if fp.endswith((".cpp", ".cc", ".c", ".cxx"))]
+    key = cache.binary_key(cpp_files, compile_flags(clang_args)) if cache.CACHE_ENABLED and cpp_files else None
+
+    if key and cache.fetch_binary(key, exe_path):
+        print("♻️  Compile cache hit")
+        if remarks is not None:
+            remarks.extend(cache.load_remarks(key) or [])
+        return True, key
+
+    if not compile_project(filepaths, exe_path, clang_args, remarks):
+        return False, None
+    if key:
+        cache.store_binary(key, exe_path)
+        if remarks is not None:
+            cache.store_remarks(key, remarks)
+    return True, key
+
+def benchmark_project(filepaths, run_args=None, clang_args=None,
+                      warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, build_dir=None, cwd=None,
+                      output_files=None, workloads=None):
+    """Compile and benchmark C++ project, returning timing statistics (see benchmark.py).
+
+    The binary is built in build_dir (a private temp dir if not given) and run
+    from cwd, so concurrent jobs never share a binary or the process cwd.
+    Identical builds and workloads are served from the cache (see cache.py).
+    stdout/stderr and output_files (relative to cwd) are recorded in stats["output"],
+    the build's vectorizer remarks in stats["remarks"] (see remarks.py).
+    With a workload matrix (see workloads.py) it replaces run_args and the
+    statistics aggregate all of its runs.
+    """
+    private_dir = None if build_dir else tempfile.mkdtemp(prefix="cppopt_build_")
+    exe_path = os.path.join(build_dir or private_dir, "optimized_bin")
+
     try:
-        # Compile
-        result = subprocess.run(compile_cmd, capture_output=True, text=True)
-        if result.returncode != 0:
-            print(f"Compilation failed:")
-            print("\n".join(result.stderr.splitlines()[:10])) # Print first 10 lines of error
-            return None
-        
-        # Run
-        start = time.time()
-        cmd = [f"./{exe_path}"] + (run_args or [])
-        
-        # Increase timeout to 20s to be safe
-        result = subprocess.run(cmd, capture_output=True, text=True, timeout=20)
-        
-        if result.returncode != 0:
-            print(f"⚠️ Runtime Error (Exit {result.returncode}): {result.stderr}")
+        remarks = [] if VECTORIZE_REMARKS else None
+        compiled, key = cached_compile(filepaths, exe_path, clang_args, remarks)
+        if not compiled:
             return None
-            
-        return time.time() - start
+
+        # Same binary and same workload: reuse the measured timings
+        inputs = [a for w in workloads["runs"] for a in w["args"]] if workloads else run_args
+        rkey = cache.result_key(key, inputs, cwd, warmup=warmup, repetitions=repetitions,
+                                output_files=output_files or [], allocations=COUNT_ALLOCATIONS,
+                                counters=COLLECT_COUNTERS, workloads=workloads) if key else None
+        if rkey:
+            stats = cache.load_result(rkey)
+            if stats is not None:
+                print("♻️  Reusing cached benchmark result")
+                return stats
+
+        # Run (timeout is per repetition)
+        if workloads:
+            stats = run_workloads(os.path.abspath(exe_path), workloads, warmup=warmup, repetitions=repetitions,
+                                  cwd=cwd, output_files=output_files)
+        else:
+            cmd = [os.path.abspath(exe_path)] + (run_args or [])
+            stats = run_benchmark(cmd, warmup=warmup, repetitions=repetitions, cwd=cwd, output_files=output_files)
+        if stats is not None:
+            stats["binary_size"] = os.path.getsize(exe_path)
+            stats["remarks"] = remarks
+        if rkey and stats is not None:
+            cache.store_result(rkey, stats)
+        return stats
         
     except Exception as e:
         print(f" Execution error: {e}")
@@ -49,17 +121,25 @@ def compile_and_run_project(filepaths, run_args=None, clang_args=None):
     finally:
         if os.path.exists(exe_path):
             os.remove(exe_path)
+        if private_dir:
+            shutil.rmtree(private_dir, ignore_errors=True)
+
+def compile_and_run_project(filepaths, run_args=None, clang_args=None, build_dir=None, cwd=None):
+    """Compile and run C++ project once, returning execution time."""
+    stats = benchmark_project(filepaths, run_args=run_args, clang_args=clang_args, warmup=0, repetitions=1,
+                              build_dir=build_dir, cwd=cwd)
+    return stats["median"] if stats else None
+
+# Helper to extract code string
+def get_code(item):
+    if isinstance(item, str): return item
+    if isinstance(item, dict):
+        return item.get('code', item.get('definition', list(item.values())[0]))
+    return str(item)
 
 def json_to_cpp(data: dict, filename: str = "project_combined.cpp"):
     """Convert JSON to C++ with deduplication and header fixing."""
     lines = []
-    
-    # Helper to extract code string
-    def get_code(item):
-        if isinstance(item, str): return item
-        if isinstance(item, dict):
-            return item.get('code', item.get('definition', list(item.values())[0]))
-        return str(item)
 
     # 1. System Headers ONLY
     headers = data.get("headers", [])
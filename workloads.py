@@ -0,0 +1,145 @@
+import json
+import math
+import os
+from benchmark import run_benchmark, summarize, DEFAULT_WARMUP, DEFAULT_REPETITIONS
+
+# A workload matrix: the program is benchmarked on several argument lists
+# (input files, sizes) and thread counts instead of one run_args, so a
+# candidate that only wins on the small sample doesn't get in. Each run's
+# statistics are kept as the scaling curve (stats["workloads"]); the
+# top-level statistics are an aggregate over the matrix, per repetition:
+#   geomean  geometric mean of the runtimes (each workload counts the same)
+#   total    sum of the runtimes (long workloads dominate)
+#   worst    timed like geomean, but a candidate must be faster on every workload
+AGGREGATES = ("geomean", "total", "worst")
+DEFAULT_AGGREGATE = "geomean"
+MAX_WORKLOADS = 16
+# Environment variable set to a workload's thread count
+THREADS_ENV = "OMP_NUM_THREADS"
+
+
+def _args(value):
+    if isinstance(value, str):
+        return [a.strip() for a in value.split(",") if a.strip()]
+    if isinstance(value, list) and all(isinstance(a, (str, int, float)) for a in value):
+        return [str(a) for a in value]
+    raise ValueError(f"workload arguments must be a list or a comma-separated string: {value!r}")
+
+
+def _workload(args, threads=None, env=None, name=None):
+    if threads is not None and (not isinstance(threads, int) or threads < 1):
+        raise ValueError(f"threads must be a positive integer: {threads!r}")
+    if env is not None and not isinstance(env, dict):
+        raise ValueError("workload env must be an object")
+    env = {str(k): str(v) for k, v in (env or {}).items()}
+    if threads is not None:
+        env.setdefault(THREADS_ENV, str(threads))
+    label = name or " ".join(args) or "(no args)"
+    if threads is not None and not name:
+        label += f" @{threads}t"
+    return {"name": label, "args": args, "threads": threads or 1, "env": env}
+
+
+def parse_workloads(spec, aggregate=DEFAULT_AGGREGATE):
+    """Workload matrix from JSON, or None for an empty spec; ValueError if invalid.
+
+    Either a list of {"args", "threads", "env", "name"} (all optional but
+    args), or a matrix {"args": [...], "threads": [...]} whose combinations
+    are all run. Returns {"runs": [{"name", "args", "threads", "env"}], "aggregate"}.
+    """
+    if not spec or not spec.strip():
+        return None
+    if aggregate not in AGGREGATES:
+        raise ValueError(f"aggregate must be one of: {', '.join(AGGREGATES)}")
+    try:
+        data = json.loads(spec)
+    except ValueError:
+        raise ValueError("workloads must be JSON")
+
+    if isinstance(data, dict):
+        arg_lists = [_args(a) for a in data.get("args") or [[]]]
+        thread_counts = data.get("threads") or [None]
+        if not isinstance(thread_counts, list):
+            raise ValueError("threads must be a list")
+        runs = [_workload(a, t, data.get("env")) for a in arg_lists for t in thread_counts]
+    elif isinstance(data, list):
+        runs = []
+        for w in data:
+            if not isinstance(w, dict):
+                raise ValueError("each workload must be an object")
+            runs.append(_workload(_args(w.get("args", [])), w.get("threads"), w.get("env"), w.get("name")))
+    else:
+        raise ValueError("workloads must be a list or an object")
+
+    if not runs:
+        raise ValueError("no workloads given")
+    if len(runs) > MAX_WORKLOADS:
+        raise ValueError(f"at most {MAX_WORKLOADS} workloads")
+    if len({r["name"] for r in runs}) != len(runs):
+        raise ValueError("workload names must be unique")
+    return {"runs": runs, "aggregate": aggregate}
+
+
+def thread_scaling(run_args, threads):
+    """Matrix of run_args at 1 and threads threads (parallelization mode's default)."""
+    counts = [1, threads] if threads > 1 else [1]
+    return {"runs": [_workload(list(run_args or []), t) for t in counts], "aggregate": DEFAULT_AGGREGATE}
+
+
+def primary_args(workloads, run_args=None):
+    """Arguments of the last (by convention the production-size) workload, for profiling and training."""
+    return workloads["runs"][-1]["args"] if workloads else run_args
+
+
+def _geomean(values):
+    return math.exp(sum(math.log(max(v, 1e-9)) for v in values) / len(values))
+
+
+def combine(results, workloads):
+    """One statistics dict for a matrix of run_benchmark results (in workloads["runs"] order)."""
+    aggregate = workloads["aggregate"]
+    reduce = sum if aggregate == "total" else _geomean
+    n = min(len(s["samples"]) for s in results)
+    wall = [reduce([s["samples"][i] for s in results]) for i in range(n)]
+    cpu = [reduce([s["cpu_samples"][i] for s in results]) for i in range(n)] \
+        if all(s.get("cpu_samples") for s in results) else None
+
+    # Counters describe the longest workload; allocations add up over the matrix
+    longest = max(results, key=lambda s: s["median"])
+    allocations = None
+    if all(s.get("allocations") is not None for s in results):
+        allocations = {"allocations": sum(s["allocations"] for s in results),
+                       "allocated_bytes": sum(s["allocated_bytes"] or 0 for s in results)}
+    rss = [s["peak_rss_kb"] for s in results if s.get("peak_rss_kb")]
+    outputs = {run["name"]: s["output"] for run, s in zip(workloads["runs"], results)}
+    stats = summarize(wall, cpu, max(rss) if rss else None, longest.get("counters"),
+                      {"workloads": outputs}, allocations)
+    stats["aggregate"] = aggregate
+    stats["workloads"] = [
+        {"name": run["name"], "args": run["args"], "threads": run["threads"],
+         **{k: s.get(k) for k in ("median", "ci_low", "ci_high", "ci_level", "cpu_median", "samples",
+                                   "cpu_samples", "peak_rss_kb", "allocations")}}
+        for run, s in zip(workloads["runs"], results)]
+    return stats
+
+
+def run_workloads(exe, workloads, warmup=DEFAULT_WARMUP, repetitions=DEFAULT_REPETITIONS, cwd=None,
+                  output_files=None, **kwargs):
+    """Benchmark exe on every workload of the matrix, returning combined statistics (None if one fails)."""
+    results = []
+    for run in workloads["runs"]:
+        env = dict(os.environ, **run["env"]) if run["env"] else None
+        stats = run_benchmark([exe] + run["args"], warmup=warmup, repetitions=repetitions, cwd=cwd, env=env,
+                              output_files=output_files, threads=run["threads"], **kwargs)
+        if stats is None:
+            print(f"⚠️  Workload {run['name']} failed")
+            return None
+        results.append(stats)
+    return combine(results, workloads)
+
+
+def format_workloads(stats):
+    """Scaling curve for logs and prompts, e.g. 'small 0.010s, large 1.230s, large @8t 0.210s'."""
+    if not stats or not stats.get("workloads"):
+        return ""
+    return ", ".join(f"{w['name']} {w['median']:.6f}s" for w in stats["workloads"])
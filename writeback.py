@@ -0,0 +1,196 @@
+import difflib
+import os
+import re
+import zipfile
+from utils import get_code
+
+# Write an optimized code state back into the project's own files instead of
+# one combined TU. Every extracted item has a location (file + byte range,
+# recorded by analyze.recursiveSearch); changed items are spliced into their
+# original spans and files without changes are left byte-identical.
+
+HEADER_EXTS = (".h", ".hpp", ".hxx", ".hh", ".H", ".inl")
+
+
+def _changed(original, optimized):
+    return optimized is not None and get_code(optimized).strip() != get_code(original).strip()
+
+
+def _edits(original_json, optimized_json, locations):
+    """(file, start, end, text) replacements of changed items, plus the items with no location."""
+    edits, added = [], []
+
+    functions = original_json.get("functions", {})
+    for name, code in optimized_json.get("functions", {}).items():
+        loc = locations["functions"].get(name)
+        if name not in functions or loc is None:
+            added.append((name, get_code(code)))
+        elif _changed(functions[name], code):
+            edits.append((loc["file"], loc["start"], loc["end"], get_code(code)))
+
+    classes = original_json.get("classes", {})
+    for name, data in optimized_json.get("classes", {}).items():
+        loc = locations["classes"].get(name)
+        if name not in classes or loc is None:
+            added.append((name, get_code(data)))
+            continue
+        original = classes[name]
+        definition = loc["definition"]
+        methods = data.get("methods", {}) if isinstance(data, dict) else {}
+        changed_methods = {m: get_code(c) for m, c in methods.items()
+                           if _changed(original["methods"].get(m, ""), c)}
+
+        if _changed(original["definition"], data.get("definition") if isinstance(data, dict) else data):
+            # The new definition replaces its inline methods; methods that were
+            # moved out of the class (Class::method) go right after it
+            outside = [c for c in changed_methods.values() if f"{name}::" in c.split("{")[0]]
+            if definition["file"].endswith(HEADER_EXTS):
+                outside = [c if re.match(r"\s*(inline|template)\b", c) else f"inline {c}" for c in outside]
+            text = "\n\n".join([get_code(data)] + outside)
+            edits.append((definition["file"], definition["start"], definition["end"], text))
+        else:
+            for m, code in changed_methods.items():
+                mloc = loc["methods"].get(m)
+                if mloc is None:
+                    # A new method has no span; it can only live in a changed definition
+                    continue
+                edits.append((mloc["file"], mloc["start"], mloc["end"], code))
+
+    return edits, added
+
+
+def _enclosing_start(file, start, locations):
+    """Start of the top-level class containing an offset (where new declarations can go)."""
+    for loc in locations["classes"].values():
+        d = loc["definition"]
+        if d["file"] == file and d["start"] <= start < d["end"]:
+            return d["start"]
+    return start
+
+
+def apply_changes(original_json, optimized_json, locations):
+    """New contents of every file the optimized code state changes, as {path: bytes}.
+
+    New functions and classes are inserted before the first changed code that
+    uses them, new system headers after the last #include of each changed file.
+    """
+    edits, added = _edits(original_json, optimized_json, locations)
+    if not edits and not added:
+        return {}
+
+    # Edits nested in an earlier edit (a method of a replaced class) are dropped
+    edits.sort(key=lambda e: (e[0], e[1], -e[2]))
+    kept = []
+    for e in edits:
+        if kept and kept[-1][0] == e[0] and e[1] < kept[-1][2]:
+            continue
+        kept.append(e)
+
+    inserts = []
+    for name, code in added:
+        pattern = re.compile(rf"\b{re.escape(name)}\b")
+        target = next((e for e in kept if pattern.search(e[3])), kept[0] if kept else None)
+        if target is None:
+            main = locations["functions"].get("main")
+            if main is None:
+                print(f"⚠️  No place to write new item {name}, skipping it")
+                continue
+            target = (main["file"], main["start"])
+        inserts.append((target[0], _enclosing_start(target[0], target[1], locations), code))
+
+    files = {}
+    for path in sorted({e[0] for e in kept} | {i[0] for i in inserts}):
+        with open(path, "rb") as f:
+            data = f.read()
+        splices = [(s, e, text.encode()) for p, s, e, text in kept if p == path]
+        splices += [(s, s, (code + "\n\n").encode()) for p, s, code in inserts if p == path]
+
+        # Apply from the end so earlier offsets stay valid
+        for s, e, text in sorted(splices, key=lambda x: (x[0], x[1]), reverse=True):
+            data = data[:s] + text + data[e:]
+        files[os.path.normpath(path)] = _add_headers(data, original_json, optimized_json)
+    return files
+
+
+def _add_headers(data, original_json, optimized_json):
+    """Add the system headers the optimized code state introduced to a changed file."""
+    new = [h for h in optimized_json.get("headers", []) if h not in set(original_json.get("headers", []))]
+    includes = []
+    for h in map(lambda h: get_code(h).strip(), new):
+        include = h if h.startswith("#") else f"#include <{h.strip('<>')}>"
+        if include.encode() not in data:
+            includes.append(include)
+    if not includes:
+        return data
+    last = None
+    for m in re.finditer(rb"^[ \t]*#[ \t]*include\b.*$", data, re.M):
+        last = m
+    pos = last.end() + 1 if last else 0
+    block = ("\n".join(includes) + "\n").encode()
+    return data[:pos] + block + data[pos:]
+
+
+def write_tree(layout, original_json, optimized_json, dest, clang_args=None):
+    """Materialize the optimized project under dest, returning (sources to compile, clang_args).
+
+    Unchanged files are symlinked, changed ones written, and include paths
+    into the project are redirected to dest.
+    """
+    root = layout["root"]
+    changed = apply_changes(original_json, optimized_json, layout["locations"])
+
+    for dirpath, dirs, files in os.walk(root):
+        dirs[:] = [d for d in dirs if not d.startswith('.') and d not in ['__pycache__', '__MACOSX']]
+        # Build files and data come along too, so the tree builds and runs like the original
+        for name in files:
+            src = os.path.normpath(os.path.join(dirpath, name))
+            target = os.path.join(dest, os.path.relpath(src, root))
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            if src in changed:
+                with open(target, "wb") as f:
+                    f.write(changed[src])
+            else:
+                os.symlink(os.path.abspath(src), target)
+
+    sources = [os.path.join(dest, os.path.relpath(fp, root)) for fp in layout["sources"]]
+    def redirect(arg):
+        for flag in ("-I", "-isystem", "-iquote", "-idirafter", "-include"):
+            if arg == f"{flag}{root}" or arg.startswith(f"{flag}{root}{os.sep}"):
+                return f"{flag}{dest}" + arg[len(flag) + len(root):]
+        return arg
+    args = [redirect(a) for a in clang_args or []]
+    return sources, args
+
+
+def write_zip(layout, original_json, optimized_json, zip_path):
+    """The whole project (build files and data included) with the optimizations applied; returns the changed paths."""
+    root = layout["root"]
+    changed = apply_changes(original_json, optimized_json, layout["locations"])
+    with zipfile.ZipFile(zip_path, "w", zipfile.ZIP_DEFLATED) as zf:
+        for dirpath, dirs, files in os.walk(root):
+            dirs[:] = sorted(d for d in dirs if not d.startswith('.') and d not in ['__pycache__', '__MACOSX'])
+            for name in sorted(files):
+                path = os.path.normpath(os.path.join(dirpath, name))
+                rel = os.path.relpath(path, root)
+                if path in changed:
+                    zf.writestr(rel, changed[path])
+                else:
+                    zf.write(path, rel)
+    return sorted(os.path.relpath(p, root) for p in changed)
+
+
+def write_patch(layout, original_json, optimized_json, patch_path):
+    """Unified diff of the changed files (apply with `git apply` or `patch -p1`); returns the changed paths."""
+    root = layout["root"]
+    changed = apply_changes(original_json, optimized_json, layout["locations"])
+    chunks = []
+    for path in sorted(changed):
+        rel = os.path.relpath(path, root).replace(os.sep, "/")
+        with open(path, "rb") as f:
+            before = f.read().decode(errors="replace").splitlines(keepends=True)
+        after = changed[path].decode(errors="replace").splitlines(keepends=True)
+        for line in difflib.unified_diff(before, after, f"a/{rel}", f"b/{rel}"):
+            chunks.append(line if line.endswith("\n") else line + "\n\\ No newline at end of file\n")
+    with open(patch_path, "w") as f:
+        f.write("".join(chunks))
+    return sorted(os.path.relpath(p, root) for p in changed)